@@ -0,0 +1,235 @@
+/*
+ * arrow.hpp
+ * Arrow IPC file (Feather v2) backend: each merge group as record batches
+ *  of non-null int32 columns, written straight from the mapped streams
+ */
+
+#ifndef ARROW_HPP_
+#define ARROW_HPP_
+
+#include <stdint.h>
+
+#include "data.hpp"
+#include "flatbuf.hpp"
+#include "sink.hpp"
+
+using namespace std;
+
+const char ARROW_MAGIC[6] = {'A', 'R', 'R', 'O', 'W', '1'};
+
+//Message.fbs / Schema.fbs constants
+const int ARROW_METADATA_V5 = 4;
+const int ARROW_HEADER_SCHEMA = 1;
+const int ARROW_HEADER_RECORD_BATCH = 3;
+const int ARROW_TYPE_INT = 2;
+//body buffers are padded to this (Arrow recommends 64 byte alignment)
+const size_t ARROW_ALIGN = 64;
+
+/**
+ * @brief Write a Schema table of non-nullable signed int32 fields
+ * @returns the table position
+ */
+size_t arrow_schema(FlatWriter &w, const vector<string> &names) {
+	vector<FlatField> f;
+	vector<size_t> at;
+	f.push_back(flat_offset(1));
+	size_t schema = w.table(f, at);
+
+	vector<size_t> fields;
+	w.link(at[1], w.offset_vector(names.size(), fields));
+	for (unsigned i = 0; i < names.size(); ++i) {
+		//Field: name, nullable, type_type, type, children
+		f.clear();
+		f.push_back(flat_offset(0));
+		f.push_back(flat_scalar(1, 1, 0));
+		f.push_back(flat_scalar(2, 1, ARROW_TYPE_INT));
+		f.push_back(flat_offset(3));
+		f.push_back(flat_offset(5));
+		vector<size_t> fat;
+		w.link(fields[i], w.table(f, fat));
+		w.link(fat[0], w.str(names[i]));
+
+		//Int: bitWidth, is_signed
+		f.clear();
+		f.push_back(flat_scalar(0, 4, 32));
+		f.push_back(flat_scalar(1, 1, 1));
+		vector<size_t> iat;
+		w.link(fat[3], w.table(f, iat));
+
+		vector<size_t> none;
+		w.link(fat[5], w.offset_vector(0, none));
+	}
+	return schema;
+}
+
+/**
+ * @brief Start a Message flatbuffer
+ * @returns position of the header offset, to link to the header table
+ */
+size_t arrow_message(FlatWriter &w, int header_type, uint64_t bodylen) {
+	size_t root = w.root();
+	vector<FlatField> f;
+	vector<size_t> at;
+	f.push_back(flat_scalar(0, 2, ARROW_METADATA_V5));
+	f.push_back(flat_scalar(1, 1, header_type));
+	f.push_back(flat_offset(2));
+	f.push_back(flat_scalar(3, 8, bodylen));
+	w.link(root, w.table(f, at));
+	return at[2];
+}
+
+size_t arrow_padded(size_t n) {
+	return (n + ARROW_ALIGN - 1) / ARROW_ALIGN * ARROW_ALIGN;
+}
+
+/**
+ * Writes each merge group as output-N.arrow, one record batch per --rows
+ *  block. Column data goes from the block (usually the mapped stream
+ *  itself) to the file without an intermediate copy.
+ */
+class ArrowSink : public GroupSink {
+private:
+	string output;
+	ofstream out;
+	vector<string> names;
+	//(offset, metadata length, body length) per record batch, for the footer
+	vector<uint64_t> blocks;
+
+	/**
+	 * @brief Write an encapsulated message: continuation marker, metadata
+	 *  length, metadata padded to 8 bytes
+	 * @returns the metadata length including the 8 byte prefix
+	 */
+	uint32_t write_message(FlatWriter &w) {
+		w.pad_to(8);
+		uint32_t len = w.buf.size();
+		write_pod(out, (uint32_t) 0xFFFFFFFF);
+		write_pod(out, len);
+		out.write((const char*) &w.buf[0], len);
+		return len + 8;
+	}
+
+	void write_zeros(size_t n) {
+		static const char zeros[ARROW_ALIGN] = {0};
+		out.write(zeros, n);
+	}
+
+public:
+	uint64_t totalbytes;
+
+	ArrowSink(const char *_output) : output(_output), totalbytes(0) {}
+
+	const char* name() const {
+		return "arrow";
+	}
+
+	void begin_group(int groupdx, const string &key, const GroupReader &group) {
+		stringstream name;
+		name << output << "-" << groupdx << ".arrow";
+		out.open(name.str().c_str(), ios::binary | ios::out | ios::trunc);
+		out.write(ARROW_MAGIC, 6);
+		write_zeros(2);
+
+		names.assign(1, "ts");
+		names.insert(names.end(), group.columns.begin(), group.columns.end());
+		blocks.clear();
+
+		FlatWriter w;
+		size_t header = arrow_message(w, ARROW_HEADER_SCHEMA, 0);
+		w.link(header, arrow_schema(w, names));
+		write_message(w);
+	}
+
+	void write_block(const GroupBlock &blk) {
+		size_t buflen = blk.nrows * sizeof(int32_t);
+		size_t padded = arrow_padded(buflen);
+		uint64_t bodylen = padded * names.size();
+
+		FlatWriter w;
+		size_t header = arrow_message(w, ARROW_HEADER_RECORD_BATCH, bodylen);
+
+		//RecordBatch: length, nodes, buffers
+		vector<FlatField> f;
+		vector<size_t> at;
+		f.push_back(flat_scalar(0, 8, blk.nrows));
+		f.push_back(flat_offset(1));
+		f.push_back(flat_offset(2));
+		w.link(header, w.table(f, at));
+
+		//FieldNode (length, null count) per column
+		vector<uint64_t> nodes;
+		for (unsigned c = 0; c < names.size(); ++c) {
+			nodes.push_back(blk.nrows);
+			nodes.push_back(0);
+		}
+		w.link(at[1], w.struct_vector(nodes, names.size()));
+
+		//Buffer (offset, length): an empty validity bitmap, then the values
+		vector<uint64_t> buffers;
+		for (unsigned c = 0; c < names.size(); ++c) {
+			buffers.push_back(c * padded);
+			buffers.push_back(0);
+			buffers.push_back(c * padded);
+			buffers.push_back(buflen);
+		}
+		w.link(at[2], w.struct_vector(buffers, 2 * names.size()));
+
+		blocks.push_back(out.tellp());
+		blocks.push_back(write_message(w));
+		blocks.push_back(bodylen);
+
+		out.write((const char*) blk.ts, buflen);
+		write_zeros(padded - buflen);
+		for (unsigned i = 0; i < blk.vals.size(); ++i) {
+			out.write((const char*) blk.vals[i], buflen);
+			write_zeros(padded - buflen);
+		}
+	}
+
+	void end_group() {
+		//end of stream marker
+		write_pod(out, (uint32_t) 0xFFFFFFFF);
+		write_pod(out, (uint32_t) 0);
+
+		//Footer: version, schema, record batch blocks
+		FlatWriter w;
+		size_t root = w.root();
+		vector<FlatField> f;
+		vector<size_t> at;
+		f.push_back(flat_scalar(0, 2, ARROW_METADATA_V5));
+		f.push_back(flat_offset(1));
+		f.push_back(flat_offset(3));
+		w.link(root, w.table(f, at));
+		w.link(at[1], arrow_schema(w, names));
+		w.link(at[3], w.struct_vector(blocks, blocks.size() / 3));
+
+		out.write((const char*) &w.buf[0], w.buf.size());
+		write_pod(out, (uint32_t) w.buf.size());
+		out.write(ARROW_MAGIC, 6);
+		totalbytes += out.tellp();
+		out.close();
+	}
+
+	void finish() {
+		cerr << "arrow bytes " << totalbytes << endl;
+	}
+};
+
+void insert_arrow_multi(DataMulti data, int twidth, int vwidth, const char *output) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "arrow only supports 4 byte samples" << endl;
+		return;
+	}
+
+	ArrowSink arrow(output);
+	vector<GroupSink*> sinks(1, &arrow);
+	run_sinks(data, sinks);
+}
+
+void test_arrow_multi() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	insert_arrow_multi(data, 4, 4, "out-arrow");
+}
+
+#endif /* ARROW_HPP_ */
@@ -0,0 +1,51 @@
+/**
+ * Micro-benchmarks of the hot paths, written as JSON (bin/bench)
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "microbench.hpp"
+
+void usage(char** argv) {
+	cout << "Usage: " << argv[0] << " [tsdir vsdir mergemap] [--options]" << endl;
+	cout << "  benchmarks reading .ts/.vs streams with ifstream, mmap and pread, each" << endl;
+	cout << "  codec's encode and decode, integer formatting and sqlite bind/step," << endl;
+	cout << "  on the ts and vs streams of a dataset, or on synthetic series if none" << endl;
+	cout << "  --blocks=4096,65536,1048576 bytes per read, values per codec block and" << endl;
+	cout << "    rows per sqlite transaction" << endl;
+	cout << "  --values=N values per source for the in-memory benchmarks (1048576)" << endl;
+	cout << "  --sqlite_rows=N rows per sqlite benchmark (262144)" << endl;
+	cout << "  --filter=S runs only benchmarks whose name contains S" << endl;
+	cout << "    (names are group/method/[block/]source, e.g. codec/s8b/decode/65536/vs)" << endl;
+	cout << "  --min_time=S seconds per benchmark (0.5)" << endl;
+	cout << "  --out=file writes the JSON there instead of to stdout" << endl;
+	cout << "  --tmpdir=dir for the synthetic series files (/tmp)" << endl;
+}
+
+int main(int argc, char** argv) {
+	argc = parse_options(argc, argv);
+	vector<BenchSource> sources;
+	string description;
+	if (4 == argc) {
+		DataMulti data(argv[1], argv[2], getMergeMap(argv[3]));
+		sources = dataset_bench_sources(data);
+		description = string(argv[1]) + " " + argv[2];
+	} else if (1 == argc) {
+		sources = synthetic_bench_sources();
+		description = "synthetic";
+	} else {
+		usage(argv);
+		return 1;
+	}
+
+	if (has_opt("out")) {
+		ofstream out(opt_str("out", "").c_str(), ios::out | ios::trunc);
+		print_microbench(sources, description, out);
+	} else {
+		print_microbench(sources, description, cout);
+	}
+	return 0;
+}
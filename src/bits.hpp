@@ -0,0 +1,132 @@
+/*
+ * bits.hpp
+ * Varints and bit packing shared by the codecs
+ */
+
+#ifndef BITS_HPP_
+#define BITS_HPP_
+
+#include <stdint.h>
+
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+void put_varint(vector<uint8_t> &out, uint32_t v) {
+	while (v >= 0x80) {
+		out.push_back((uint8_t) (v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t) v);
+}
+
+uint32_t get_varint(const uint8_t *&p) {
+	uint32_t v = 0;
+	int shift = 0;
+	while (*p & 0x80) {
+		v |= (uint32_t) (*p++ & 0x7f) << shift;
+		shift += 7;
+	}
+	v |= (uint32_t) (*p++) << shift;
+	return v;
+}
+
+void put_u32(vector<uint8_t> &out, uint32_t v) {
+	size_t at = out.size();
+	out.resize(at + 4);
+	memcpy(&out[at], &v, 4);
+}
+
+uint32_t get_u32(const uint8_t *&p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	p += 4;
+	return v;
+}
+
+/**
+ * LSB-first bit packer appending to a byte vector
+ */
+class BitWriter {
+private:
+	vector<uint8_t> &out;
+	uint64_t acc;
+	int nbits;
+
+public:
+	BitWriter(vector<uint8_t> &_out) : out(_out), acc(0), nbits(0) {}
+
+	void put(uint32_t v, int width) {
+		if (0 == width) {
+			return;
+		}
+		acc |= (uint64_t) (v & (0xffffffffULL >> (32 - width))) << nbits;
+		nbits += width;
+		while (nbits >= 8) {
+			out.push_back((uint8_t) acc);
+			acc >>= 8;
+			nbits -= 8;
+		}
+	}
+
+	void flush() {
+		if (nbits > 0) {
+			out.push_back((uint8_t) acc);
+		}
+		acc = 0;
+		nbits = 0;
+	}
+};
+
+class BitReader {
+private:
+	const uint8_t *p;
+	uint64_t acc;
+	int nbits;
+
+public:
+	BitReader(const uint8_t *_p) : p(_p), acc(0), nbits(0) {}
+
+	uint32_t get(int width) {
+		if (0 == width) {
+			return 0;
+		}
+		while (nbits < width) {
+			acc |= (uint64_t) (*p++) << nbits;
+			nbits += 8;
+		}
+		uint32_t v = (uint32_t) (acc & (0xffffffffULL >> (32 - width)));
+		acc >>= width;
+		nbits -= width;
+		return v;
+	}
+
+	/**
+	 * @returns first byte past the last one consumed
+	 */
+	const uint8_t* pos() const {
+		return p;
+	}
+};
+
+/**
+ * Fixed-width bit packing of n values
+ */
+void pack_bits(const uint32_t *in, size_t n, int width, vector<uint8_t> &out) {
+	BitWriter bw(out);
+	for (size_t i = 0; i < n; ++i) {
+		bw.put(in[i], width);
+	}
+	bw.flush();
+}
+
+const uint8_t* unpack_bits(const uint8_t *in, size_t n, int width, uint32_t *out) {
+	BitReader br(in);
+	for (size_t i = 0; i < n; ++i) {
+		out[i] = br.get(width);
+	}
+	return br.pos();
+}
+
+#endif /* BITS_HPP_ */
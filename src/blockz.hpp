@@ -0,0 +1,179 @@
+/*
+ * blockz.hpp
+ * In-tree LZ77 block compressor (LZ4-style sequences, hash chain match
+ *  search whose depth grows with the level)
+ */
+
+#ifndef BLOCKZ_HPP_
+#define BLOCKZ_HPP_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+const int BLOCKZ_MIN_MATCH = 4;
+const int BLOCKZ_HASH_BITS = 16;
+const size_t BLOCKZ_WINDOW = 65535;
+const int BLOCKZ_MAX_LEVEL = 9;
+
+uint32_t blockz_hash(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return (v * 2654435761U) >> (32 - BLOCKZ_HASH_BITS);
+}
+
+void blockz_put_len(vector<uint8_t> &out, size_t len) {
+	while (len >= 255) {
+		out.push_back(255);
+		len -= 255;
+	}
+	out.push_back((uint8_t) len);
+}
+
+/**
+ * @brief One sequence: token (literal length << 4 | match length - 4,
+ *  each nibble 15 meaning "more length bytes follow"), literals, then a
+ *  16-bit offset unless this is the final literal-only sequence
+ */
+void blockz_sequence(vector<uint8_t> &out, const uint8_t *lit, size_t nlit,
+		size_t offset, size_t matchlen) {
+	size_t mcode = matchlen ? matchlen - BLOCKZ_MIN_MATCH : 0;
+	out.push_back((uint8_t) ((min(nlit, (size_t) 15) << 4) | min(mcode, (size_t) 15)));
+	if (nlit >= 15) {
+		blockz_put_len(out, nlit - 15);
+	}
+	out.insert(out.end(), lit, lit + nlit);
+	if (matchlen) {
+		out.push_back((uint8_t) offset);
+		out.push_back((uint8_t) (offset >> 8));
+		if (mcode >= 15) {
+			blockz_put_len(out, mcode - 15);
+		}
+	}
+}
+
+/**
+ * @brief Compress n bytes, appending to out
+ * @param level 1 (one probe per position) to BLOCKZ_MAX_LEVEL (deep chain)
+ */
+void blockz_compress(const uint8_t *in, size_t n, vector<uint8_t> &out, int level) {
+	level = max(1, min(level, BLOCKZ_MAX_LEVEL));
+	int depth = 1 << (level - 1);
+
+	vector<int32_t> head(1 << BLOCKZ_HASH_BITS, -1);
+	vector<int32_t> chain(n);
+
+	size_t anchor = 0;
+	size_t i = 0;
+	//leave a literal tail so matches never run to the very end
+	size_t limit = n > 12 ? n - 12 : 0;
+	while (i < limit) {
+		uint32_t h = blockz_hash(in + i);
+		size_t bestlen = 0;
+		size_t bestoff = 0;
+		int32_t cand = head[h];
+		for (int d = 0; d < depth && cand >= 0 && i - cand <= BLOCKZ_WINDOW; ++d) {
+			size_t len = 0;
+			size_t maxlen = n - 5 - i;
+			while (len < maxlen && in[cand + len] == in[i + len]) {
+				++len;
+			}
+			if (len > bestlen) {
+				bestlen = len;
+				bestoff = i - cand;
+			}
+			cand = chain[cand];
+		}
+		chain[i] = head[h];
+		head[h] = i;
+
+		if (bestlen < (size_t) BLOCKZ_MIN_MATCH) {
+			++i;
+			continue;
+		}
+
+		blockz_sequence(out, in + anchor, i - anchor, bestoff, bestlen);
+		//index the positions inside the match so later data can refer to it
+		size_t end = i + bestlen;
+		for (++i; i < end && i < limit; ++i) {
+			uint32_t hh = blockz_hash(in + i);
+			chain[i] = head[hh];
+			head[hh] = i;
+		}
+		i = end;
+		anchor = i;
+	}
+	blockz_sequence(out, in + anchor, n - anchor, 0, 0);
+}
+
+/**
+ * @brief Decompress into out, which must hold exactly outlen bytes
+ * @returns true if the input decoded to exactly outlen bytes
+ */
+bool blockz_decompress(const uint8_t *in, size_t n, uint8_t *out, size_t outlen) {
+	const uint8_t *p = in;
+	const uint8_t *end = in + n;
+	size_t o = 0;
+	while (p < end) {
+		uint8_t token = *p++;
+		size_t nlit = token >> 4;
+		if (nlit == 15) {
+			uint8_t b;
+			do {
+				if (p >= end) {
+					return false;
+				}
+				b = *p++;
+				nlit += b;
+			} while (b == 255);
+		}
+		if (nlit > (size_t) (end - p) || nlit > outlen - o) {
+			return false;
+		}
+		memcpy(out + o, p, nlit);
+		p += nlit;
+		o += nlit;
+		if (p == end) {
+			break;
+		}
+
+		if (end - p < 2) {
+			return false;
+		}
+		size_t offset = p[0] | (p[1] << 8);
+		p += 2;
+		size_t mlen = token & 15;
+		if (mlen == 15) {
+			uint8_t b;
+			do {
+				if (p >= end) {
+					return false;
+				}
+				b = *p++;
+				mlen += b;
+			} while (b == 255);
+		}
+		mlen += BLOCKZ_MIN_MATCH;
+		if (0 == offset || offset > o || mlen > outlen - o) {
+			return false;
+		}
+		//overlapping matches (offset < length) repeat a pattern and
+		// must be copied byte by byte
+		const uint8_t *src = out + o - offset;
+		if (offset >= mlen) {
+			memcpy(out + o, src, mlen);
+		} else {
+			for (size_t k = 0; k < mlen; ++k) {
+				out[o + k] = src[k];
+			}
+		}
+		o += mlen;
+	}
+	return o == outlen;
+}
+
+#endif /* BLOCKZ_HPP_ */
@@ -0,0 +1,347 @@
+/*
+ * catalog.hpp
+ * On-disk binary cache of directory listings and per-stream summaries
+ */
+
+#ifndef CATALOG_HPP_
+#define CATALOG_HPP_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "dirscan.hpp"
+#include "mapped.hpp"
+#include "options.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+
+const char CATALOG_MAGIC[8] = {'T', 'S', 'C', 'A', 'T', '0', '0', '1'};
+const char MERGEMAP_MAGIC[8] = {'T', 'S', 'M', 'M', 'C', '0', '0', '1'};
+
+bool ends_with(const string &s, const char *suffix) {
+	size_t n = strlen(suffix);
+	return s.length() >= n && 0 == s.compare(s.length() - n, n, suffix);
+}
+
+/**
+ * @returns where the cache for an input directory or mergemap lives: in
+ *  --catalog_dir (default: the working directory, where outputs go), never
+ *  next to or inside the input, which may be read-only. The file is named
+ *  for the input's base name and a hash of its absolute path.
+ */
+string catalog_path(const char *input) {
+	string path(input);
+	char *abs = realpath(input, NULL);
+	if (abs) {
+		path = abs;
+		free(abs);
+	}
+	while (path.length() > 1 && path[path.length() - 1] == '/') {
+		path.erase(path.length() - 1);
+	}
+
+	//FNV-1a
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t c = 0; c < path.size(); ++c) {
+		h = (h ^ (uint8_t) path[c]) * 1099511628211ULL;
+	}
+	char hex[20];
+	sprintf(hex, "-%016llx", (unsigned long long) h);
+
+	string dir = opt_str("catalog_dir", ".");
+	mkdir(dir.c_str(), 0777);
+	return dir + "/" + path.substr(path.rfind('/') + 1) + hex + ".catalog";
+}
+
+template <class T>
+void write_pod(ostream &out, const T &v) {
+	out.write((const char*) &v, sizeof(T));
+}
+
+template <class T>
+bool read_pod(istream &in, T &v) {
+	in.read((char*) &v, sizeof(T));
+	return in.good();
+}
+
+void write_str(ostream &out, const string &s) {
+	uint32_t len = s.length();
+	write_pod(out, len);
+	out.write(s.data(), len);
+}
+
+bool read_str(istream &in, string &s) {
+	uint32_t len;
+	if (!read_pod(in, len) || len > (1 << 20)) {
+		return false;
+	}
+	s.resize(len);
+	if (len > 0) {
+		in.read(&s[0], len);
+	}
+	return in.good();
+}
+
+/**
+ * Summary of one file in a stream directory
+ */
+struct CatalogEntry {
+	uint64_t size;
+	int64_t mtime;
+	//only filled in for .ts/.vs files
+	uint64_t nsamples;
+	int32_t mints;
+	int32_t maxts;
+};
+
+/**
+ * @brief Summarize a binary stream of 4-byte samples
+ */
+void scan_catalog_entry(const string &fname, CatalogEntry &ent) {
+	ent.nsamples = 0;
+	ent.mints = 0;
+	ent.maxts = 0;
+
+	MappedFile f(fname.c_str());
+	if (!f.ok) {
+		return;
+	}
+	const int32_t *vals = (const int32_t*) f.data;
+	size_t n = f.size / sizeof(int32_t);
+	int32_t lo = n ? vals[0] : 0;
+	int32_t hi = lo;
+	for (size_t i = 1; i < n; ++i) {
+		lo = min(lo, vals[i]);
+		hi = max(hi, vals[i]);
+	}
+	ent.nsamples = n;
+	ent.mints = lo;
+	ent.maxts = hi;
+}
+
+struct CatalogScanner {
+	const vector<ScanEntry> *changed;
+	map<string, CatalogEntry> *fresh;
+	void operator()(size_t i) {
+		const ScanEntry &se = (*changed)[i];
+		//entries already exist, so concurrent finds don't modify the map
+		scan_catalog_entry(se.path(), fresh->find(se.name)->second);
+	}
+};
+
+/**
+ * Directory listing with per-file size, mtime and sample summaries,
+ *  persisted to catalog_path(dir) and revalidated by mtime.
+ * --catalog=on (default) | off | trust (skip per-file stats when the
+ *  directory itself is unchanged) | rebuild
+ */
+class Catalog {
+private:
+	int64_t dirmtime;
+
+	bool load(const string &path) {
+		ifstream in(path.c_str(), ios::binary | ios::in);
+		char magic[8];
+		in.read(magic, 8);
+		if (!in.good() || 0 != memcmp(magic, CATALOG_MAGIC, 8)) {
+			return false;
+		}
+		uint64_t count;
+		if (!read_pod(in, dirmtime) || !read_pod(in, count)) {
+			return false;
+		}
+		string name;
+		CatalogEntry ent;
+		for (uint64_t i = 0; i < count; ++i) {
+			if (!read_str(in, name) || !read_pod(in, ent)) {
+				entries.clear();
+				return false;
+			}
+			entries.insert(entries.end(), make_pair(name, ent));
+		}
+		return true;
+	}
+
+	void save(const string &path) {
+		string tmp = path + ".tmp";
+		ofstream out(tmp.c_str(), ios::binary | ios::out | ios::trunc);
+		out.write(CATALOG_MAGIC, 8);
+		write_pod(out, dirmtime);
+		write_pod(out, (uint64_t) entries.size());
+		for (map<string, CatalogEntry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+			write_str(out, it->first);
+			write_pod(out, it->second);
+		}
+		out.close();
+		if (!out.good() || 0 != rename(tmp.c_str(), path.c_str())) {
+			cerr << "Warning: couldn't write catalog " << path << endl;
+			unlink(tmp.c_str());
+		}
+	}
+
+public:
+	//file name (with extension) -> summary
+	map<string, CatalogEntry> entries;
+
+	Catalog() : dirmtime(0) {}
+
+	/**
+	 * @brief Bring the catalog for dir up to date, rescanning only what changed
+	 * @returns false if dir couldn't be read
+	 */
+	bool refresh(const char *dir) {
+		string mode = opt_str("catalog", "on");
+		string path = catalog_path(dir);
+
+		struct stat dst;
+		if (0 != stat(dir, &dst)) {
+			return false;
+		}
+
+		entries.clear();
+		bool cached = (mode == "on" || mode == "trust") && load(path);
+		bool listing_ok = cached && dirmtime == stat_mtime_ns(dst);
+		bool dirty = !listing_ok;
+
+		vector<ScanEntry> listed;
+		if (listing_ok) {
+			if (mode == "trust") {
+				return true;
+			}
+			ScanEntry ent;
+			ent.dir = dir;
+			ent.statted = false;
+			for (map<string, CatalogEntry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+				ent.name = it->first;
+				listed.push_back(ent);
+			}
+		} else {
+			list_dir_entries(dir, listed);
+		}
+		unsigned nthreads = default_threads();
+		stat_entries(listed, nthreads);
+
+		map<string, CatalogEntry> fresh;
+		vector<ScanEntry> changed;
+		for (unsigned i = 0; i < listed.size(); ++i) {
+			const ScanEntry &se = listed[i];
+			if (!se.statted || se.type != DT_REG) {
+				dirty = true;
+				continue;
+			}
+
+			CatalogEntry ent;
+			ent.size = se.size;
+			ent.mtime = se.mtime;
+			ent.nsamples = 0;
+			ent.mints = 0;
+			ent.maxts = 0;
+
+			map<string, CatalogEntry>::const_iterator old = entries.find(se.name);
+			if (old != entries.end() && old->second.size == se.size &&
+					old->second.mtime == se.mtime) {
+				ent = old->second;
+			} else if (ends_with(se.name, ".ts") || ends_with(se.name, ".vs")) {
+				changed.push_back(se);
+				dirty = true;
+			} else {
+				dirty = true;
+			}
+			fresh[se.name] = ent;
+		}
+
+		//summarize new and modified streams in parallel
+		CatalogScanner scanner;
+		scanner.changed = &changed;
+		scanner.fresh = &fresh;
+		parallel_for(changed.size(), scanner, nthreads);
+
+		entries.swap(fresh);
+		dirmtime = stat_mtime_ns(dst);
+		if (dirty && mode != "off") {
+			save(path);
+		}
+		return true;
+	}
+
+	const CatalogEntry* find(const string &fname) const {
+		map<string, CatalogEntry>::const_iterator it = entries.find(fname);
+		return (it == entries.end()) ? NULL : &it->second;
+	}
+};
+
+/**
+ * @brief Load a cached mergemap parse if the source's size and mtime match
+ */
+bool load_mergemap_cache(const char *fname, const struct stat &src,
+		map<string, set<string> > &themap) {
+	if (opt_str("catalog", "on") == "off" || opt_str("catalog", "on") == "rebuild") {
+		return false;
+	}
+	string path = catalog_path(fname);
+	ifstream in(path.c_str(), ios::binary | ios::in);
+	char magic[8];
+	in.read(magic, 8);
+	if (!in.good() || 0 != memcmp(magic, MERGEMAP_MAGIC, 8)) {
+		return false;
+	}
+	uint64_t size, ngroups;
+	int64_t mtime;
+	if (!read_pod(in, size) || !read_pod(in, mtime) || !read_pod(in, ngroups) ||
+			size != (uint64_t) src.st_size || mtime != stat_mtime_ns(src)) {
+		return false;
+	}
+	string key, member;
+	for (uint64_t g = 0; g < ngroups; ++g) {
+		uint32_t nmembers;
+		if (!read_str(in, key) || !read_pod(in, nmembers)) {
+			themap.clear();
+			return false;
+		}
+		set<string> &members = themap.insert(themap.end(), make_pair(key, set<string>()))->second;
+		for (uint32_t m = 0; m < nmembers; ++m) {
+			if (!read_str(in, member)) {
+				themap.clear();
+				return false;
+			}
+			members.insert(members.end(), member);
+		}
+	}
+	return true;
+}
+
+void save_mergemap_cache(const char *fname, const struct stat &src,
+		const map<string, set<string> > &themap) {
+	if (opt_str("catalog", "on") == "off") {
+		return;
+	}
+	string path = catalog_path(fname);
+	string tmp = path + ".tmp";
+	ofstream out(tmp.c_str(), ios::binary | ios::out | ios::trunc);
+	out.write(MERGEMAP_MAGIC, 8);
+	write_pod(out, (uint64_t) src.st_size);
+	write_pod(out, stat_mtime_ns(src));
+	write_pod(out, (uint64_t) themap.size());
+	for (map<string, set<string> >::const_iterator it = themap.begin(); it != themap.end(); ++it) {
+		write_str(out, it->first);
+		write_pod(out, (uint32_t) it->second.size());
+		for (set<string>::const_iterator sit = it->second.begin(); sit != it->second.end(); ++sit) {
+			write_str(out, *sit);
+		}
+	}
+	out.close();
+	if (!out.good() || 0 != rename(tmp.c_str(), path.c_str())) {
+		unlink(tmp.c_str());
+	}
+}
+
+#endif /* CATALOG_HPP_ */
@@ -0,0 +1,805 @@
+/*
+ * codec.hpp
+ * Integer block codecs and adaptive per-block codec selection
+ */
+
+#ifndef CODEC_HPP_
+#define CODEC_HPP_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bits.hpp"
+#include "dict.hpp"
+#include "stats.hpp"
+
+using namespace std;
+
+/**
+ * An integer block codec. encode appends; decode reads exactly n values.
+ */
+class Codec {
+public:
+	virtual ~Codec() {}
+	virtual const char* name() const = 0;
+	/**
+	 * Relative decode cost, lower is faster. choose_codec uses this to
+	 *  trade size for decode speed.
+	 */
+	virtual int decode_cost() const = 0;
+	virtual void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const = 0;
+	/**
+	 * @returns bytes consumed
+	 */
+	virtual size_t decode(const uint8_t *in, size_t n, int32_t *out) const = 0;
+};
+
+class RawCodec : public Codec {
+public:
+	const char* name() const { return "raw"; }
+	int decode_cost() const { return 0; }
+	void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const {
+		size_t at = out.size();
+		out.resize(at + n * 4);
+		if (n) {
+			memcpy(&out[at], in, n * 4);
+		}
+	}
+	size_t decode(const uint8_t *in, size_t n, int32_t *out) const {
+		memcpy(out, in, n * 4);
+		return n * 4;
+	}
+};
+
+class VarintCodec : public Codec {
+public:
+	const char* name() const { return "varint"; }
+	int decode_cost() const { return 2; }
+	void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const {
+		for (size_t i = 0; i < n; ++i) {
+			put_varint(out, zigzag(in[i]));
+		}
+	}
+	size_t decode(const uint8_t *in, size_t n, int32_t *out) const {
+		const uint8_t *p = in;
+		for (size_t i = 0; i < n; ++i) {
+			out[i] = unzigzag(get_varint(p));
+		}
+		return p - in;
+	}
+};
+
+class DeltaCodec : public Codec {
+public:
+	const char* name() const { return "delta"; }
+	int decode_cost() const { return 3; }
+	void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const {
+		uint32_t prev = 0;
+		for (size_t i = 0; i < n; ++i) {
+			put_varint(out, zigzag((int32_t) ((uint32_t) in[i] - prev)));
+			prev = in[i];
+		}
+	}
+	size_t decode(const uint8_t *in, size_t n, int32_t *out) const {
+		const uint8_t *p = in;
+		uint32_t prev = 0;
+		for (size_t i = 0; i < n; ++i) {
+			prev += (uint32_t) unzigzag(get_varint(p));
+			out[i] = (int32_t) prev;
+		}
+		return p - in;
+	}
+};
+
+class DeltaOfDeltaCodec : public Codec {
+public:
+	const char* name() const { return "dod"; }
+	int decode_cost() const { return 4; }
+	void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const {
+		uint32_t prev = 0;
+		uint32_t prevdelta = 0;
+		for (size_t i = 0; i < n; ++i) {
+			uint32_t delta = (uint32_t) in[i] - prev;
+			put_varint(out, zigzag((int32_t) (delta - prevdelta)));
+			prevdelta = delta;
+			prev = in[i];
+		}
+	}
+	size_t decode(const uint8_t *in, size_t n, int32_t *out) const {
+		const uint8_t *p = in;
+		uint32_t prev = 0;
+		uint32_t delta = 0;
+		for (size_t i = 0; i < n; ++i) {
+			delta += (uint32_t) unzigzag(get_varint(p));
+			prev += delta;
+			out[i] = (int32_t) prev;
+		}
+		return p - in;
+	}
+};
+
+/**
+ * (value, run length) pairs
+ */
+class RleCodec : public Codec {
+public:
+	const char* name() const { return "rle"; }
+	int decode_cost() const { return 1; }
+	void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const {
+		size_t i = 0;
+		while (i < n) {
+			size_t j = i + 1;
+			while (j < n && in[j] == in[i]) {
+				++j;
+			}
+			put_varint(out, zigzag(in[i]));
+			put_varint(out, j - i);
+			i = j;
+		}
+	}
+	size_t decode(const uint8_t *in, size_t n, int32_t *out) const {
+		const uint8_t *p = in;
+		size_t i = 0;
+		while (i < n) {
+			int32_t v = unzigzag(get_varint(p));
+			uint32_t run = get_varint(p);
+			for (uint32_t r = 0; r < run && i < n; ++r) {
+				out[i++] = v;
+			}
+		}
+		return p - in;
+	}
+};
+
+/**
+ * Frame of reference: block minimum, then (v - min) bit packed
+ */
+class ForCodec : public Codec {
+public:
+	const char* name() const { return "for"; }
+	int decode_cost() const { return 1; }
+	void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const {
+		int32_t lo = n ? in[0] : 0;
+		int32_t hi = lo;
+		for (size_t i = 1; i < n; ++i) {
+			lo = min(lo, in[i]);
+			hi = max(hi, in[i]);
+		}
+		int width = bit_width((uint32_t) hi - (uint32_t) lo);
+		put_u32(out, (uint32_t) lo);
+		out.push_back((uint8_t) width);
+		vector<uint32_t> offs(n);
+		for (size_t i = 0; i < n; ++i) {
+			offs[i] = (uint32_t) in[i] - (uint32_t) lo;
+		}
+		pack_bits(n ? &offs[0] : NULL, n, width, out);
+	}
+	size_t decode(const uint8_t *in, size_t n, int32_t *out) const {
+		const uint8_t *p = in;
+		uint32_t lo = get_u32(p);
+		int width = *p++;
+		p = unpack_bits(p, n, width, (uint32_t*) out);
+		for (size_t i = 0; i < n; ++i) {
+			out[i] = (int32_t) ((uint32_t) out[i] + lo);
+		}
+		return p - in;
+	}
+};
+
+/**
+ * Gorilla-style XOR against the previous value: a 0 bit for repeats,
+ *  otherwise the meaningful bits, reusing the previous window when they fit
+ */
+class XorCodec : public Codec {
+public:
+	const char* name() const { return "xor"; }
+	int decode_cost() const { return 5; }
+	void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const {
+		BitWriter bw(out);
+		uint32_t prev = 0;
+		int lead = -1;
+		int len = 0;
+		for (size_t i = 0; i < n; ++i) {
+			uint32_t x = (uint32_t) in[i] ^ prev;
+			prev = in[i];
+			if (0 == x) {
+				bw.put(0, 1);
+				continue;
+			}
+			int l = __builtin_clz(x);
+			int t = __builtin_ctz(x);
+			if (lead >= 0 && l >= lead && t >= 32 - lead - len) {
+				bw.put(1, 1);
+				bw.put(0, 1);
+				bw.put(x >> (32 - lead - len), len);
+			} else {
+				lead = l;
+				len = 32 - l - t;
+				bw.put(1, 1);
+				bw.put(1, 1);
+				bw.put(lead, 5);
+				bw.put(len - 1, 5);
+				bw.put(x >> t, len);
+			}
+		}
+		bw.flush();
+	}
+	size_t decode(const uint8_t *in, size_t n, int32_t *out) const {
+		BitReader br(in);
+		uint32_t prev = 0;
+		int lead = 0;
+		int len = 0;
+		for (size_t i = 0; i < n; ++i) {
+			if (br.get(1)) {
+				if (br.get(1)) {
+					lead = br.get(5);
+					len = br.get(5) + 1;
+				}
+				prev ^= br.get(len) << (32 - lead - len);
+			}
+			out[i] = (int32_t) prev;
+		}
+		return br.pos() - in;
+	}
+};
+
+/**
+ * Sorted dictionary plus bit packed codes, see dict.hpp
+ */
+class DictCodec : public Codec {
+public:
+	const char* name() const { return "dict"; }
+	int decode_cost() const { return 2; }
+	void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const {
+		dict_encode(in, n, out);
+	}
+	size_t decode(const uint8_t *in, size_t n, int32_t *out) const {
+		DictView view;
+		const uint8_t *end = view.parse(in, n);
+		view.decode(out);
+		return end - in;
+	}
+};
+
+/**
+ * Runs of 3+ equal values as (value, length), everything else as literal
+ *  stretches; each group is headed by varint (length << 1 | is_run)
+ */
+class RleLiteralCodec : public Codec {
+public:
+	const char* name() const { return "rlelit"; }
+	int decode_cost() const { return 2; }
+	void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const {
+		const size_t minrun = 3;
+		size_t i = 0;
+		size_t litstart = 0;
+		while (i < n) {
+			size_t j = i + 1;
+			while (j < n && in[j] == in[i]) {
+				++j;
+			}
+			if (j - i >= minrun || j == n) {
+				size_t runstart = (j - i >= minrun) ? i : j;
+				if (runstart > litstart) {
+					put_varint(out, (runstart - litstart) << 1);
+					for (size_t k = litstart; k < runstart; ++k) {
+						put_varint(out, zigzag(in[k]));
+					}
+				}
+				if (runstart < j) {
+					put_varint(out, ((j - i) << 1) | 1);
+					put_varint(out, zigzag(in[i]));
+				}
+				litstart = j;
+			}
+			i = j;
+		}
+	}
+	size_t decode(const uint8_t *in, size_t n, int32_t *out) const {
+		const uint8_t *p = in;
+		size_t i = 0;
+		while (i < n) {
+			uint32_t head = get_varint(p);
+			uint32_t len = head >> 1;
+			if (head & 1) {
+				int32_t v = unzigzag(get_varint(p));
+				for (uint32_t r = 0; r < len && i < n; ++r) {
+					out[i++] = v;
+				}
+			} else {
+				for (uint32_t r = 0; r < len && i < n; ++r) {
+					out[i++] = unzigzag(get_varint(p));
+				}
+			}
+		}
+		return p - in;
+	}
+};
+
+/**
+ * Bitmap of nonzero positions followed by the nonzero values
+ */
+class SparseCodec : public Codec {
+public:
+	const char* name() const { return "sparse"; }
+	int decode_cost() const { return 2; }
+	void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const {
+		size_t at = out.size();
+		out.resize(at + (n + 7) / 8);
+		for (size_t i = 0; i < n; ++i) {
+			if (in[i] != 0) {
+				out[at + i / 8] |= (uint8_t) (1 << (i % 8));
+			}
+		}
+		for (size_t i = 0; i < n; ++i) {
+			if (in[i] != 0) {
+				put_varint(out, zigzag(in[i]));
+			}
+		}
+	}
+	size_t decode(const uint8_t *in, size_t n, int32_t *out) const {
+		const uint8_t *bitmap = in;
+		const uint8_t *p = in + (n + 7) / 8;
+		for (size_t i = 0; i < n; i += 8) {
+			uint8_t bits = bitmap[i / 8];
+			size_t end = min(n, i + 8);
+			if (0 == bits) {
+				//whole byte of zeros: the common case for idle counters
+				memset(out + i, 0, (end - i) * sizeof(int32_t));
+				continue;
+			}
+			for (size_t k = i; k < end; ++k) {
+				out[k] = (bits & (1 << (k - i))) ? unzigzag(get_varint(p)) : 0;
+			}
+		}
+		return p - in;
+	}
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TSC_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/**
+ * (values per word, bits per value) for each Simple-8b selector.
+ *  Selectors 0 and 1 encode runs of zeros.
+ */
+const int S8B_COUNT[16] = {240, 120, 60, 30, 20, 15, 12, 10, 8, 7, 6, 5, 4, 3, 2, 1};
+const int S8B_BITS[16] = {0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 10, 12, 15, 20, 30, 60};
+
+/**
+ * Simple-8b over zigzag deltas: 64-bit words of a 4-bit selector and
+ *  60 payload bits split evenly among as many values as fit
+ */
+class Simple8bCodec : public Codec {
+public:
+	const char* name() const { return "s8b"; }
+	int decode_cost() const { return 1; }
+	void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const {
+		vector<uint32_t> zz(n);
+		uint32_t prev = 0;
+		for (size_t i = 0; i < n; ++i) {
+			zz[i] = zigzag((int32_t) ((uint32_t) in[i] - prev));
+			prev = in[i];
+		}
+
+		size_t i = 0;
+		while (i < n) {
+			int sel = 0;
+			for (; sel < 15; ++sel) {
+				size_t cnt = S8B_COUNT[sel];
+				if (i + cnt > n) {
+					continue;
+				}
+				uint32_t lim = S8B_BITS[sel] >= 32 ? 0xffffffffU : (1U << S8B_BITS[sel]) - 1;
+				size_t k = 0;
+				while (k < cnt && zz[i + k] <= lim) {
+					++k;
+				}
+				if (k == cnt) {
+					break;
+				}
+			}
+			uint64_t word = (uint64_t) sel << 60;
+			int bits = S8B_BITS[sel];
+			for (int k = 0; k < S8B_COUNT[sel] && bits > 0; ++k) {
+				word |= (uint64_t) zz[i + k] << (k * bits);
+			}
+			size_t at = out.size();
+			out.resize(at + 8);
+			memcpy(&out[at], &word, 8);
+			i += S8B_COUNT[sel];
+		}
+	}
+	size_t decode(const uint8_t *in, size_t n, int32_t *out) const {
+		const uint8_t *p = in;
+		uint32_t prev = 0;
+		size_t i = 0;
+		while (i < n) {
+			uint64_t word;
+			memcpy(&word, p, 8);
+			p += 8;
+			int sel = word >> 60;
+			int bits = S8B_BITS[sel];
+			size_t cnt = min((size_t) S8B_COUNT[sel], n - i);
+			if (0 == bits) {
+				//zero deltas: the previous value repeats
+				for (size_t k = 0; k < cnt; ++k) {
+					out[i + k] = (int32_t) prev;
+				}
+			} else {
+				uint64_t mask = (1ULL << bits) - 1;
+				for (size_t k = 0; k < cnt; ++k) {
+					prev += (uint32_t) unzigzag((uint32_t) ((word >> (k * bits)) & mask));
+					out[i + k] = (int32_t) prev;
+				}
+			}
+			i += cnt;
+		}
+		return p - in;
+	}
+};
+
+/**
+ * Shuffle masks and data lengths for each Stream VByte control byte
+ */
+struct StreamVByteTables {
+	uint8_t shuffle[256][16];
+	uint8_t length[256];
+
+	StreamVByteTables() {
+		for (int c = 0; c < 256; ++c) {
+			int off = 0;
+			for (int k = 0; k < 4; ++k) {
+				int len = ((c >> (2 * k)) & 3) + 1;
+				for (int b = 0; b < 4; ++b) {
+					shuffle[c][4 * k + b] = (b < len) ? off + b : 0x80;
+				}
+				off += len;
+			}
+			length[c] = off;
+		}
+	}
+};
+
+const StreamVByteTables& svb_tables() {
+	static StreamVByteTables tables;
+	return tables;
+}
+
+#ifdef TSC_X86_SIMD
+/**
+ * @brief Zigzag decode and prefix sum four deltas onto prev
+ */
+__attribute__((target("ssse3")))
+__m128i svb_undelta(__m128i v, __m128i &prev) {
+	v = _mm_xor_si128(_mm_srli_epi32(v, 1),
+			_mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, _mm_set1_epi32(1))));
+	v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+	v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+	v = _mm_add_epi32(v, prev);
+	prev = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+	return v;
+}
+
+/**
+ * @brief pshufb decode of quads while 16 bytes of data remain readable
+ * @returns quads decoded
+ */
+__attribute__((target("ssse3")))
+size_t svb_decode_ssse3(const uint8_t *ctrl, size_t nquads, const uint8_t *&data,
+		const uint8_t *dataend, int32_t *out, uint32_t &prev) {
+	const StreamVByteTables &t = svb_tables();
+	__m128i vprev = _mm_set1_epi32(prev);
+	size_t q = 0;
+	for (; q < nquads && data + 16 <= dataend; ++q) {
+		uint8_t c = ctrl[q];
+		__m128i raw = _mm_loadu_si128((const __m128i*) data);
+		__m128i v = _mm_shuffle_epi8(raw, _mm_loadu_si128((const __m128i*) t.shuffle[c]));
+		_mm_storeu_si128((__m128i*) (out + 4 * q), svb_undelta(v, vprev));
+		data += t.length[c];
+	}
+	prev = _mm_cvtsi128_si32(vprev);
+	return q;
+}
+
+/**
+ * @brief AVX2 variant: two quads per 256-bit shuffle
+ * @returns quads decoded
+ */
+__attribute__((target("avx2")))
+size_t svb_decode_avx2(const uint8_t *ctrl, size_t nquads, const uint8_t *&data,
+		const uint8_t *dataend, int32_t *out, uint32_t &prev) {
+	const StreamVByteTables &t = svb_tables();
+	__m128i vprev = _mm_set1_epi32(prev);
+	size_t q = 0;
+	for (; q + 1 < nquads; q += 2) {
+		uint8_t c0 = ctrl[q];
+		uint8_t c1 = ctrl[q + 1];
+		const uint8_t *second = data + t.length[c0];
+		if (second + 16 > dataend) {
+			break;
+		}
+		__m256i raw = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i*) data)),
+				_mm_loadu_si128((const __m128i*) second), 1);
+		__m256i mask = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i*) t.shuffle[c0])),
+				_mm_loadu_si128((const __m128i*) t.shuffle[c1]), 1);
+		__m256i v = _mm256_shuffle_epi8(raw, mask);
+		_mm_storeu_si128((__m128i*) (out + 4 * q),
+				svb_undelta(_mm256_castsi256_si128(v), vprev));
+		_mm_storeu_si128((__m128i*) (out + 4 * q + 4),
+				svb_undelta(_mm256_extracti128_si256(v, 1), vprev));
+		data = second + t.length[c1];
+	}
+	prev = _mm_cvtsi128_si32(vprev);
+	return q;
+}
+#endif
+
+/**
+ * Stream VByte over zigzag deltas: 2-bit lengths for each quad packed
+ *  in control bytes ahead of the data bytes, decoded with byte shuffles
+ *  (SSSE3 or AVX2, chosen at runtime; scalar elsewhere)
+ */
+class StreamVByteCodec : public Codec {
+public:
+	const char* name() const { return "svb"; }
+	int decode_cost() const { return 0; }
+	void encode(const int32_t *in, size_t n, vector<uint8_t> &out) const {
+		size_t nquads = (n + 3) / 4;
+		vector<uint8_t> ctrl(nquads);
+		vector<uint8_t> data;
+		uint32_t prev = 0;
+		for (size_t i = 0; i < n; ++i) {
+			uint32_t z = zigzag((int32_t) ((uint32_t) in[i] - prev));
+			prev = in[i];
+			int len = (z < (1U << 8)) ? 1 : (z < (1U << 16)) ? 2 : (z < (1U << 24)) ? 3 : 4;
+			ctrl[i / 4] |= (len - 1) << (2 * (i % 4));
+			for (int b = 0; b < len; ++b) {
+				data.push_back((uint8_t) (z >> (8 * b)));
+			}
+		}
+		//pad a partial last quad with one zero byte per missing value
+		for (size_t i = n; i < nquads * 4; ++i) {
+			data.push_back(0);
+		}
+		put_varint(out, data.size());
+		out.insert(out.end(), ctrl.begin(), ctrl.end());
+		out.insert(out.end(), data.begin(), data.end());
+	}
+	size_t decode(const uint8_t *in, size_t n, int32_t *out) const {
+		const uint8_t *p = in;
+		size_t datalen = get_varint(p);
+		size_t nquads = (n + 3) / 4;
+		const uint8_t *ctrl = p;
+		const uint8_t *data = ctrl + nquads;
+		const uint8_t *dataend = data + datalen;
+		uint32_t prev = 0;
+
+		//full quads only; the last, possibly partial, quad goes scalar
+		size_t fullquads = n / 4;
+		size_t q = 0;
+#ifdef TSC_X86_SIMD
+		if (__builtin_cpu_supports("avx2")) {
+			q = svb_decode_avx2(ctrl, fullquads, data, dataend, out, prev);
+		}
+		if (__builtin_cpu_supports("ssse3")) {
+			q += svb_decode_ssse3(ctrl + q, fullquads - q, data, dataend, out + 4 * q, prev);
+		}
+#endif
+		for (size_t i = 4 * q; i < n; ++i) {
+			int len = ((ctrl[i / 4] >> (2 * (i % 4))) & 3) + 1;
+			uint32_t z = 0;
+			for (int b = 0; b < len; ++b) {
+				z |= (uint32_t) data[b] << (8 * b);
+			}
+			data += len;
+			prev += (uint32_t) unzigzag(z);
+			out[i] = (int32_t) prev;
+		}
+		return dataend - in;
+	}
+};
+
+/**
+ * @returns all codecs; a codec's index is its id in encoded blocks
+ */
+const vector<Codec*>& codecs() {
+	static vector<Codec*> all;
+	if (all.empty()) {
+		all.push_back(new RawCodec());
+		all.push_back(new VarintCodec());
+		all.push_back(new DeltaCodec());
+		all.push_back(new DeltaOfDeltaCodec());
+		all.push_back(new RleCodec());
+		all.push_back(new ForCodec());
+		all.push_back(new XorCodec());
+		all.push_back(new DictCodec());
+		all.push_back(new RleLiteralCodec());
+		all.push_back(new SparseCodec());
+		all.push_back(new Simple8bCodec());
+		all.push_back(new StreamVByteCodec());
+	}
+	return all;
+}
+
+/**
+ * @returns codec id for name, or -1
+ */
+int find_codec(const string &name) {
+	for (unsigned i = 0; i < codecs().size(); ++i) {
+		if (name == codecs()[i]->name()) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Pick a codec for a block by encoding a sample with every codec.
+ *  Among codecs within (1 + slack) of the smallest sample encoding, the
+ *  cheapest to decode wins: slack 0 optimizes size, large slack speed.
+ * @returns codec id
+ */
+int choose_codec(const int32_t *in, size_t n, double slack) {
+	//four evenly spaced runs keep delta structure intact
+	const size_t runs = 4;
+	const size_t runlen = 256;
+	vector<int32_t> sample;
+	if (n <= runs * runlen) {
+		sample.assign(in, in + n);
+	} else {
+		for (size_t r = 0; r < runs; ++r) {
+			size_t at = r * (n - runlen) / (runs - 1);
+			sample.insert(sample.end(), in + at, in + at + runlen);
+		}
+	}
+
+	const vector<Codec*> &all = codecs();
+	vector<size_t> sizes(all.size());
+	size_t best = (size_t) -1;
+	vector<uint8_t> buf;
+	for (unsigned c = 0; c < all.size(); ++c) {
+		buf.clear();
+		all[c]->encode(sample.empty() ? NULL : &sample[0], sample.size(), buf);
+		sizes[c] = buf.size();
+		best = min(best, sizes[c]);
+	}
+
+	int chosen = 0;
+	for (unsigned c = 0; c < all.size(); ++c) {
+		if (sizes[c] <= best * (1 + slack) &&
+				(sizes[chosen] > best * (1 + slack) ||
+				all[c]->decode_cost() < all[chosen]->decode_cost() ||
+				(all[c]->decode_cost() == all[chosen]->decode_cost() && sizes[c] < sizes[chosen]))) {
+			chosen = c;
+		}
+	}
+	return chosen;
+}
+
+/**
+ * @brief Append a self-describing block: codec id, value count, payload
+ * @param codec codec id, or -1 to choose adaptively
+ * @returns the codec id used
+ */
+int encode_block(const int32_t *in, size_t n, vector<uint8_t> &out, int codec, double slack) {
+	if (codec < 0) {
+		codec = choose_codec(in, n, slack);
+	}
+	out.push_back((uint8_t) codec);
+	put_varint(out, n);
+	codecs()[codec]->encode(in, n, out);
+	return codec;
+}
+
+/**
+ * @brief Decode one block written by encode_block, appending to out
+ * @returns bytes consumed, or 0 on an unknown codec
+ */
+size_t decode_block(const uint8_t *in, vector<int32_t> &out) {
+	const uint8_t *p = in;
+	unsigned codec = *p++;
+	if (codec >= codecs().size()) {
+		return 0;
+	}
+	size_t n = get_varint(p);
+	size_t at = out.size();
+	out.resize(at + n);
+	p += codecs()[codec]->decode(p, n, n ? &out[at] : NULL);
+	return p - in;
+}
+
+/**
+ * @brief Encode/decode every ts and vs stream of data with each codec in
+ *  --codecs (comma separated, default all) in --block sized blocks, best of
+ *  --reps runs, and print bytes per sample and MB/s of raw int32 data
+ */
+void print_codec_bench(DataMulti data, ostream &out) {
+	size_t blocksize = opt_int("block", 65536);
+	int reps = opt_int("reps", 5);
+	string only = "," + opt_str("codecs", "") + ",";
+
+	vector<string> names;
+	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
+		names.push_back(data.get_name((*it).first, TS));
+		for (set<string>::const_iterator sit = (*it).second.begin(); sit != (*it).second.end(); ++sit) {
+			names.push_back(data.get_name(*sit, VS));
+		}
+	}
+
+	out << "stream\tcodec\tbytes_per_sample\tencode_mbps\tdecode_mbps" << endl;
+	for (unsigned s = 0; s < names.size(); ++s) {
+		MappedFile f(names[s].c_str());
+		if (!f.ok) {
+			cerr << "could not read stream " << names[s] << endl;
+			continue;
+		}
+		const int32_t *vals = (const int32_t*) f.data;
+		size_t n = f.size / sizeof(int32_t);
+		double mb = n * sizeof(int32_t) / 1e6;
+
+		for (unsigned c = 0; c < codecs().size(); ++c) {
+			if (only != ",," && string::npos == only.find(string(",") + codecs()[c]->name() + ",")) {
+				continue;
+			}
+			vector<uint8_t> enc;
+			vector<int32_t> dec;
+			double besttenc = 1e30;
+			double besttdec = 1e30;
+			for (int r = 0; r < reps; ++r) {
+				enc.clear();
+				double t0 = wall_seconds();
+				for (size_t start = 0; start < n; start += blocksize) {
+					encode_block(vals + start, min(blocksize, n - start), enc, c, 0);
+				}
+				double t1 = wall_seconds();
+				dec.clear();
+				dec.reserve(n);
+				for (size_t pos = 0; pos < enc.size(); ) {
+					pos += decode_block(&enc[pos], dec);
+				}
+				double t2 = wall_seconds();
+				besttenc = min(besttenc, t1 - t0);
+				besttdec = min(besttdec, t2 - t1);
+			}
+			if (dec.size() != n || (n && 0 != memcmp(&dec[0], vals, n * sizeof(int32_t)))) {
+				cerr << codecs()[c]->name() << " failed to round trip " << names[s] << endl;
+			}
+			out << names[s] << "\t" << codecs()[c]->name()
+					<< "\t" << (n ? (double) enc.size() / n : 0)
+					<< "\t" << mb / besttenc << "\t" << mb / besttdec << endl;
+		}
+	}
+}
+
+/**
+ * @brief Round trip each codec over a small synthetic column
+ */
+void test_codecs() {
+	vector<int32_t> vals;
+	for (int i = 0; i < 5000; ++i) {
+		vals.push_back(i < 3000 ? 0 : 1342181904 + 20 * i + (i % 7 == 0 ? 1 : 0));
+	}
+	vals.push_back(-1);
+	vals.push_back(2147483647);
+	vals.push_back(-2147483647 - 1);
+
+	for (unsigned c = 0; c < codecs().size(); ++c) {
+		vector<uint8_t> enc;
+		vector<int32_t> dec;
+		encode_block(&vals[0], vals.size(), enc, c, 0);
+		size_t used = decode_block(&enc[0], dec);
+		cerr << codecs()[c]->name() << ": " << enc.size() << " bytes "
+				<< ((dec == vals && used == enc.size()) ? "ok" : "MISMATCH") << endl;
+	}
+	cerr << "chosen: " << codecs()[choose_codec(&vals[0], vals.size(), 0)]->name() << endl;
+}
+
+#endif /* CODEC_HPP_ */
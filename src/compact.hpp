@@ -0,0 +1,333 @@
+/*
+ * compact.hpp
+ * Compact backend: every column stored as adaptively encoded blocks
+ */
+
+#ifndef COMPACT_HPP_
+#define COMPACT_HPP_
+
+#include <stdint.h>
+
+#include "blockz.hpp"
+#include "codec.hpp"
+#include "data.hpp"
+#include "sink.hpp"
+
+using namespace std;
+
+const char COMPACT_MAGIC[8] = {'T', 'S', 'C', 'M', 'P', '0', '0', '2'};
+
+/**
+ * @brief Append a chunk record: u32 stored length, u32 raw length (0 when
+ *  stored as is), then the bytes, block compressed at level if that helps
+ */
+void write_chunk(ostream &out, const vector<uint8_t> &chunk, int level, vector<uint8_t> &scratch) {
+	if (level > 0) {
+		scratch.clear();
+		blockz_compress(&chunk[0], chunk.size(), scratch, level);
+		if (scratch.size() < chunk.size()) {
+			write_pod(out, (uint32_t) scratch.size());
+			write_pod(out, (uint32_t) chunk.size());
+			out.write((const char*) &scratch[0], scratch.size());
+			return;
+		}
+	}
+	write_pod(out, (uint32_t) chunk.size());
+	write_pod(out, (uint32_t) 0);
+	out.write((const char*) &chunk[0], chunk.size());
+}
+
+/**
+ * @brief Read a chunk record written by write_chunk
+ * @param chunk set to the (decompressed) chunk bytes
+ * @param scratch holds decompressed bytes when needed
+ * @returns pointer past the record, or NULL if it is malformed
+ */
+const uint8_t* read_chunk(const uint8_t *p, const uint8_t *end,
+		const uint8_t *&chunk, size_t &chunklen, vector<uint8_t> &scratch) {
+	if (end - p < 8) {
+		return NULL;
+	}
+	uint32_t stored = get_u32(p);
+	uint32_t raw = get_u32(p);
+	if ((size_t) (end - p) < stored) {
+		return NULL;
+	}
+	if (0 == raw) {
+		chunk = p;
+		chunklen = stored;
+	} else {
+		scratch.resize(raw);
+		if (!blockz_decompress(p, stored, &scratch[0], raw)) {
+			return NULL;
+		}
+		chunk = &scratch[0];
+		chunklen = raw;
+	}
+	return p + stored;
+}
+
+void print_compact_usage(uint64_t totalbytes, const vector<long> &usage) {
+	cerr << "compact bytes " << totalbytes << endl;
+	for (unsigned c = 0; c < usage.size(); ++c) {
+		if (usage[c]) {
+			cerr << "  " << codecs()[c]->name() << " blocks: " << usage[c] << endl;
+		}
+	}
+}
+
+/**
+ * Writes each merge group as output-N.cmp, from row blocks: the timestamp
+ *  column then every value column, each as codec-tagged blocks (--block
+ *  values per block, --slack size tolerance traded for decode speed,
+ *  --level block compression level, 0 for none). Every column collects
+ *  values up to --block and keeps its encoded chunks in memory until the
+ *  group ends. Missing value streams come out zero filled.
+ */
+class CompactSink : public GroupSink {
+private:
+	struct Column {
+		string name;
+		vector<int32_t> pending;
+		stringstream chunks;
+		uint64_t n;
+		uint32_t nblocks;
+	};
+
+	string output;
+	size_t blocksize;
+	double slack;
+	int level;
+	int filedx;
+	vector<Column*> cols;
+	vector<uint8_t> buf;
+	vector<uint8_t> scratch;
+
+	void encode_pending(Column &c) {
+		if (c.pending.empty()) {
+			return;
+		}
+		buf.clear();
+		int codec = encode_block(&c.pending[0], c.pending.size(), buf, -1, slack);
+		++usage[codec];
+		write_chunk(c.chunks, buf, level, scratch);
+		c.n += c.pending.size();
+		++c.nblocks;
+		c.pending.clear();
+	}
+
+	void append(Column &c, const int32_t *vals, size_t n) {
+		while (n > 0) {
+			size_t take = min(n, blocksize - c.pending.size());
+			c.pending.insert(c.pending.end(), vals, vals + take);
+			vals += take;
+			n -= take;
+			if (c.pending.size() == blocksize) {
+				encode_pending(c);
+			}
+		}
+	}
+
+	void clear() {
+		for (unsigned i = 0; i < cols.size(); ++i) {
+			delete cols[i];
+		}
+		cols.clear();
+	}
+
+public:
+	vector<long> usage;
+	uint64_t totalbytes;
+
+	CompactSink(const char *_output) : output(_output),
+		blocksize(opt_int("block", 65536)), slack(opt_double("slack", 0)),
+		level(opt_int("level", 0)), filedx(0), usage(codecs().size()), totalbytes(0) {}
+
+	~CompactSink() {
+		clear();
+	}
+
+	const char* name() const {
+		return "compact";
+	}
+
+	void begin_group(int groupdx, const string &key, const GroupReader &group) {
+		clear();
+		filedx = groupdx;
+		cols.push_back(new Column);
+		cols.back()->name = "ts";
+		for (unsigned i = 0; i < group.columns.size(); ++i) {
+			cols.push_back(new Column);
+			cols.back()->name = group.columns[i];
+		}
+		for (unsigned i = 0; i < cols.size(); ++i) {
+			cols[i]->n = 0;
+			cols[i]->nblocks = 0;
+		}
+	}
+
+	void write_block(const GroupBlock &blk) {
+		append(*cols[0], blk.ts, blk.nrows);
+		for (unsigned i = 0; i < blk.vals.size(); ++i) {
+			append(*cols[i + 1], blk.vals[i], blk.nrows);
+		}
+	}
+
+	void end_group() {
+		stringstream name;
+		name << output << "-" << filedx << ".cmp";
+		ofstream out(name.str().c_str(), ios::binary | ios::out | ios::trunc);
+		out.write(COMPACT_MAGIC, 8);
+		write_pod(out, (uint32_t) cols.size());
+		for (unsigned i = 0; i < cols.size(); ++i) {
+			Column &c = *cols[i];
+			encode_pending(c);
+			write_str(out, c.name);
+			write_pod(out, c.n);
+			write_pod(out, c.nblocks);
+			if (c.nblocks) {
+				out << c.chunks.rdbuf();
+			}
+		}
+		totalbytes += out.tellp();
+		clear();
+	}
+
+	void finish() {
+		print_compact_usage(totalbytes, usage);
+	}
+};
+
+/**
+ * @brief Write each merge group to output-N.cmp through CompactSink
+ */
+void insert_compact_multi(DataMulti data, int twidth, int vwidth, const char *output) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "compact backend only supports 4 byte samples" << endl;
+		return;
+	}
+
+	CompactSink compact(output);
+	vector<GroupSink*> sinks(1, &compact);
+	run_sinks(data, sinks);
+}
+
+/**
+ * @brief Read a file written by insert_compact_multi back into columns
+ * @returns false on a malformed file
+ */
+bool read_compact(const char *fname, vector<string> &names, vector<vector<int32_t> > &cols) {
+	MappedFile f(fname);
+	if (!f.ok || f.size < 12 || 0 != memcmp(f.data, COMPACT_MAGIC, 8)) {
+		return false;
+	}
+	const uint8_t *p = (const uint8_t*) f.data + 8;
+	const uint8_t *end = (const uint8_t*) f.data + f.size;
+	uint32_t ncols = get_u32(p);
+	vector<uint8_t> scratch;
+	names.resize(ncols);
+	cols.resize(ncols);
+	for (uint32_t c = 0; c < ncols; ++c) {
+		if (p + 4 > end) {
+			return false;
+		}
+		uint32_t namelen = get_u32(p);
+		if (p + namelen + 12 > end) {
+			return false;
+		}
+		names[c].assign((const char*) p, namelen);
+		p += namelen;
+		uint64_t n;
+		memcpy(&n, p, 8);
+		p += 8;
+		uint32_t nblocks = get_u32(p);
+		for (uint32_t b = 0; b < nblocks; ++b) {
+			const uint8_t *chunk;
+			size_t len;
+			p = read_chunk(p, end, chunk, len, scratch);
+			if (NULL == p || decode_block(chunk, cols[c]) != len) {
+				return false;
+			}
+		}
+		if (cols[c].size() != n) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief For block compression levels 0 (off) to BLOCKZ_MAX_LEVEL, report
+ *  total size of every stream's adaptively coded blocks after compression,
+ *  compression MB/s and decompress+decode MB/s (of raw int32 data)
+ */
+void print_blockz_levels(DataMulti data, ostream &out) {
+	size_t blocksize = opt_int("block", 65536);
+
+	vector<string> names;
+	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
+		names.push_back(data.get_name((*it).first, TS));
+		for (set<string>::const_iterator sit = (*it).second.begin(); sit != (*it).second.end(); ++sit) {
+			names.push_back(data.get_name(*sit, VS));
+		}
+	}
+
+	//encode once; the levels only differ in the second stage
+	vector<vector<uint8_t> > chunks;
+	uint64_t rawbytes = 0;
+	for (unsigned s = 0; s < names.size(); ++s) {
+		MappedFile f(names[s].c_str());
+		const int32_t *vals = (const int32_t*) f.data;
+		size_t n = f.size / sizeof(int32_t);
+		rawbytes += n * sizeof(int32_t);
+		for (size_t start = 0; start < n; start += blocksize) {
+			chunks.push_back(vector<uint8_t>());
+			encode_block(vals + start, min(blocksize, n - start), chunks.back(), -1, 0);
+		}
+	}
+	double mb = rawbytes / 1e6;
+
+	out << "level\tbytes\tratio\tcompress_mbps\tdecode_mbps" << endl;
+	for (int level = 0; level <= BLOCKZ_MAX_LEVEL; ++level) {
+		stringstream packed;
+		vector<uint8_t> scratch;
+		double t0 = wall_seconds();
+		for (unsigned c = 0; c < chunks.size(); ++c) {
+			write_chunk(packed, chunks[c], level, scratch);
+		}
+		double t1 = wall_seconds();
+
+		string bytes = packed.str();
+		const uint8_t *p = (const uint8_t*) bytes.data();
+		const uint8_t *end = p + bytes.size();
+		vector<int32_t> vals;
+		while (p != NULL && p < end) {
+			const uint8_t *chunk;
+			size_t len;
+			p = read_chunk(p, end, chunk, len, scratch);
+			if (p != NULL) {
+				vals.clear();
+				decode_block(chunk, vals);
+			}
+		}
+		double t2 = wall_seconds();
+
+		out << level << "\t" << bytes.size() << "\t" << (double) rawbytes / bytes.size()
+				<< "\t" << mb / (t1 - t0) << "\t" << mb / (t2 - t1) << endl;
+	}
+}
+
+void test_compact_multi() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	insert_compact_multi(data, 4, 4, "out-compact");
+
+	vector<string> names;
+	vector<vector<int32_t> > cols;
+	bool ok = read_compact("out-compact-1.cmp", names, cols);
+	MappedFile ts("../testdata-multi/ts.merge/012dd4af04c6fff34ffb0734141299c7.ts");
+	ok = ok && cols[0].size() * 4 == ts.size && 0 == memcmp(&cols[0][0], ts.data, ts.size);
+	cerr << "compact round trip " << (ok ? "ok" : "FAILED") << endl;
+}
+
+#endif /* COMPACT_HPP_ */
@@ -19,7 +19,19 @@
 #include "data.hpp"
 #include "opentsdb.hpp"
 #include "sqlite.hpp"
+#include "sqlitestat.hpp"
 #include "csv.hpp"
+#include "stats.hpp"
+#include "codec.hpp"
+#include "compact.hpp"
+#include "dictstore.hpp"
+#include "fanout.hpp"
+#include "tscol.hpp"
+#include "arrow.hpp"
+#include "parquet.hpp"
+#include "tsdbnet.hpp"
+#include "querybench.hpp"
+#include "microbench.hpp"
 
 #ifdef HAS_FINANCEDB
 #include "financedb.hpp"
@@ -34,19 +46,87 @@ using namespace std;
 void usage(char** argv) {
 	cout << "Usage: " << argv[0] << " [fn] [args]" << endl;
 	cout << "  if [fn] is test, run basic tests." << endl;
-	cout << "  if [fn] is ins_{sqlite,financedb,opentsdb,csv}_multi, [args] = " << endl;
+	cout << "  if [fn] is ins_{sqlite,financedb,opentsdb,csv,compact,dict,tscol,arrow,parquet,influx,promwrite}_multi, [args] = " << endl;
 	cout << "    2: timestamp directory" << endl;
 	cout << "    3: values directory" << endl;
 	cout << "    4: timestamp merge map" << endl;
 	cout << "    5: output database" << endl;
+	cout << "    (compact: --block=N values per block, --slack=F size slack" << endl;
+	cout << "     allowed to pick a faster-decoding codec, default 0," << endl;
+	cout << "     --level=0-9 second stage block compression, default 0)" << endl;
+	cout << "    (parquet: --rg_rows=N rows per row group, --page_rows=N rows per page)" << endl;
+	cout << "  if [fn] is ins_all_multi, [args] = 2-5 as for ins_*_multi" << endl;
+	cout << "    (reads the input once for every --sinks=sqlite,csv,opentsdb,compact," << endl;
+	cout << "     tscol,arrow,parquet,influx,promwrite backend, writing output.db," << endl;
+	cout << "     output-N.csv, output.tsdb, output-N.cmp, output-N.tsc, output-N.arrow," << endl;
+	cout << "     output-N.parquet, output.influx, output.prw)" << endl;
+	cout << "  if [fn] is ins_all_tscol, [args] = " << endl;
+	cout << "    2: output prefix, as for ins_all_multi" << endl;
+	cout << "    3...: .tsc files written by ins_tscol_multi, read in place of .ts/.vs" << endl;
+	cout << "  if [fn] is tscol_info, [args] = .tsc file (prints the chunk index)" << endl;
+	cout << "  if [fn] is tscol_sum, [args] = " << endl;
+	cout << "    2: .tsc file" << endl;
+	cout << "    3: value column" << endl;
+	cout << "    4-5: first and last timestamp (chunks outside are skipped)" << endl;
 	cout << "  if [fn] is ins_opentsdb, [args] = " << endl;
 	cout << "    2: timestamp directory" << endl;
 	cout << "    3: values directory" << endl;
 	cout << "    4: metric name file" << endl;
 	cout << "    (writes inserts to stdout)" << endl;
+	cout << "  if [fn] is tsdb_serve, [args] = 2: port (stand-in opentsdb server)" << endl;
+	cout << "  if [fn] is tsdb_drive, [args] = 2-4 as for ins_*_multi, 5: host, 6: port" << endl;
+	cout << "    (--proto=telnet|http, --conns=N, --batch=N puts, --pipeline=N batches in flight)" << endl;
+	cout << "  if [fn] is tsdb_bench, [args] = 2-4 as for ins_*_multi" << endl;
+	cout << "    (tsdb_drive against a stand-in server on a local ephemeral port)" << endl;
+	cout << "  if [fn] is ins_opentsdb_sharded, [args] = 2-5 as for ins_*_multi" << endl;
+	cout << "    (--shard_by=hash|metric, --shards=N hash buckets, --gzip=1)" << endl;
+	cout << "  if [fn] is ins_sqlite_sharded, [args] = 2-5 as for ins_*_multi" << endl;
+	cout << "    (groups hashed over --shards=N databases output-K.db, loaded in parallel;" << endl;
+	cout << "     --merge=1 then copies them into output, --keep=1 keeps the shards)" << endl;
+	cout << "  if [fn] is sqlite_bulk_bench, [args] = 2-5 as for ins_*_multi" << endl;
+	cout << "    (load rate with conflict checks vs --presorted=1, and the speedup)" << endl;
+	cout << "  if [fn] is sqlite_zpage, [args] = 2-5 as for ins_*_multi" << endl;
+	cout << "    (output.db as usual vs output.zdb through the page compressing vfs:" << endl;
+	cout << "     sizes, load rates, query latency; --zpage_level=1-9)" << endl;
+	cout << "  if [fn] is query_bench, [args] = 2-5 as for ins_*_multi" << endl;
+	cout << "    (loads --backends=sqlite,csv,tscol,opentsdb, then times --queries point," << endl;
+	cout << "     range and aggregate queries over --query_widths seconds, --cache=warm,cold)" << endl;
+	cout << "  if [fn] is sqlite_storage, [args] = db file (--vfs=zpage for zpage dbs)" << endl;
+	cout << "    (payload, overhead and unused bytes per table and index, and per sample;" << endl;
+	cout << "     ins_sqlite_multi --storage_report=1 prints it after loading)" << endl;
+	cout << "  if [fn] is sqlite_matrix, [args] = 2-5 as for ins_*_multi" << endl;
+	cout << "    (loads output-N.db per layout in the cross product of --page_sizes," << endl;
+	cout << "     --layouts=rowid,without_rowid, --journals, --cache_sizes, --mmap_sizes;" << endl;
+	cout << "     reports size, load rate and --queries ranges of --query_width seconds)" << endl;
+	cout << "  if [fn] is stats_multi, [args] = 2-4 as for ins_*_multi" << endl;
+	cout << "    (writes a per-stream statistics report to stdout)" << endl;
+	cout << "  if [fn] is dict_count, [args] = " << endl;
+	cout << "    2: .dict file written by ins_dict_multi" << endl;
+	cout << "    3: value column" << endl;
+	cout << "    4: predicate op, one of eq,ne,lt,le,gt,ge" << endl;
+	cout << "    5: predicate value" << endl;
+	cout << "  if [fn] is codec_bench, [args] = 2-4 as for ins_*_multi" << endl;
+	cout << "    (--codecs=for,s8b,svb to restrict; --block, --reps)" << endl;
+	cout << "  if [fn] is blockz_levels, [args] = 2-4 as for ins_*_multi" << endl;
+	cout << "    (size and speed of each block compression level)" << endl;
+	cout << "  if [fn] is scan, [args] = directories to enumerate" << endl;
+	cout << "    (--recursive=1 descends into subdirectories)" << endl;
+	cout << "  options, accepted anywhere after [fn]:" << endl;
+	cout << "    --threads=N worker threads (default: online cpus)" << endl;
+	cout << "    --sparse=1 opentsdb: drop the interior of zero runs" << endl;
+	cout << "    --catalog={on,off,trust,rebuild} cached directory scans (default: on)" << endl;
+	cout << "     --catalog_dir=DIR where caches are kept (default: working directory)" << endl;
+	cout << "    sqlite: --page_size=N, --without_rowid=1, --journal=MODE (default: MEMORY)," << endl;
+	cout << "     --cache_size=N, --mmap_size=N, --value_index=1 index value columns," << endl;
+	cout << "     --presorted=1 no conflict checks for increasing groups, indexes last," << endl;
+	cout << "     --vfs=zpage compress db pages (--zpage_level=1-9)" << endl;
+	cout << "    --lateness=S reorder each group's rows, dropping rows more than S seconds" << endl;
+	cout << "     behind the newest; one row per timestamp (--dedup=last|first," << endl;
+	cout << "     --reorder_rows=N buffered before spilling to disk)" << endl;
 }
 
 int main(int argc, char** argv) {
+	argc = parse_options(argc, argv);
 	if (argc < 2) {
 		usage(argv);
 		return 1;
@@ -62,12 +142,35 @@ int main(int argc, char** argv) {
 		test_datamulti();
 		test_mergemap();
 		test_opentsdb_multi();
+		test_opentsdb_sharded();
+		test_reorder_multi();
+		test_reorder_shuffled();
 		test_insert_sqlite_multi();
+		test_insert_sqlite_sharded();
+		test_sqlite_bulk_bench();
+		test_sqlite_matrix();
+		test_sqlite_zpage();
+		test_sqlite_storage();
+		test_query_bench();
+		test_stats_multi();
+		test_codecs();
+		test_microbench();
+		test_compact_multi();
+		test_insert_dict_multi();
+		test_insert_all_multi();
+		test_tscol_multi();
+		test_arrow_multi();
+		test_parquet_multi();
+		test_promwrite_multi();
+		test_opentsdb_net();
 		*/
 		test_insert_csv_multi();
 	} else if (fn == "ins_sqlite_multi") {
 		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
 		insert_sqlite_multi(data, twidth, vwidth, argv[5]);
+		if (opt_int("storage_report", 0)) {
+			print_sqlite_storage(argv[5], cout);
+		}
 	} else if (fn == "ins_opentsdb") {
 		ofstream metout(argv[4], ios::out);
 		Data data(argv[2], argv[3]);
@@ -77,14 +180,98 @@ int main(int argc, char** argv) {
 		print_opentsdb_inserts(data, twidth, vwidth);
 	} else if (fn == "ins_opentsdb_multi") {
 		DataMulti dm(argv[2], argv[3], getMergeMap(argv[4]));
-		Data wrapper(dm);
-		print_opentsdb_inserts(wrapper, twidth, vwidth);
+		print_opentsdb_inserts_grouped(dm, twidth, vwidth, cout);
+	} else if (fn == "ins_opentsdb_sharded") {
+		DataMulti dm(argv[2], argv[3], getMergeMap(argv[4]));
+		print_opentsdb_inserts_sharded(dm, twidth, vwidth, argv[5]);
 	} else if (fn == "ins_financedb_multi") {
 		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
 		insert_financedb_multi(data, twidth, vwidth);
 	} else if (fn == "ins_csv_multi") {
 		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
 		insert_csv_multi(data, twidth, vwidth, argv[5]);
+	} else if (fn == "ins_compact_multi") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		insert_compact_multi(data, twidth, vwidth, argv[5]);
+	} else if (fn == "ins_dict_multi") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		insert_dict_multi(data, twidth, vwidth, argv[5]);
+	} else if (fn == "ins_all_multi") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		insert_all_multi(data, twidth, vwidth, argv[5]);
+	} else if (fn == "ins_tscol_multi") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		insert_tscol_multi(data, twidth, vwidth, argv[5]);
+	} else if (fn == "ins_arrow_multi") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		insert_arrow_multi(data, twidth, vwidth, argv[5]);
+	} else if (fn == "ins_parquet_multi") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		insert_parquet_multi(data, twidth, vwidth, argv[5]);
+	} else if (fn == "ins_influx_multi") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		insert_influx_multi(data, twidth, vwidth, argv[5]);
+	} else if (fn == "ins_promwrite_multi") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		insert_promwrite_multi(data, twidth, vwidth, argv[5]);
+	} else if (fn == "tsdb_serve") {
+		serve_opentsdb(atoi(argv[2]));
+	} else if (fn == "tsdb_drive") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		drive_opentsdb(data, argv[5], atoi(argv[6]), cout);
+	} else if (fn == "tsdb_bench") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		bench_opentsdb_local(data, cout);
+	} else if (fn == "ins_all_tscol") {
+		vector<string> files(argv + 3, argv + argc);
+		insert_all_tscol(files, argv[2]);
+	} else if (fn == "tscol_info") {
+		print_tscol_info(argv[2], cout);
+	} else if (fn == "tscol_sum") {
+		int64_t sum;
+		long rows;
+		size_t scanned;
+		if (argc < 6 || !tscol_sum_range(argv[2], argv[3], atoi(argv[4]), atoi(argv[5]), sum, rows, scanned)) {
+			usage(argv);
+			return 1;
+		}
+		cout << sum << " over " << rows << " rows, " << scanned << " chunks read" << endl;
+	} else if (fn == "dict_count") {
+		DictOp op;
+		if (argc < 6 || !parse_dict_op(argv[4], op)) {
+			usage(argv);
+			return 1;
+		}
+		cout << count_dict_matches(argv[2], argv[3], op, atoi(argv[5])) << endl;
+	} else if (fn == "ins_sqlite_sharded") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		insert_sqlite_sharded(data, twidth, vwidth, argv[5]);
+	} else if (fn == "sqlite_bulk_bench") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		print_sqlite_bulk_bench(data, argv[5], cout);
+	} else if (fn == "sqlite_zpage") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		print_sqlite_zpage(data, argv[5], cout);
+	} else if (fn == "query_bench") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		print_query_bench(data, argv[5], cout);
+	} else if (fn == "sqlite_storage") {
+		print_sqlite_storage(argv[2], cout);
+	} else if (fn == "sqlite_matrix") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		print_sqlite_matrix(data, argv[5], cout);
+	} else if (fn == "stats_multi") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		print_stats_multi(data, cout);
+	} else if (fn == "codec_bench") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		print_codec_bench(data, cout);
+	} else if (fn == "blockz_levels") {
+		DataMulti data(argv[2], argv[3], getMergeMap(argv[4]));
+		print_blockz_levels(data, cout);
+	} else if (fn == "scan") {
+		vector<string> roots(argv + 2, argv + argc);
+		print_scan(roots, opt_int("recursive", 0) != 0);
 	}
 
 	return 0;
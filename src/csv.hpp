@@ -8,106 +8,111 @@
 #ifndef CSV_HPP_
 #define CSV_HPP_
 
+#include <cstdio>
+
 #include "data.hpp"
+#include "sink.hpp"
+#include "stats.hpp"
 
 using namespace std;
 
-void insert_csv_multi(DataMulti data, int twidth, int vwidth, const char *output) {
-	//index of the current file ("table")
-	int filedx = 0;
-
-	//if we want to write multiple dsdefs to a single file
-	//stringstream dsdef;
-
-	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
-		long ninserts = 0;
-
-		++filedx;
-
-		timeit(true);
-
-		stringstream dsname;
-		dsname << output << "-" << filedx << ".xml";
-		ofstream dsdef(dsname.str().c_str(), ios::binary | ios::out);
-
-		//grab the timestamp stream
-		string tsloc = data.get_name((*it).first, TS);
-		ifstream ts(tsloc.c_str(), ios::binary | ios::in);
-		vector<ifstream*> vs((*it).second.size());
-
-		//write DataSeries xml spec
-		dsdef << "<ExtentType name=\"" << filedx << "\" namespace=\"tss.mrcaps.com\" version=\"1.0\">" << endl;
-		//write timestamp line
-		dsdef << "\t<field type=\"int32\" name=\"ts\" pack_relative=\"ts\" />" << endl;
+/**
+ * Writes each merge group as output-N.csv, with a DataSeries spec in
+ *  output-N.xml
+ */
+class CsvSink : public GroupSink {
+private:
+	string output;
+	ofstream ssdata;
+	string line;
+	int groupdx;
+	//per value column, fed from the blocks as they are written
+	vector<StreamStatsBuilder> stats;
+
+public:
+	CsvSink(const char *_output) : output(_output), groupdx(0) {}
+
+	const char* name() const {
+		return "csv";
+	}
 
-		int coldx = 0;
-		for (set<string>::const_iterator sit = (*it).second.begin(); sit != (*it).second.end(); ++sit) {
-			string vloc = data.get_name(*sit, VS);
-			vs[coldx] = new ifstream(vloc.c_str(), ios::binary | ios::in);
+	void begin_group(int filedx, const string &key, const GroupReader &group) {
+		groupdx = filedx;
+		stats.assign(group.vsnames.size(), StreamStatsBuilder());
 
-			++coldx;
-			dsdef << "\t<field type=\"int32\" name=\"" << coldx << "\" />" << endl;
-		}
-		dsdef << "</ExtentType>" << endl;
-
-		char tbuf[twidth];
-		char vbufs[vs.size()][vwidth];
+		stringstream name;
+		name << output << "-" << filedx << ".csv";
+		ssdata.open(name.str().c_str(), ios::binary | ios::out);
+	}
 
-		if (!ts.good()) {
-			cerr << "could not find timestamp file " << tsloc << endl;
-			break;
+	void write_block(const GroupBlock &blk) {
+		for (unsigned i = 0; i < blk.vals.size(); ++i) {
+			stats[i].add(blk.vals[i], blk.nrows);
 		}
 
-		int n_vstream_failures = 0;
+		char num[16];
+		for (size_t r = 0; r < blk.nrows; ++r) {
+			line.clear();
+			sprintf(num, "%d", blk.ts[r]);
+			line += num;
+			line += ',';
 
-		ofstream ssdata;
+			//one value from each value stream
+			for (unsigned i = 0; i < blk.vals.size(); ++i) {
+				int v = blk.vals[i][r];
 
-		stringstream name;
-		name << output << "-" << filedx << ".csv";
-		ssdata.open(name.str().c_str(), ios::binary | ios::out);
-		while (ts.good()) {
-			ts.read(tbuf, twidth);
-
-			ssdata << *((int*) tbuf) << ",";
-
-			//grab a value from each value stream and insert
-			//	(hope that the ifstreams will be buffered)
-			for (unsigned i = 0; i < vs.size(); ++i) {
-				int v = 0;
-				if (vs[i]->good()) {
-					vs[i]->read(vbufs[i], vwidth);
-					v = *((int*) vbufs[i]);
+				//zeros dominate sparse counters; skip the formatter for them
+				if (0 == v) {
+					line += '0';
 				} else {
-					++n_vstream_failures;
+					sprintf(num, "%d", v);
+					line += num;
 				}
 
-				ssdata << v;
-
-				if (i != vs.size() - 1) {
-					ssdata << ",";
+				if (i != blk.vals.size() - 1) {
+					line += ',';
 				}
 			}
 
-			++ninserts;
-
-			ssdata << endl;
+			line += '\n';
+			ssdata.write(line.data(), line.size());
 		}
+	}
 
-		if (0 != n_vstream_failures) {
-			cerr << "some value streams were incomplete or missing: count="
-					<< n_vstream_failures << endl;
-		}
+	void end_group() {
+		ssdata.close();
 
-		timeit(false, ninserts);
+		stringstream dsname;
+		dsname << output << "-" << groupdx << ".xml";
+		ofstream dsdef(dsname.str().c_str(), ios::binary | ios::out);
 
-		ssdata.close();
+		//write DataSeries xml spec
+		dsdef << "<ExtentType name=\"" << groupdx << "\" namespace=\"tss.mrcaps.com\" version=\"1.0\">" << endl;
+		//write timestamp line
+		dsdef << "\t<field type=\"int32\" name=\"ts\" pack_relative=\"ts\" />" << endl;
 
-		for (unsigned i = 0; i < vs.size(); ++i) {
-			vs[i]->close();
-			delete vs[i];
+		for (unsigned coldx = 1; coldx <= stats.size(); ++coldx) {
+			dsdef << "\t<field type=\"int32\" name=\"" << coldx << "\"";
+			//delta-friendly columns get packed relative to their previous value
+			string enc = suggest_encoding(stats[coldx - 1].finish());
+			if (enc == "delta" || enc == "dod") {
+				dsdef << " pack_relative=\"" << coldx << "\"";
+			}
+			dsdef << " />" << endl;
 		}
-		ts.close();
+		dsdef << "</ExtentType>" << endl;
 	}
+};
+
+void insert_csv_multi(DataMulti data, int twidth, int vwidth, const char *output) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "csv only supports 4 byte samples" << endl;
+		return;
+	}
+
+	CsvSink csv(output);
+	vector<GroupSink*> sinks(1, &csv);
+	run_sinks(data, sinks);
 }
 
 void test_insert_csv_multi() {
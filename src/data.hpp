@@ -11,6 +11,10 @@
 #include <unistd.h>
 #include <dirent.h>
 
+#include "catalog.hpp"
+#include "mapped.hpp"
+#include "parallel.hpp"
+
 using namespace std;
 
 /**
@@ -43,21 +47,16 @@ enum StreamT { TS, VS };
 class DataMulti {
 private:
 	void init() {
-		DIR *dir;
-		struct dirent *ent;
-		if (NULL != (dir = opendir(tsdir))) {
-			while (NULL != (ent = readdir(dir))) {
-				string name = string(ent->d_name);
-				if (name.length() > 3) {
-					name.erase(name.find("."));
-					//assume mergemap is complete.
-					// just check for entries not in mergemap
-					if (merge.find(name) == merge.end() && (name != "fmerge")) {
-						cerr << "Warning: could not find ts entry for " << name << endl;
-					}
+		if (catalog.refresh(tsdir)) {
+			for (map<string, CatalogEntry>::const_iterator it = catalog.entries.begin();
+					it != catalog.entries.end(); ++it) {
+				string name = it->first.substr(0, it->first.find("."));
+				//assume mergemap is complete.
+				// just check for entries not in mergemap
+				if (merge.find(name) == merge.end() && (name != "fmerge")) {
+					cerr << "Warning: could not find ts entry for " << name << endl;
 				}
 			}
-			closedir(dir);
 		} else {
 			cerr << "Coudln't open directory " << tsdir << endl;
 		}
@@ -65,6 +64,7 @@ private:
 
 public:
 	map<string, set<string> > merge;
+	Catalog catalog;
 	const char* tsdir;
 	const char* vsdir;
 	DataMulti(const char *_tsdir, const char *_vsdir,
@@ -87,6 +87,148 @@ public:
 	}
 };
 
+/**
+ * @returns FNV-1a hash of name, for assigning streams to output shards
+ *  (stable, so a stream keeps its shard as others come and go)
+ */
+uint32_t shard_hash(const string &name) {
+	uint32_t h = 2166136261U;
+	for (size_t c = 0; c < name.size(); ++c) {
+		h = (h ^ (uint8_t) name[c]) * 16777619U;
+	}
+	return h;
+}
+
+/**
+ * @returns rows per block handed out by GroupReader (--rows)
+ */
+size_t group_block_rows() {
+	return opt_int("rows", 65536);
+}
+
+/**
+ * A run of rows of one merge group. Columns point into the mapped streams
+ *  where possible; value streams shorter than the timestamps are zero padded.
+ */
+struct GroupBlock {
+	size_t start;
+	size_t nrows;
+	const int32_t *ts;
+	vector<const int32_t*> vals;
+};
+
+/**
+ * Reads a merge group: each stream is mapped once and every block hands out
+ *  the same timestamp column to all value columns. rewind() starts over
+ *  without touching the files again.
+ */
+class GroupReader {
+private:
+	MappedFile *ts;
+	vector<MappedFile*> vs;
+	//zero padded copies of the current block for short value streams
+	vector<vector<int32_t> > padded;
+	size_t pos;
+
+	GroupReader(const GroupReader&);
+	GroupReader& operator=(const GroupReader&);
+
+protected:
+	/**
+	 * For readers over other storage: they fill in the public fields and
+	 *  override ok/rewind/next
+	 */
+	GroupReader() : ts(NULL), pos(0), nrows(0), n_vstream_failures(0) {}
+
+public:
+	string tsname;
+	vector<string> columns;
+	vector<string> vsnames;
+	//rows handed out over the whole group. Readers that drop rows
+	// (ReorderReader) only know it once next() has returned false, and
+	// hold an upper bound until then
+	size_t nrows;
+	//(row, column) cells past the end of a short or missing value stream
+	long n_vstream_failures;
+
+	GroupReader(DataMulti &data, map<string, set<string> >::const_iterator group) :
+			pos(0), nrows(0), n_vstream_failures(0) {
+		tsname = data.get_name((*group).first, TS);
+		ts = new MappedFile(tsname.c_str());
+		nrows = ts->size / sizeof(int32_t);
+		for (set<string>::const_iterator sit = (*group).second.begin(); sit != (*group).second.end(); ++sit) {
+			columns.push_back(*sit);
+			vsnames.push_back(data.get_name(*sit, VS));
+			vs.push_back(new MappedFile(vsnames.back().c_str()));
+			if (!vs.back()->ok) {
+				cerr << "Missing value stream: " << vsnames.back() << endl;
+			}
+		}
+		padded.resize(vs.size());
+	}
+
+	virtual ~GroupReader() {
+		delete ts;
+		for (unsigned i = 0; i < vs.size(); ++i) {
+			delete vs[i];
+		}
+	}
+
+	virtual bool ok() const {
+		return ts->ok;
+	}
+
+	virtual void rewind() {
+		pos = 0;
+	}
+
+	/**
+	 * @returns true if timestamps strictly increase over the whole group,
+	 *  checked without handing out any rows (false if unknown)
+	 */
+	virtual bool strictly_increasing() const {
+		if (NULL == ts || !ts->ok) {
+			return false;
+		}
+		const int32_t *t = (const int32_t*) ts->data;
+		for (size_t i = 1; i < nrows; ++i) {
+			if (t[i] <= t[i - 1]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Fill blk with up to maxrows rows
+	 * @returns false once every row has been handed out
+	 */
+	virtual bool next(GroupBlock &blk, size_t maxrows) {
+		if (pos >= nrows) {
+			return false;
+		}
+		blk.start = pos;
+		blk.nrows = min(maxrows, nrows - pos);
+		blk.ts = (const int32_t*) ts->data + pos;
+		blk.vals.resize(vs.size());
+		for (unsigned i = 0; i < vs.size(); ++i) {
+			size_t have = vs[i]->size / sizeof(int32_t);
+			if (have >= pos + blk.nrows) {
+				blk.vals[i] = (const int32_t*) vs[i]->data + pos;
+			} else {
+				padded[i].assign(blk.nrows, 0);
+				if (have > pos) {
+					memcpy(&padded[i][0], (const int32_t*) vs[i]->data + pos, (have - pos) * sizeof(int32_t));
+				}
+				n_vstream_failures += blk.nrows - (have > pos ? have - pos : 0);
+				blk.vals[i] = &padded[i][0];
+			}
+		}
+		pos += blk.nrows;
+		return true;
+	}
+};
+
 /**
  * Data source - flat binary files, one value stream per timestamp stream
  */
@@ -101,25 +243,19 @@ private:
 	map<string, string> *revmap;
 
 	void init() {
-		DIR *dir;
-		struct dirent *ent;
-		if (NULL != (dir = opendir(tsdir))) {
-			while (NULL != (ent = readdir(dir))) {
-				const char* name = ent->d_name;
-				if (name[0] != '\0' && name[1] != '\0' && name[2] != '\0') {
-					//XXX: we should really copy.
-					char *dloc = const_cast<char*>(strchr(name, '.'));
-					*dloc = '\0';
-					diritems.insert(string(name));
-				}
+		if (catalog.refresh(tsdir)) {
+			for (map<string, CatalogEntry>::const_iterator it = catalog.entries.begin();
+					it != catalog.entries.end(); ++it) {
+				diritems.insert(it->first.substr(0, it->first.find(".")));
 			}
-			closedir(dir);
 		} else {
 			cout << "Coudln't open directory " << tsdir << endl;
 		}
 	}
 
 public:
+	Catalog catalog;
+
 	Data(const char* _tsdir, const char* _vsdir) :
 		tsdir(_tsdir), vsdir(_vsdir), isMulti(false), dmulti(NULL), revmap(NULL) {
 
@@ -146,6 +282,18 @@ public:
 		return diritems.end();
 	}
 
+	/**
+	 * @returns the same streams as a DataMulti, grouped as in the one
+	 *  wrapped or one group per stream, to read them through GroupReader
+	 */
+	DataMulti as_multi() {
+		map<string, set<string> > groups;
+		for (set<string>::const_iterator it = diritems.begin(); it != diritems.end(); ++it) {
+			groups[isMulti ? (*revmap)[*it] : *it].insert(*it);
+		}
+		return DataMulti(tsdir, vsdir, groups);
+	}
+
 	string get_name(string item, StreamT type) {
 		if (isMulti && type == TS) {
 			return string(tsdir) + string("/") + (*revmap)[item] + string(".ts");
@@ -156,44 +304,133 @@ public:
 	}
 };
 
-map<string, set<string> > getMergeMap(const char* fname) {
+/**
+ * A newline-aligned slice of a mergemap file and the (tskey, vskey) pairs in it
+ */
+struct MergeMapChunk {
+	const char *begin;
+	const char *end;
+	vector<pair<string, string> > entries;
+	long nbad;
+};
+
+/**
+ * @brief Parse lines of "<tskey> <dir>/<vskey>.<ext>" into chunk.entries
+ */
+void parse_mergemap_chunk(MergeMapChunk &chunk) {
+	const char *p = chunk.begin;
+	const char *end = chunk.end;
+	while (p < end) {
+		//fields are split on any blank, as the old stream parser did; SIMD
+		// scans find each field's end, stopping at the newline on short lines
+		const char *key = skip_blanks(p, end);
+		const char *sep = find_blank(key, end);
+		const char *vs = skip_blanks(sep, end);
+		const char *vend = find_blank(vs, end);
+		const char *nl = (vend < end && *vend == '\n') ? vend : find_byte(vend, end, '\n');
+
+		if (vs < vend) {
+			//strip the directory, then everything from the first '.'
+			const char *base = vs;
+			for (const char *q = vend; q > vs; --q) {
+				if (q[-1] == '/') {
+					base = q;
+					break;
+				}
+			}
+			const char *dot = find_byte(base, vend, '.');
+			chunk.entries.push_back(make_pair(string(key, sep), string(base, dot)));
+		} else if (key < nl) {
+			++chunk.nbad;
+		}
+
+		p = nl + 1;
+	}
+}
+
+struct MergeMapChunkParser {
+	vector<MergeMapChunk> *chunks;
+	void operator()(size_t i) {
+		parse_mergemap_chunk((*chunks)[i]);
+	}
+};
+
+/**
+ * @brief Parse a mergemap (lines of "<hash> *<path>.ts.enc").
+ *  The file is mapped, cut into chunks on newline boundaries and the
+ *  chunks parsed in parallel (see --threads).
+ * @returns timestamp stream name -> value stream names sharing it
+ */
+map<string, set<string> > parseMergeMap(const char* fname) {
 	map<string, set<string> > themap;
-	ifstream fin(fname, ios::in);
+	MappedFile fin(fname);
 
-	if (!fin) {
+	if (!fin.ok) {
 		cerr << "coudln't find map input file " << fname << endl;
+		return themap;
 	}
 
-	int ldx = 0;
-	string tskey;
-	string vskey;
-	while (fin.good()) {
-		if (ldx % 2 == 0) {
-			fin >> tskey;
-		} else {
-			fin >> vskey;
-			unsigned pos = vskey.rfind("/");
-			if (pos != string::npos) {
-				vskey.erase(0, pos + 1);
-			}
-			pos = vskey.find(".");
-			if (pos != string::npos) {
-				vskey.erase(vskey.find("."));
-			}
-			if (themap.find(tskey) == themap.end()) {
-				themap[tskey] = set<string>();
-			}
-			themap[tskey].insert(vskey);
+	const size_t minchunk = 1 << 20;
+	unsigned nthreads = default_threads();
+	size_t chunksize = max(minchunk, fin.size / (nthreads * 4) + 1);
+
+	vector<MergeMapChunk> chunks;
+	const char *p = fin.data;
+	const char *end = fin.data + fin.size;
+	while (p < end) {
+		MergeMapChunk chunk;
+		chunk.begin = p;
+		chunk.end = (size_t) (end - p) > chunksize ?
+				find_byte(p + chunksize, end, '\n') : end;
+		if (chunk.end < end) {
+			++chunk.end;
 		}
-		if (!fin.good()) {
-			break;
+		chunk.nbad = 0;
+		chunks.push_back(chunk);
+		p = chunk.end;
+	}
+
+	MergeMapChunkParser parser;
+	parser.chunks = &chunks;
+	parallel_for(chunks.size(), parser, nthreads);
+
+	//chunks are in file order and the file is sorted, so hinted inserts
+	// at the end are amortized constant time
+	long nbad = 0;
+	map<string, set<string> >::iterator last = themap.end();
+	for (unsigned c = 0; c < chunks.size(); ++c) {
+		vector<pair<string, string> > &entries = chunks[c].entries;
+		for (unsigned i = 0; i < entries.size(); ++i) {
+			if (last == themap.end() || last->first != entries[i].first) {
+				last = themap.insert(themap.end(), make_pair(entries[i].first, set<string>()));
+			}
+			last->second.insert(last->second.end(), entries[i].second);
 		}
+		nbad += chunks[c].nbad;
+	}
 
-		++ldx;
+	if (0 != nbad) {
+		cerr << "Warning: skipped malformed mergemap lines: count=" << nbad << endl;
 	}
 
-	fin.close();
+	return themap;
+}
 
+/**
+ * @brief Load a mergemap, reusing the cached parse next to it when the
+ *  file hasn't changed since it was written (see Catalog)
+ */
+map<string, set<string> > getMergeMap(const char* fname) {
+	map<string, set<string> > themap;
+	struct stat st;
+	bool statted = (0 == stat(fname, &st));
+	if (statted && load_mergemap_cache(fname, st, themap)) {
+		return themap;
+	}
+	themap = parseMergeMap(fname);
+	if (statted && !themap.empty()) {
+		save_mergemap_cache(fname, st, themap);
+	}
 	return themap;
 }
 
@@ -209,7 +446,11 @@ void test_datamulti() {
 }
 
 void test_mergemap() {
-	getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt");
+	map<string, set<string> > mm =
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt");
+	for (map<string, set<string> >::const_iterator it = mm.begin(); it != mm.end(); ++it) {
+		cerr << (*it).first << ": " << (*it).second.size() << " value streams" << endl;
+	}
 }
 
 #endif /* DATA_HPP_ */
@@ -0,0 +1,191 @@
+/*
+ * dict.hpp
+ * Per-block dictionary encoding with predicate evaluation on codes
+ */
+
+#ifndef DICT_HPP_
+#define DICT_HPP_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "bits.hpp"
+#include "stats.hpp"
+
+using namespace std;
+
+/**
+ * Open addressing value -> code table; codes are handed out in order of
+ *  first appearance
+ */
+class DictHash {
+private:
+	vector<int32_t> keys;
+	//code + 1, 0 marks an empty slot
+	vector<uint32_t> slots;
+	uint32_t mask;
+
+	void grow() {
+		vector<int32_t> oldkeys;
+		oldkeys.swap(keys);
+		slots.assign(slots.size() * 2, 0);
+		mask = slots.size() - 1;
+		for (unsigned i = 0; i < oldkeys.size(); ++i) {
+			insert(oldkeys[i]);
+		}
+	}
+
+public:
+	DictHash() : slots(1024, 0), mask(1023) {}
+
+	uint32_t insert(int32_t v) {
+		uint32_t h = (uint32_t) mix64((uint32_t) v) & mask;
+		while (slots[h] != 0) {
+			if (keys[slots[h] - 1] == v) {
+				return slots[h] - 1;
+			}
+			h = (h + 1) & mask;
+		}
+		keys.push_back(v);
+		slots[h] = keys.size();
+		if (keys.size() * 2 > slots.size()) {
+			grow();
+		}
+		return keys.size() - 1;
+	}
+
+	const vector<int32_t>& values() const {
+		return keys;
+	}
+};
+
+int dict_code_width(size_t ndict) {
+	return bit_width(ndict > 1 ? ndict - 1 : 0);
+}
+
+/**
+ * @brief Dictionary encode n values: sorted dictionary (delta varints)
+ *  then bit packed codes. Sorting keeps codes order preserving, so range
+ *  predicates become code ranges.
+ */
+void dict_encode(const int32_t *in, size_t n, vector<uint8_t> &out) {
+	DictHash hash;
+	vector<uint32_t> codes(n);
+	for (size_t i = 0; i < n; ++i) {
+		codes[i] = hash.insert(in[i]);
+	}
+
+	const vector<int32_t> &seen = hash.values();
+	vector<pair<int32_t, uint32_t> > order(seen.size());
+	for (unsigned c = 0; c < seen.size(); ++c) {
+		order[c] = make_pair(seen[c], c);
+	}
+	sort(order.begin(), order.end());
+	vector<uint32_t> remap(seen.size());
+	put_varint(out, order.size());
+	uint32_t prev = 0;
+	for (unsigned c = 0; c < order.size(); ++c) {
+		remap[order[c].second] = c;
+		put_varint(out, (uint32_t) order[c].first - prev);
+		prev = order[c].first;
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		codes[i] = remap[codes[i]];
+	}
+	pack_bits(n ? &codes[0] : NULL, n, dict_code_width(order.size()), out);
+}
+
+enum DictOp { EQ, NE, LT, LE, GT, GE };
+
+bool parse_dict_op(const string &op, DictOp &out) {
+	const char *names[] = {"eq", "ne", "lt", "le", "gt", "ge"};
+	for (int i = 0; i < 6; ++i) {
+		if (op == names[i]) {
+			out = (DictOp) i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Read-only view of a dict_encode block; codes stay packed
+ */
+class DictView {
+public:
+	vector<int32_t> dict;
+	const uint8_t *codes;
+	size_t n;
+	int width;
+
+	/**
+	 * @returns pointer past the block
+	 */
+	const uint8_t* parse(const uint8_t *in, size_t _n) {
+		const uint8_t *p = in;
+		n = _n;
+		uint32_t ndict = get_varint(p);
+		dict.resize(ndict);
+		uint32_t prev = 0;
+		for (uint32_t d = 0; d < ndict; ++d) {
+			prev += get_varint(p);
+			dict[d] = (int32_t) prev;
+		}
+		width = dict_code_width(ndict);
+		codes = p;
+		return p + (n * width + 7) / 8;
+	}
+
+	void decode(int32_t *out) const {
+		BitReader br(codes);
+		for (size_t i = 0; i < n; ++i) {
+			out[i] = dict[br.get(width)];
+		}
+	}
+
+	/**
+	 * @brief The codes [lo, hi) whose values satisfy (value op v)
+	 */
+	void code_range(DictOp op, int32_t v, uint32_t &lo, uint32_t &hi) const {
+		uint32_t lb = lower_bound(dict.begin(), dict.end(), v) - dict.begin();
+		uint32_t ub = upper_bound(dict.begin(), dict.end(), v) - dict.begin();
+		switch (op) {
+		case EQ: case NE: lo = lb; hi = ub; break;
+		case LT: lo = 0; hi = lb; break;
+		case LE: lo = 0; hi = ub; break;
+		case GT: lo = ub; hi = dict.size(); break;
+		case GE: lo = lb; hi = dict.size(); break;
+		}
+	}
+
+	/**
+	 * @brief Count rows matching (value op v) by comparing packed codes,
+	 *  never materializing values. Predicates that match no or every
+	 *  dictionary entry skip the scan.
+	 */
+	size_t count(DictOp op, int32_t v) const {
+		uint32_t lo = 0;
+		uint32_t hi = 0;
+		code_range(op, v, lo, hi);
+		size_t hits;
+		if (lo >= hi) {
+			hits = 0;
+		} else if (lo == 0 && hi == dict.size()) {
+			hits = n;
+		} else {
+			hits = 0;
+			BitReader br(codes);
+			for (size_t i = 0; i < n; ++i) {
+				uint32_t c = br.get(width);
+				hits += (c >= lo) & (c < hi);
+			}
+		}
+		return (op == NE) ? n - hits : hits;
+	}
+};
+
+#endif /* DICT_HPP_ */
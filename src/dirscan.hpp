@@ -0,0 +1,245 @@
+/*
+ * dirscan.hpp
+ * Parallel directory enumeration and batched stat
+ */
+
+#ifndef DIRSCAN_HPP_
+#define DIRSCAN_HPP_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "parallel.hpp"
+
+using namespace std;
+
+int64_t stat_mtime_ns(const struct stat &st) {
+#ifdef __linux__
+	return (int64_t) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+	return (int64_t) st.st_mtime * 1000000000LL;
+#endif
+}
+
+/**
+ * One directory entry. size/mtime are filled by stat_entries.
+ */
+struct ScanEntry {
+	string dir;
+	string name;
+	unsigned char type;
+	bool statted;
+	uint64_t size;
+	int64_t mtime;
+
+	string path() const {
+		return dir + "/" + name;
+	}
+};
+
+#if defined(__linux__) && defined(SYS_getdents64)
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/**
+ * @brief List dir with getdents64 into a large buffer: one syscall per
+ *  few thousand entries instead of readdir's libc-sized batches
+ * @returns false if dir couldn't be opened
+ */
+bool list_dir_entries(const string &dir, vector<ScanEntry> &out) {
+	int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		return false;
+	}
+	const size_t bufsize = 1 << 20;
+	vector<char> buf(bufsize);
+	ScanEntry ent;
+	ent.dir = dir;
+	ent.statted = false;
+	ent.size = 0;
+	ent.mtime = 0;
+
+	long nread;
+	while ((nread = syscall(SYS_getdents64, fd, &buf[0], bufsize)) > 0) {
+		for (long off = 0; off < nread; ) {
+			linux_dirent64 *d = (linux_dirent64*) (&buf[0] + off);
+			off += d->d_reclen;
+			if (d->d_name[0] == '.') {
+				continue;
+			}
+			ent.name = d->d_name;
+			ent.type = d->d_type;
+			out.push_back(ent);
+		}
+	}
+	close(fd);
+	return nread == 0;
+}
+#else
+bool list_dir_entries(const string &dir, vector<ScanEntry> &out) {
+	DIR *d;
+	struct dirent *de;
+	if (NULL == (d = opendir(dir.c_str()))) {
+		return false;
+	}
+	ScanEntry ent;
+	ent.dir = dir;
+	ent.statted = false;
+	ent.size = 0;
+	ent.mtime = 0;
+	while (NULL != (de = readdir(d))) {
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		ent.name = de->d_name;
+#ifdef _DIRENT_HAVE_D_TYPE
+		ent.type = de->d_type;
+#else
+		ent.type = DT_UNKNOWN;
+#endif
+		out.push_back(ent);
+	}
+	closedir(d);
+	return true;
+}
+#endif
+
+/**
+ * @brief stat one entry, preferring statx asking only for size and mtime
+ */
+bool stat_entry(ScanEntry &ent) {
+	string path = ent.path();
+#if defined(__linux__) && defined(STATX_SIZE)
+	struct statx stx;
+	if (0 != statx(AT_FDCWD, path.c_str(), AT_STATX_DONT_SYNC,
+			STATX_TYPE | STATX_SIZE | STATX_MTIME, &stx)) {
+		return false;
+	}
+	ent.size = stx.stx_size;
+	ent.mtime = (int64_t) stx.stx_mtime.tv_sec * 1000000000LL + stx.stx_mtime.tv_nsec;
+	ent.type = S_ISDIR(stx.stx_mode) ? DT_DIR : (S_ISREG(stx.stx_mode) ? DT_REG : DT_UNKNOWN);
+#else
+	struct stat st;
+	if (0 != stat(path.c_str(), &st)) {
+		return false;
+	}
+	ent.size = st.st_size;
+	ent.mtime = stat_mtime_ns(st);
+	ent.type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+#endif
+	ent.statted = true;
+	return true;
+}
+
+struct StatBatch {
+	vector<ScanEntry> *entries;
+	size_t batch;
+	void operator()(size_t b) {
+		size_t end = min(entries->size(), (b + 1) * batch);
+		for (size_t i = b * batch; i < end; ++i) {
+			stat_entry((*entries)[i]);
+		}
+	}
+};
+
+/**
+ * @brief Fill size/mtime for every entry, in batches spread over nthreads
+ */
+void stat_entries(vector<ScanEntry> &entries, unsigned nthreads) {
+	StatBatch sb;
+	sb.entries = &entries;
+	sb.batch = 512;
+	parallel_for((entries.size() + sb.batch - 1) / sb.batch, sb, nthreads);
+}
+
+struct DirLister {
+	const vector<string> *dirs;
+	vector<vector<ScanEntry> > *found;
+	vector<char> *failed;
+	void operator()(size_t i) {
+		(*failed)[i] = !list_dir_entries((*dirs)[i], (*found)[i]);
+	}
+};
+
+/**
+ * @brief Enumerate and stat every file under roots. Directories are listed
+ *  level by level, each level's directories sharded across threads.
+ * @param recursive descend into subdirectories
+ * @returns regular files only; directories that couldn't be read are
+ *  reported on stderr
+ */
+vector<ScanEntry> scan_dirs(const vector<string> &roots, bool recursive, unsigned nthreads) {
+	vector<ScanEntry> files;
+	vector<string> level(roots);
+
+	while (!level.empty()) {
+		vector<vector<ScanEntry> > found(level.size());
+		vector<char> failed(level.size());
+		DirLister lister;
+		lister.dirs = &level;
+		lister.found = &found;
+		lister.failed = &failed;
+		parallel_for(level.size(), lister, nthreads);
+
+		vector<ScanEntry> listed;
+		for (unsigned d = 0; d < level.size(); ++d) {
+			if (failed[d]) {
+				cerr << "Coudln't open directory " << level[d] << endl;
+			}
+			listed.insert(listed.end(), found[d].begin(), found[d].end());
+		}
+		stat_entries(listed, nthreads);
+
+		vector<string> next;
+		for (unsigned i = 0; i < listed.size(); ++i) {
+			if (!listed[i].statted) {
+				continue;
+			}
+			if (listed[i].type == DT_DIR) {
+				if (recursive) {
+					next.push_back(listed[i].path());
+				}
+			} else if (listed[i].type == DT_REG) {
+				files.push_back(listed[i]);
+			}
+		}
+		level.swap(next);
+	}
+
+	return files;
+}
+
+/**
+ * @brief Print entry count, bytes and scan time for the given directories
+ */
+void print_scan(const vector<string> &roots, bool recursive) {
+	double start = wall_seconds();
+	vector<ScanEntry> files = scan_dirs(roots, recursive, default_threads());
+	double secs = wall_seconds() - start;
+
+	uint64_t bytes = 0;
+	for (unsigned i = 0; i < files.size(); ++i) {
+		bytes += files[i].size;
+	}
+	cout << "files " << files.size() << endl;
+	cout << "bytes " << bytes << endl;
+	cout << "seconds " << secs << endl;
+}
+
+#endif /* DIRSCAN_HPP_ */
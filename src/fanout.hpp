@@ -0,0 +1,110 @@
+/*
+ * fanout.hpp
+ * Feed several backends from a single scan of the input
+ */
+
+#ifndef FANOUT_HPP_
+#define FANOUT_HPP_
+
+#include "arrow.hpp"
+#include "compact.hpp"
+#include "csv.hpp"
+#include "data.hpp"
+#include "opentsdb.hpp"
+#include "parquet.hpp"
+#include "sink.hpp"
+#include "sqlite.hpp"
+#include "tscol.hpp"
+
+using namespace std;
+
+/**
+ * @brief The backends named in --sinks (comma separated, default
+ *  sqlite,csv,opentsdb; compact, tscol, arrow, parquet, influx and
+ *  promwrite are also available). Outputs: output.db, output-N.{csv,xml},
+ *  output.tsdb (plus output.tsdb.metrics), output-N.cmp, output-N.tsc,
+ *  output-N.arrow, output-N.parquet, output.influx and output.prw.
+ * @param streams every value stream name, for opentsdb metric numbering
+ */
+void make_sinks(const set<string> &streams, const char *output, vector<GroupSink*> &sinks) {
+	string base(output);
+	stringstream names(opt_str("sinks", "sqlite,csv,opentsdb"));
+	string name;
+	while (getline(names, name, ',')) {
+		if (name == "sqlite") {
+			sinks.push_back(new SqliteSink((base + ".db").c_str()));
+		} else if (name == "csv") {
+			sinks.push_back(new CsvSink(output));
+		} else if (name == "opentsdb") {
+			sinks.push_back(new OpenTsdbSink(streams, base + ".tsdb"));
+		} else if (name == "compact") {
+			sinks.push_back(new CompactSink(output));
+		} else if (name == "tscol") {
+			sinks.push_back(new TscolSink(output));
+		} else if (name == "arrow") {
+			sinks.push_back(new ArrowSink(output));
+		} else if (name == "parquet") {
+			sinks.push_back(new ParquetSink(output));
+		} else if (name == "influx") {
+			sinks.push_back(new InfluxSink(base + ".influx"));
+		} else if (name == "promwrite") {
+			sinks.push_back(new PromWriteSink(base + ".prw"));
+		} else {
+			cerr << "unknown sink " << name << endl;
+		}
+	}
+}
+
+void delete_sinks(vector<GroupSink*> &sinks) {
+	for (unsigned s = 0; s < sinks.size(); ++s) {
+		delete sinks[s];
+	}
+	sinks.clear();
+}
+
+/**
+ * @brief Write every --sinks backend from one pass over data
+ */
+void insert_all_multi(DataMulti data, int twidth, int vwidth, const char *output) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "all multi only supports 4 byte samples" << endl;
+		return;
+	}
+
+	set<string> streams;
+	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
+		streams.insert((*it).second.begin(), (*it).second.end());
+	}
+
+	vector<GroupSink*> sinks;
+	make_sinks(streams, output, sinks);
+	run_sinks(data, sinks);
+	delete_sinks(sinks);
+}
+
+/**
+ * @brief Write every --sinks backend from .tsc files (one per group)
+ *  instead of loose .ts/.vs streams
+ */
+void insert_all_tscol(const vector<string> &files, const char *output) {
+	set<string> streams;
+	for (unsigned i = 0; i < files.size(); ++i) {
+		TscolFile file(files[i].c_str());
+		if (file.ok) {
+			streams.insert(file.names.begin() + 1, file.names.end());
+		}
+	}
+
+	vector<GroupSink*> sinks;
+	make_sinks(streams, output, sinks);
+	run_sinks_tscol(files, sinks);
+	delete_sinks(sinks);
+}
+
+void test_insert_all_multi() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	insert_all_multi(data, 4, 4, "out-all");
+}
+
+#endif /* FANOUT_HPP_ */
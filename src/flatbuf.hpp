@@ -0,0 +1,171 @@
+/*
+ * flatbuf.hpp
+ * Minimal FlatBuffers writer, enough for Arrow IPC metadata. Objects are
+ *  laid out front to back: a table's vtable just before it and everything
+ *  it refers to after it, so offsets only ever point forward.
+ */
+
+#ifndef FLATBUF_HPP_
+#define FLATBUF_HPP_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * One scalar or offset field of a table; offsets are written as
+ *  placeholders and linked once their target exists
+ */
+struct FlatField {
+	int id;
+	int size;
+	uint64_t value;
+	bool offset;
+};
+
+FlatField flat_scalar(int id, int size, uint64_t value) {
+	FlatField f = {id, size, value, false};
+	return f;
+}
+
+FlatField flat_offset(int id) {
+	FlatField f = {id, 4, 0, true};
+	return f;
+}
+
+class FlatWriter {
+public:
+	vector<uint8_t> buf;
+
+	size_t pos() const {
+		return buf.size();
+	}
+
+	/**
+	 * @brief Pad until (position + skew) is a multiple of align
+	 */
+	void pad_to(size_t align, size_t skew = 0) {
+		while ((buf.size() + skew) % align) {
+			buf.push_back(0);
+		}
+	}
+
+	void put(uint64_t v, int size) {
+		for (int i = 0; i < size; ++i) {
+			buf.push_back((uint8_t) (v >> (8 * i)));
+		}
+	}
+
+	void set_u32(size_t at, uint32_t v) {
+		for (int i = 0; i < 4; ++i) {
+			buf[at + i] = (uint8_t) (v >> (8 * i));
+		}
+	}
+
+	/**
+	 * @brief Point the offset placeholder at `at` to target, which follows it
+	 */
+	void link(size_t at, size_t target) {
+		set_u32(at, target - at);
+	}
+
+	/**
+	 * @brief Root offset placeholder; must come first
+	 */
+	size_t root() {
+		put(0, 4);
+		return 0;
+	}
+
+	/**
+	 * @brief Write a vtable and its table. Fields are placed widest first
+	 *  after the vtable offset, the table starting 4 bytes short of an 8
+	 *  byte boundary so every field is naturally aligned.
+	 * @param at set to the position of each field, indexed by id
+	 * @returns the table position
+	 */
+	size_t table(const vector<FlatField> &fields, vector<size_t> &at) {
+		int maxid = -1;
+		for (unsigned i = 0; i < fields.size(); ++i) {
+			maxid = max(maxid, fields[i].id);
+		}
+		vector<int> order;
+		for (int size = 8; size >= 1; size /= 2) {
+			for (unsigned i = 0; i < fields.size(); ++i) {
+				if (fields[i].size == size) {
+					order.push_back(i);
+				}
+			}
+		}
+		vector<uint16_t> fieldoff(maxid + 1, 0);
+		size_t tblsize = 4;
+		for (unsigned i = 0; i < order.size(); ++i) {
+			fieldoff[fields[order[i]].id] = tblsize;
+			tblsize += fields[order[i]].size;
+		}
+
+		pad_to(2);
+		size_t vt = pos();
+		put(4 + 2 * (maxid + 1), 2);
+		put(tblsize, 2);
+		for (int id = 0; id <= maxid; ++id) {
+			put(fieldoff[id], 2);
+		}
+
+		pad_to(8, 4);
+		size_t tbl = pos();
+		put(tbl - vt, 4);
+		at.assign(maxid + 1, 0);
+		for (unsigned i = 0; i < order.size(); ++i) {
+			const FlatField &f = fields[order[i]];
+			at[f.id] = pos();
+			put(f.value, f.size);
+		}
+		return tbl;
+	}
+
+	size_t str(const string &s) {
+		pad_to(4);
+		size_t p = pos();
+		put(s.size(), 4);
+		buf.insert(buf.end(), s.begin(), s.end());
+		buf.push_back(0);
+		return p;
+	}
+
+	/**
+	 * @brief Vector of n offset placeholders (to tables)
+	 * @param at set to the position of each element
+	 */
+	size_t offset_vector(size_t n, vector<size_t> &at) {
+		pad_to(4);
+		size_t p = pos();
+		put(n, 4);
+		at.resize(n);
+		for (size_t i = 0; i < n; ++i) {
+			at[i] = pos();
+			put(0, 4);
+		}
+		return p;
+	}
+
+	/**
+	 * @brief Vector of n structs of 8 byte words (words.size() / n each),
+	 *  elements 8 byte aligned
+	 */
+	size_t struct_vector(const vector<uint64_t> &words, size_t n) {
+		pad_to(8, 4);
+		size_t p = pos();
+		put(n, 4);
+		for (unsigned i = 0; i < words.size(); ++i) {
+			put(words[i], 8);
+		}
+		return p;
+	}
+};
+
+#endif /* FLATBUF_HPP_ */
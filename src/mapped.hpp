@@ -0,0 +1,188 @@
+/*
+ * mapped.hpp
+ * Read-only memory mapped files and byte scanning helpers
+ */
+
+#ifndef MAPPED_HPP_
+#define MAPPED_HPP_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+/**
+ * Whole-file read-only mapping. Falls back to reading into a heap
+ *  buffer where mmap is unavailable.
+ */
+class MappedFile {
+private:
+	int fd;
+	bool mapped;
+
+	//no copies; the mapping is owned
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+	const char *data;
+	size_t size;
+	bool ok;
+
+	MappedFile(const char *fname) : fd(-1), mapped(false), data(NULL), size(0), ok(false) {
+		fd = open(fname, O_RDONLY);
+		if (fd < 0) {
+			return;
+		}
+		struct stat st;
+		if (0 != fstat(fd, &st)) {
+			return;
+		}
+		size = st.st_size;
+		ok = true;
+		if (0 == size) {
+			return;
+		}
+#ifndef _WIN32
+		void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr != MAP_FAILED) {
+			madvise(addr, size, MADV_SEQUENTIAL);
+			data = (const char*) addr;
+			mapped = true;
+			return;
+		}
+#endif
+		char *buf = (char*) malloc(size);
+		size_t got = 0;
+		while (got < size) {
+			ssize_t rc = read(fd, buf + got, size - got);
+			if (rc <= 0) {
+				break;
+			}
+			got += rc;
+		}
+		size = got;
+		data = buf;
+	}
+
+	~MappedFile() {
+#ifndef _WIN32
+		if (mapped) {
+			munmap(const_cast<char*>(data), size);
+		} else
+#endif
+		{
+			free(const_cast<char*>(data));
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+};
+
+/**
+ * @returns size of fname in bytes, 0 if it doesn't exist
+ */
+off_t file_bytes(const string &fname) {
+	struct stat st;
+	return 0 == stat(fname.c_str(), &st) ? st.st_size : 0;
+}
+
+/**
+ * @brief Find the first occurrence of either a or b in [p, end)
+ * @returns pointer to the match, or end
+ */
+const char* find_either(const char *p, const char *end, char a, char b) {
+#ifdef __SSE2__
+	const __m128i va = _mm_set1_epi8(a);
+	const __m128i vb = _mm_set1_epi8(b);
+	while (p + 16 <= end) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*) p);
+		int mask = _mm_movemask_epi8(_mm_or_si128(
+				_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+		if (0 != mask) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#endif
+	while (p < end && *p != a && *p != b) {
+		++p;
+	}
+	return p;
+}
+
+/**
+ * @brief Find the first blank (space, tab or CR) or newline in [p, end),
+ *  i.e. the end of a whitespace separated field
+ * @returns pointer to the match, or end
+ */
+const char* find_blank(const char *p, const char *end) {
+#ifdef __SSE2__
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i nl = _mm_set1_epi8('\n');
+	while (p + 16 <= end) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*) p);
+		int mask = _mm_movemask_epi8(_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, sp), _mm_cmpeq_epi8(chunk, tab)),
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, nl))));
+		if (0 != mask) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#endif
+	while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+		++p;
+	}
+	return p;
+}
+
+/**
+ * @brief Skip blanks (spaces, tabs and CRs, not newlines) from p
+ * @returns pointer to the first other byte in [p, end), or end
+ */
+const char* skip_blanks(const char *p, const char *end) {
+#ifdef __SSE2__
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i cr = _mm_set1_epi8('\r');
+	while (p + 16 <= end) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*) p);
+		int mask = ~_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, sp),
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, tab), _mm_cmpeq_epi8(chunk, cr)))) & 0xffff;
+		if (0 != mask) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#endif
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+		++p;
+	}
+	return p;
+}
+
+/**
+ * @returns pointer to the first c in [p, end), or end
+ */
+const char* find_byte(const char *p, const char *end, char c) {
+	const void *hit = memchr(p, c, end - p);
+	return (NULL == hit) ? end : (const char*) hit;
+}
+
+#endif /* MAPPED_HPP_ */
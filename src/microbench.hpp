@@ -0,0 +1,606 @@
+/*
+ * microbench.hpp
+ * Micro-benchmarks of the hot paths: stream file reads, codecs, integer
+ *  formatting and sqlite bind/step, per block size and data source, with
+ *  results as JSON in the layout Google Benchmark writes
+ */
+
+#ifndef MICROBENCH_HPP_
+#define MICROBENCH_HPP_
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "../inc/sqlite3.h"
+#include "codec.hpp"
+#include "data.hpp"
+#include "mapped.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+
+/**
+ * Values to benchmark on: a dataset's .ts or .vs streams, or a synthetic
+ *  series written to a temporary file
+ */
+struct BenchSource {
+	string name;
+	vector<string> files;
+	//the first --values values of the files, for the in-memory benchmarks
+	vector<int32_t> values;
+	bool temporary;
+};
+
+/**
+ * One benchmark: run does one iteration, adding what it processed to
+ *  bytes and items
+ */
+class MicroBench {
+public:
+	virtual ~MicroBench() {}
+	virtual string name() const = 0;
+	virtual void setup() {}
+	virtual void run(int64_t &bytes, int64_t &items) = 0;
+	virtual void teardown() {}
+};
+
+struct MicroBenchResult {
+	string name;
+	long iterations;
+	//per iteration
+	double real_ns;
+	double cpu_ns;
+	double bytes_per_second;
+	double items_per_second;
+};
+
+double cpu_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Run b for growing iteration counts until one run takes mintime
+ *  seconds, and report that run
+ */
+MicroBenchResult run_microbench(MicroBench &b, double mintime) {
+	b.setup();
+	MicroBenchResult res;
+	res.name = b.name();
+	long n = 1;
+	for (;;) {
+		int64_t bytes = 0;
+		int64_t items = 0;
+		double cpu = cpu_seconds();
+		double start = wall_seconds();
+		for (long i = 0; i < n; ++i) {
+			b.run(bytes, items);
+		}
+		double secs = wall_seconds() - start;
+		cpu = cpu_seconds() - cpu;
+		if (secs >= mintime || n >= 1000000000L) {
+			res.iterations = n;
+			res.real_ns = secs * 1e9 / n;
+			res.cpu_ns = cpu * 1e9 / n;
+			res.bytes_per_second = secs > 0 ? bytes / secs : 0;
+			res.items_per_second = secs > 0 ? items / secs : 0;
+			break;
+		}
+		//aim past mintime, growing at most tenfold per round
+		double grow = secs > 0 ? 1.4 * mintime / secs : 10;
+		n = max(n + 1, (long) (n * min(10.0, grow)));
+	}
+	b.teardown();
+	return res;
+}
+
+/**
+ * @brief Sum the int32s of a buffer, so reads can't be optimized away
+ */
+int64_t bench_consume(const char *p, size_t n) {
+	int64_t sum = 0;
+	const int32_t *v = (const int32_t*) p;
+	for (size_t i = 0; i < n / sizeof(int32_t); ++i) {
+		sum += v[i];
+	}
+	return sum;
+}
+
+enum BenchReadMethod { READ_IFSTREAM, READ_MMAP, READ_PREAD };
+
+/**
+ * Reads every file of a source start to end, block bytes at a time
+ */
+class ReadBench : public MicroBench {
+private:
+	const BenchSource &source;
+	BenchReadMethod method;
+	size_t block;
+	vector<char> buf;
+
+public:
+	volatile int64_t checksum;
+
+	ReadBench(const BenchSource &_source, BenchReadMethod _method, size_t _block) :
+		source(_source), method(_method), block(_block), checksum(0) {}
+
+	string name() const {
+		const char *methods[] = {"ifstream", "mmap", "pread"};
+		stringstream ss;
+		ss << "read/" << methods[method] << "/" << block << "/" << source.name;
+		return ss.str();
+	}
+
+	void setup() {
+		buf.resize(block);
+	}
+
+	void run(int64_t &bytes, int64_t &items) {
+		int64_t sum = 0;
+		for (unsigned f = 0; f < source.files.size(); ++f) {
+			const char *fname = source.files[f].c_str();
+			size_t total = 0;
+			if (method == READ_IFSTREAM) {
+				ifstream in(fname, ios::in | ios::binary);
+				while (in.read(&buf[0], block) || in.gcount() > 0) {
+					sum += bench_consume(&buf[0], in.gcount());
+					total += in.gcount();
+				}
+			} else if (method == READ_MMAP) {
+				MappedFile m(fname);
+				for (size_t at = 0; at < m.size; at += block) {
+					size_t n = min(block, m.size - at);
+					sum += bench_consume(m.data + at, n);
+					total += n;
+				}
+			} else {
+				int fd = open(fname, O_RDONLY);
+				ssize_t got;
+				while (fd >= 0 && (got = pread(fd, &buf[0], block, total)) > 0) {
+					sum += bench_consume(&buf[0], got);
+					total += got;
+				}
+				if (fd >= 0) {
+					close(fd);
+				}
+			}
+			bytes += total;
+			items += total / sizeof(int32_t);
+		}
+		checksum = sum;
+	}
+};
+
+/**
+ * Encodes or decodes a source's values with one codec, block values per
+ *  encoded block
+ */
+class CodecBench : public MicroBench {
+private:
+	const BenchSource &source;
+	unsigned codec;
+	bool decode;
+	size_t block;
+	vector<uint8_t> enc;
+	vector<int32_t> dec;
+
+public:
+	CodecBench(const BenchSource &_source, unsigned _codec, bool _decode, size_t _block) :
+		source(_source), codec(_codec), decode(_decode), block(_block) {}
+
+	string name() const {
+		stringstream ss;
+		ss << "codec/" << codecs()[codec]->name() << "/" << (decode ? "decode" : "encode") << "/" << block << "/"
+				<< source.name;
+		return ss.str();
+	}
+
+	void encode_all() {
+		const vector<int32_t> &vals = source.values;
+		enc.clear();
+		for (size_t start = 0; start < vals.size(); start += block) {
+			encode_block(&vals[start], min(block, vals.size() - start), enc, codec, 0);
+		}
+	}
+
+	void decode_all() {
+		dec.clear();
+		for (size_t pos = 0; pos < enc.size(); ) {
+			pos += decode_block(&enc[pos], dec);
+		}
+	}
+
+	void setup() {
+		dec.reserve(source.values.size());
+		encode_all();
+		decode_all();
+		if (dec != source.values) {
+			cerr << name() << " does not round trip" << endl;
+		}
+	}
+
+	void run(int64_t &bytes, int64_t &items) {
+		if (decode) {
+			decode_all();
+		} else {
+			encode_all();
+		}
+		bytes += source.values.size() * sizeof(int32_t);
+		items += source.values.size();
+	}
+};
+
+/**
+ * @brief Format v in decimal at p, two digits at a time
+ * @returns the end of the digits
+ */
+char* format_int_pairs(int32_t v, char *p) {
+	static const char pairs[] =
+			"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+			"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+			"8081828384858687888990919293949596979899";
+	uint32_t u = v;
+	if (v < 0) {
+		*p++ = '-';
+		u = 0 - u;
+	}
+	char tmp[10];
+	char *t = tmp + sizeof(tmp);
+	while (u >= 100) {
+		unsigned d = (u % 100) * 2;
+		u /= 100;
+		*--t = pairs[d + 1];
+		*--t = pairs[d];
+	}
+	if (u >= 10) {
+		*--t = pairs[u * 2 + 1];
+		*--t = pairs[u * 2];
+	} else {
+		*--t = '0' + u;
+	}
+	size_t len = tmp + sizeof(tmp) - t;
+	memcpy(p, t, len);
+	return p + len;
+}
+
+enum BenchFormatMethod { FORMAT_SPRINTF, FORMAT_SPRINTF_ZERO, FORMAT_OSTREAM, FORMAT_PAIRS };
+
+/**
+ * Formats a source's values as one per line, the way the text backends
+ *  do: sprintf (InfluxSink), sprintf skipping zeros (CsvSink), an ostream,
+ *  and a digit pair table
+ */
+class FormatBench : public MicroBench {
+private:
+	const BenchSource &source;
+	BenchFormatMethod method;
+	string line;
+	stringstream ss;
+
+public:
+	volatile size_t length;
+
+	FormatBench(const BenchSource &_source, BenchFormatMethod _method) :
+		source(_source), method(_method), length(0) {}
+
+	string name() const {
+		const char *methods[] = {"sprintf", "sprintf_zero", "ostream", "pairs"};
+		return string("format/") + methods[method] + "/" + source.name;
+	}
+
+	void run(int64_t &bytes, int64_t &items) {
+		const vector<int32_t> &vals = source.values;
+		char num[16];
+		size_t total = 0;
+		line.clear();
+		ss.str("");
+		for (size_t i = 0; i < vals.size(); ++i) {
+			int32_t v = vals[i];
+			if (method == FORMAT_OSTREAM) {
+				ss << v << '\n';
+				continue;
+			}
+			if (method == FORMAT_SPRINTF) {
+				sprintf(num, "%d", v);
+				line += num;
+			} else if (method == FORMAT_SPRINTF_ZERO) {
+				if (0 == v) {
+					line += '0';
+				} else {
+					sprintf(num, "%d", v);
+					line += num;
+				}
+			} else {
+				line.append(num, format_int_pairs(v, num) - num);
+			}
+			line += '\n';
+			//flush like a sink writing a block at a time
+			if (line.size() >= 65536) {
+				total += line.size();
+				line.clear();
+			}
+		}
+		total += line.size() + (size_t) ss.tellp();
+		length = total;
+		bytes += total;
+		items += vals.size();
+	}
+};
+
+/**
+ * Inserts a source's values as (index, value) rows of an in-memory db
+ *  with bound parameters, block rows per transaction, or steps through
+ *  the loaded table with a select
+ */
+class SqliteBench : public MicroBench {
+private:
+	const BenchSource &source;
+	bool select;
+	size_t block;
+	size_t nrows;
+	sqlite3 *db;
+
+	void load() {
+		sqlite3_exec(db, "drop table if exists t; create table t(time integer primary key, v integer)",
+				NULL, NULL, NULL);
+		sqlite3_stmt *stmt;
+		sqlite3_prepare_v2(db, "insert into t values(?1, ?2)", -1, &stmt, NULL);
+		//block 0 loads everything in one transaction
+		size_t per = block ? block : nrows;
+		for (size_t r = 0; r < nrows; ) {
+			sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+			for (size_t end = min(nrows, r + per); r < end; ++r) {
+				sqlite3_bind_int64(stmt, 1, r);
+				sqlite3_bind_int(stmt, 2, source.values[r]);
+				sqlite3_step(stmt);
+				sqlite3_reset(stmt);
+			}
+			sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+		}
+		sqlite3_finalize(stmt);
+	}
+
+public:
+	volatile int64_t checksum;
+
+	SqliteBench(const BenchSource &_source, bool _select, size_t _block) :
+		source(_source), select(_select), block(_block), nrows(0), db(NULL), checksum(0) {}
+
+	string name() const {
+		stringstream ss;
+		ss << "sqlite/" << (select ? "select_step" : "bind_step") << "/";
+		if (!select) {
+			ss << block << "/";
+		}
+		ss << source.name;
+		return ss.str();
+	}
+
+	void setup() {
+		nrows = min(source.values.size(), (size_t) opt_int("sqlite_rows", 1 << 18));
+		sqlite3_open(":memory:", &db);
+		if (select) {
+			load();
+		}
+	}
+
+	void run(int64_t &bytes, int64_t &items) {
+		if (select) {
+			sqlite3_stmt *stmt;
+			sqlite3_prepare_v2(db, "select time, v from t", -1, &stmt, NULL);
+			int64_t sum = 0;
+			while (SQLITE_ROW == sqlite3_step(stmt)) {
+				sum += sqlite3_column_int64(stmt, 0) + sqlite3_column_int(stmt, 1);
+			}
+			sqlite3_finalize(stmt);
+			checksum = sum;
+		} else {
+			load();
+		}
+		bytes += nrows * 2 * sizeof(int32_t);
+		items += nrows;
+	}
+
+	void teardown() {
+		sqlite3_close(db);
+		db = NULL;
+	}
+};
+
+/**
+ * @brief Add a source reading the first --values values of its files
+ */
+void add_bench_source(vector<BenchSource> &sources, const string &name, const vector<string> &files) {
+	size_t maxvals = opt_int("values", 1 << 20);
+	sources.push_back(BenchSource());
+	BenchSource &s = sources.back();
+	s.name = name;
+	s.files = files;
+	s.temporary = false;
+	for (unsigned f = 0; f < files.size() && s.values.size() < maxvals; ++f) {
+		MappedFile m(files[f].c_str());
+		const int32_t *v = (const int32_t*) m.data;
+		size_t n = min(m.size / sizeof(int32_t), maxvals - s.values.size());
+		s.values.insert(s.values.end(), v, v + n);
+	}
+}
+
+/**
+ * @returns the ts and vs streams of data as two sources
+ */
+vector<BenchSource> dataset_bench_sources(DataMulti &data) {
+	vector<string> ts;
+	vector<string> vs;
+	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
+		ts.push_back(data.get_name((*it).first, TS));
+		for (set<string>::const_iterator sit = (*it).second.begin(); sit != (*it).second.end(); ++sit) {
+			vs.push_back(data.get_name(*sit, VS));
+		}
+	}
+	vector<BenchSource> sources;
+	add_bench_source(sources, "ts", ts);
+	add_bench_source(sources, "vs", vs);
+	return sources;
+}
+
+/**
+ * @returns --values values each of synthetic timestamps (20s apart with
+ *  jitter), a gauge (random walk), a sparse counter (mostly zeros) and
+ *  uniform random values, written to files under --tmpdir
+ */
+vector<BenchSource> synthetic_bench_sources() {
+	size_t n = opt_int("values", 1 << 20);
+	string tmpdir = opt_str("tmpdir", "/tmp");
+	const char *names[] = {"timestamps", "gauge", "sparse", "random"};
+	vector<BenchSource> sources;
+	srand(1);
+	for (int k = 0; k < 4; ++k) {
+		vector<int32_t> vals(n);
+		int32_t gauge = 5000;
+		for (size_t i = 0; i < n; ++i) {
+			switch (k) {
+			case 0:
+				vals[i] = 1342181904 + 20 * i + (0 == rand() % 50 ? 1 : 0);
+				break;
+			case 1:
+				gauge += rand() % 21 - 10;
+				vals[i] = gauge;
+				break;
+			case 2:
+				vals[i] = 0 == rand() % 20 ? rand() % 1000 : 0;
+				break;
+			default:
+				vals[i] = rand();
+				break;
+			}
+		}
+		stringstream fname;
+		fname << tmpdir << "/bench-" << getpid() << "-" << names[k] << ".bin";
+		ofstream out(fname.str().c_str(), ios::out | ios::binary | ios::trunc);
+		out.write((const char*) &vals[0], n * sizeof(int32_t));
+		out.close();
+
+		sources.push_back(BenchSource());
+		BenchSource &s = sources.back();
+		s.name = names[k];
+		s.files.push_back(fname.str());
+		s.values.swap(vals);
+		s.temporary = true;
+	}
+	return sources;
+}
+
+string json_escape(const string &s) {
+	string out;
+	for (size_t i = 0; i < s.size(); ++i) {
+		if ('"' == s[i] || '\\' == s[i]) {
+			out += '\\';
+		}
+		out += s[i];
+	}
+	return out;
+}
+
+/**
+ * @brief Run every benchmark whose name contains --filter over every
+ *  source and --blocks size (bytes per read, values per codec block, rows
+ *  per sqlite transaction), for at least --min_time seconds each, and
+ *  write the results to out as JSON
+ */
+void print_microbench(vector<BenchSource> &sources, const string &description, ostream &out) {
+	vector<string> blockopts = opt_list("blocks", "4096,65536,1048576");
+	string filter = opt_str("filter", "");
+	double mintime = opt_double("min_time", 0.5);
+	vector<size_t> blocks;
+	for (unsigned i = 0; i < blockopts.size(); ++i) {
+		blocks.push_back(max(1L, atol(blockopts[i].c_str())));
+	}
+
+	vector<MicroBench*> benches;
+	for (unsigned s = 0; s < sources.size(); ++s) {
+		const BenchSource &src = sources[s];
+		for (unsigned b = 0; b < blocks.size(); ++b) {
+			for (int m = READ_IFSTREAM; m <= READ_PREAD; ++m) {
+				benches.push_back(new ReadBench(src, (BenchReadMethod) m, blocks[b]));
+			}
+			for (unsigned c = 0; c < codecs().size(); ++c) {
+				benches.push_back(new CodecBench(src, c, false, blocks[b]));
+				benches.push_back(new CodecBench(src, c, true, blocks[b]));
+			}
+			benches.push_back(new SqliteBench(src, false, blocks[b]));
+		}
+		for (int m = FORMAT_SPRINTF; m <= FORMAT_PAIRS; ++m) {
+			benches.push_back(new FormatBench(src, (BenchFormatMethod) m));
+		}
+		benches.push_back(new SqliteBench(src, true, 0));
+	}
+
+	time_t now = time(NULL);
+	char date[64];
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+	out << "{" << endl;
+	out << "  \"context\": {" << endl;
+	out << "    \"date\": \"" << date << "\"," << endl;
+	out << "    \"num_cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << "," << endl;
+	out << "    \"sqlite_version\": \"" << sqlite3_libversion() << "\"," << endl;
+	out << "    \"source\": \"" << json_escape(description) << "\"," << endl;
+	out << "    \"min_time\": " << mintime << endl;
+	out << "  }," << endl;
+	out << "  \"benchmarks\": [";
+	bool first = true;
+	for (unsigned i = 0; i < benches.size(); ++i) {
+		if (string::npos != benches[i]->name().find(filter)) {
+			MicroBenchResult r = run_microbench(*benches[i], mintime);
+			cerr << r.name << "\t" << r.real_ns << " ns\t" << r.bytes_per_second / 1e6 << " MB/s" << endl;
+			out << (first ? "" : ",") << endl;
+			out << "    {" << endl;
+			out << "      \"name\": \"" << json_escape(r.name) << "\"," << endl;
+			out << "      \"iterations\": " << r.iterations << "," << endl;
+			out << "      \"real_time\": " << r.real_ns << "," << endl;
+			out << "      \"cpu_time\": " << r.cpu_ns << "," << endl;
+			out << "      \"time_unit\": \"ns\"," << endl;
+			out << "      \"bytes_per_second\": " << r.bytes_per_second << "," << endl;
+			out << "      \"items_per_second\": " << r.items_per_second << endl;
+			out << "    }";
+			first = false;
+		}
+		delete benches[i];
+	}
+	out << endl << "  ]" << endl << "}" << endl;
+
+	for (unsigned s = 0; s < sources.size(); ++s) {
+		for (unsigned f = 0; sources[s].temporary && f < sources[s].files.size(); ++f) {
+			unlink(sources[s].files[f].c_str());
+		}
+	}
+}
+
+void test_microbench() {
+	options()["values"] = "4096";
+	options()["blocks"] = "1024";
+	options()["min_time"] = "0.001";
+	vector<BenchSource> sources = synthetic_bench_sources();
+	stringstream json;
+	print_microbench(sources, "synthetic", json);
+	options().erase("values");
+	options().erase("blocks");
+	options().erase("min_time");
+	//one object per benchmark: 3 reads, encode and decode per codec, 2
+	// sqlite and 4 formatting benchmarks, per source
+	size_t expected = sources.size() * (3 + 2 * codecs().size() + 2 + 4);
+	string text = json.str();
+	size_t found = 0;
+	for (size_t at = text.find("\"name\""); at != string::npos; at = text.find("\"name\"", at + 1)) {
+		++found;
+	}
+	cerr << found << " of " << expected << " benchmarks reported" << endl;
+}
+
+#endif /* MICROBENCH_HPP_ */
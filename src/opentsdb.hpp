@@ -1,16 +1,168 @@
 /*
  * opentsdb.hpp
- * OpenTSDB import utils.
+ * OpenTSDB import utils, and the InfluxDB and Prometheus import formats.
  *
  */
 
 #ifndef OPENTSDB_HPP_
 #define OPENTSDB_HPP_
 
+#include <algorithm>
+#include <cstdio>
+
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+
 #include "data.hpp"
+#include "parallel.hpp"
+#include "sink.hpp"
+#include "snappy.hpp"
 
 using namespace std;
 
+/**
+ * Drops the interior of zero runs, keeping each run's first and last
+ *  sample, which is lossless for readers that interpolate linearly.
+ *  Disabled (passes everything through) unless --sparse=1.
+ */
+class ZeroRunFilter {
+private:
+	bool enabled;
+	bool inrun;
+	bool pending;
+	int pendingts;
+
+public:
+	ZeroRunFilter() : enabled(opt_int("sparse", 0) != 0), inrun(false), pending(false), pendingts(0) {}
+
+	/**
+	 * @brief Offer a sample; up to two samples become ready to emit
+	 * @returns how many entries of outts/outvs to emit
+	 */
+	int push(int ts, int v, int outts[2], int outvs[2]) {
+		if (!enabled) {
+			outts[0] = ts;
+			outvs[0] = v;
+			return 1;
+		}
+		if (v == 0 && inrun) {
+			pending = true;
+			pendingts = ts;
+			return 0;
+		}
+		int nout = flush(outts, outvs);
+		inrun = (v == 0);
+		outts[nout] = ts;
+		outvs[nout] = v;
+		return nout + 1;
+	}
+
+	/**
+	 * @brief Release a held back run tail, if any
+	 * @returns 0 or 1 entries of outts/outvs to emit
+	 */
+	int flush(int outts[2], int outvs[2]) {
+		if (!pending) {
+			return 0;
+		}
+		pending = false;
+		outts[0] = pendingts;
+		outvs[0] = 0;
+		return 1;
+	}
+};
+
+/**
+ * Line formats for opentsdb puts: batch import, telnet "put" commands, or
+ *  /api/put JSON objects (each followed by a comma)
+ */
+enum TsdbFormat { TSDB_IMPORT, TSDB_TELNET, TSDB_JSON };
+
+/**
+ * One opentsdb series being written: drops samples that don't advance the
+ *  timestamp and formats the rest as batch import lines
+ */
+class OpenTsdbSeries {
+private:
+	string metric;
+	string tags;
+	TsdbFormat format;
+	int oldts;
+	ZeroRunFilter zeros;
+
+	void emit(int ts, int v, ostream &out) {
+		//opentsdb wire format:
+		//put http.hits 1234567890 34877
+		//put <metric> <timestamp> <value>
+		//batch import format has no "put"
+		char insertbuf[4096];
+		int len;
+		if (format == TSDB_JSON) {
+			len = snprintf(insertbuf, sizeof(insertbuf),
+					"{\"metric\":\"%s\",\"timestamp\":%d,\"value\":%d,\"tags\":{%s}},",
+					metric.c_str(), ts, v, tags.c_str());
+		} else {
+			len = snprintf(insertbuf, sizeof(insertbuf), "%s%s %d %d %s\n",
+					format == TSDB_TELNET ? "put " : "", metric.c_str(), ts, v, tags.c_str());
+		}
+		out.write(insertbuf, min(len, (int) sizeof(insertbuf) - 1));
+		++ninserts;
+	}
+
+public:
+	long ninserts;
+	long nolder;
+
+	/**
+	 * @param _tags space separated k=v pairs
+	 */
+	OpenTsdbSeries(const string &_metric, const string &_tags, TsdbFormat _format = TSDB_IMPORT) :
+		metric(_metric), tags(_tags), format(_format), oldts(0), ninserts(0), nolder(0) {
+		if (format == TSDB_JSON) {
+			//"k=v k2=v2" -> "k":"v","k2":"v2"
+			stringstream in(_tags);
+			string kv;
+			tags.clear();
+			while (in >> kv) {
+				size_t eq = kv.find('=');
+				tags += string(tags.empty() ? "" : ",") + "\"" + kv.substr(0, eq) + "\":\"" +
+						(eq == string::npos ? "" : kv.substr(eq + 1)) + "\"";
+			}
+		}
+	}
+
+	void push(int newts, int newvs, ostream &out) {
+		if (newts <= oldts) {
+			++nolder;
+			return;
+		}
+		int outts[2];
+		int outvs[2];
+		int nout = zeros.push(newts, newvs, outts, outvs);
+		for (int o = 0; o < nout; ++o) {
+			emit(outts[o], outvs[o], out);
+		}
+		oldts = newts;
+	}
+
+	/**
+	 * @brief Write anything held back and report out of order samples
+	 */
+	void finish(ostream &out, const string &name) {
+		int outts[2];
+		int outvs[2];
+		if (zeros.flush(outts, outvs)) {
+			emit(outts[0], outvs[0], out);
+		}
+		if (0 != nolder) {
+			cerr << "Got timestamps older than stream tail!" << endl;
+			cerr << "  count: " << nolder << endl;
+			cerr << "  in " << name << "" << endl;
+		}
+	}
+};
+
 /**
  * @brief Collect opentsdb metric names to the given output stream
  */
@@ -39,162 +191,592 @@ void print_opentsdb_metrics_multi(DataMulti data, ostream &fout) {
 }
 
 /**
- * @brief Write opentsdb stream to stdout
+ * @brief Write opentsdb stream to stdout for tagged metrics
  * the keys are simply increasing values for a metric name, prefixed by "m"
+ * Each group's timestamp stream is read once and shared by its value streams.
  */
-void print_opentsdb_inserts(Data data, int twidth, int vwidth) {
-	char tbuf[twidth];
-	char vbuf[vwidth];
+void print_opentsdb_inserts_multi(DataMulti data, int twidth, int vwidth) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "opentsdb multi only supports 4 byte samples" << endl;
+		return;
+	}
 
 	char metricname[1024];
-	char insertbuf[4096];
+	char tags[32];
 	int metricdx = 0;
+	size_t blockrows = group_block_rows();
 
-	for (set<string>::const_iterator it = data.begin(); it != data.end(); ++it) {
-		long ninserts = 0;
-		long nolder = 0;
-
+	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
 		++metricdx;
 		sprintf(metricname, "m%d", metricdx);
 
-		timeit(true);
+		GroupReader *reader = open_group(data, it);
+		GroupReader &group = *reader;
+		if (!group.ok()) {
+			cerr << "could not find timestamp file " << group.tsname << endl;
+			delete reader;
+			break;
+		}
 
-		//assume existence of both ts and vs. amd that they're the same length
-		string tsname = data.get_name(*it, TS);
-		string vsname = data.get_name(*it, VS);
-		ifstream ts(tsname.c_str(), ios::binary | ios::in);
-		ifstream vs(vsname.c_str(), ios::binary | ios::in);
-		cerr << "inserting " << *it << endl;
+		for (unsigned col = 0; col < group.columns.size(); ++col) {
+			cerr << "inserting " << group.columns[col] << endl;
 
-		if (!ts.good()) {
-			cerr << "could not find timestamp file " << tsname << endl;
-			break;
+			timeit(true);
+
+			sprintf(tags, "t=%d", col + 1);
+			OpenTsdbSeries series(metricname, tags);
+			GroupBlock blk;
+			group.rewind();
+			while (group.next(blk, blockrows)) {
+				const int32_t *vals = blk.vals[col];
+				for (size_t r = 0; r < blk.nrows; ++r) {
+					series.push(blk.ts[r], vals[r], cout);
+				}
+			}
+			series.finish(cout, group.columns[col]);
+
+			timeit(false, series.ninserts);
 		}
-		if (!vs.good()) {
-			cerr << "could not find value file " << vsname << endl;
+
+		if (0 != group.n_vstream_failures) {
+			cerr << "values were not the same length as timestamps! count="
+					<< group.n_vstream_failures << endl;
 		}
+		delete reader;
+	}
+}
+
+/**
+ * One output file of a sharded opentsdb import, plain or gzip compressed
+ */
+class TsdbShardFile {
+private:
+	FILE *plain;
+#ifdef HAS_ZLIB
+	gzFile gz;
+#endif
+
+	TsdbShardFile(const TsdbShardFile&);
+	TsdbShardFile& operator=(const TsdbShardFile&);
+
+public:
+	TsdbShardFile(const string &name, bool gzip) : plain(NULL) {
+#ifdef HAS_ZLIB
+		gz = NULL;
+		if (gzip) {
+			gz = gzopen(name.c_str(), "wb6");
+			return;
+		}
+#endif
+		plain = fopen(name.c_str(), "wb");
+	}
+
+	~TsdbShardFile() {
+		if (plain) {
+			fclose(plain);
+		}
+#ifdef HAS_ZLIB
+		if (gz) {
+			gzclose(gz);
+		}
+#endif
+	}
+
+	bool ok() const {
+#ifdef HAS_ZLIB
+		if (gz) {
+			return true;
+		}
+#endif
+		return plain != NULL;
+	}
 
-		int oldts = 0;
-		while (ts.good()) {
-			if (!vs.good()) {
-				cerr << "values were not the same length as timestamps!" << endl;
-				break;
+	void write(const string &s) {
+		if (s.empty()) {
+			return;
+		}
+#ifdef HAS_ZLIB
+		if (gz) {
+			gzwrite(gz, s.data(), s.size());
+			return;
+		}
+#endif
+		fwrite(s.data(), 1, s.size(), plain);
+	}
+};
+
+/**
+ * Writes the groups of one shard, in metric name order. Rows are written
+ *  across a group's series, so each group's lines are sorted by timestamp
+ *  as well (the bulk importer's preferred order).
+ */
+struct TsdbShardWriter {
+	DataMulti *data;
+	//indexed by metric number - 1
+	vector<map<string, set<string> >::const_iterator> groups;
+	vector<vector<size_t> > shards;
+	vector<string> filenames;
+	bool gzip;
+	size_t blockrows;
+	vector<long> ninserts;
+
+	void operator()(size_t s) {
+		TsdbShardFile out(filenames[s], gzip);
+		if (!out.ok()) {
+			cerr << "could not open " << filenames[s] << endl;
+			return;
+		}
+		char metricname[32];
+		char tags[32];
+		stringstream buf;
+		for (unsigned i = 0; i < shards[s].size(); ++i) {
+			size_t g = shards[s][i];
+			GroupReader *reader = open_group(*data, groups[g]);
+			GroupReader &group = *reader;
+			if (!group.ok()) {
+				cerr << "could not find timestamp file " << group.tsname << endl;
+				delete reader;
+				continue;
 			}
-			ts.read(tbuf, twidth);
-			vs.read(vbuf, vwidth);
-			int newts = *((int*) tbuf);
-			int newvs = *((int*) vbuf);
-			if (newts <= oldts) {
-				++nolder;
-			} else {
-				//opentsdb wire format:
-				//put http.hits 1234567890 34877
-				//put <metric> <timestamp> <value>
-				//batch import format has no "put"
-				sprintf(insertbuf, "%s %d %d t=v",
-						metricname,
-						newts,
-						newvs);
-				cout << insertbuf << endl;
-
-				++ninserts;
-				oldts = newts;
+
+			sprintf(metricname, "m%d", (int) g + 1);
+			vector<OpenTsdbSeries*> series;
+			for (unsigned col = 0; col < group.columns.size(); ++col) {
+				sprintf(tags, "t=%d", col + 1);
+				series.push_back(new OpenTsdbSeries(metricname, tags));
+			}
+			GroupBlock blk;
+			while (group.next(blk, blockrows)) {
+				for (size_t r = 0; r < blk.nrows; ++r) {
+					for (unsigned col = 0; col < series.size(); ++col) {
+						series[col]->push(blk.ts[r], blk.vals[col][r], buf);
+					}
+				}
+				out.write(buf.str());
+				buf.str("");
+			}
+			for (unsigned col = 0; col < series.size(); ++col) {
+				series[col]->finish(buf, group.columns[col]);
+				ninserts[s] += series[col]->ninserts;
+				delete series[col];
+			}
+			out.write(buf.str());
+			buf.str("");
+
+			if (0 != group.n_vstream_failures) {
+				cerr << "values were not the same length as timestamps! count="
+						<< group.n_vstream_failures << endl;
 			}
+			delete reader;
 		}
+	}
+};
 
-		if (0 != nolder) {
-			cerr << "Got timestamps older than stream tail!" << endl;
-			cerr << "  count: " << nolder << endl;
-			cerr << "  in " << *it << "" << endl;
+/**
+ * @brief Write the inserts of print_opentsdb_inserts_multi to several files
+ *  at once, for parallel runs of the bulk importer. --shard_by=metric writes
+ *  output-m<N>.tsdb per metric; --shard_by=hash (default) writes --shards
+ *  files (default: threads) output-<K>.tsdb, metrics assigned by name hash.
+ *  --gzip=1 writes .tsdb.gz instead (needs zlib at build time).
+ */
+void print_opentsdb_inserts_sharded(DataMulti data, int twidth, int vwidth, const string &output) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "opentsdb multi only supports 4 byte samples" << endl;
+		return;
+	}
+
+	TsdbShardWriter writer;
+	writer.data = &data;
+	writer.gzip = opt_int("gzip", 0) != 0;
+	writer.blockrows = group_block_rows();
+#ifndef HAS_ZLIB
+	if (writer.gzip) {
+		cerr << "built without zlib, writing uncompressed shards" << endl;
+		writer.gzip = false;
+	}
+#endif
+	const char *ext = writer.gzip ? ".tsdb.gz" : ".tsdb";
+
+	vector<string> metrics;
+	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
+		writer.groups.push_back(it);
+		stringstream m;
+		m << "m" << writer.groups.size();
+		metrics.push_back(m.str());
+	}
+
+	unsigned nthreads = default_threads();
+	if (opt_str("shard_by", "hash") == "metric") {
+		for (size_t g = 0; g < metrics.size(); ++g) {
+			writer.shards.push_back(vector<size_t>(1, g));
+			writer.filenames.push_back(output + "-" + metrics[g] + ext);
 		}
+	} else {
+		size_t nshards = max(1L, opt_int("shards", nthreads));
+		writer.shards.resize(nshards);
+		vector<pair<string, size_t> > byname;
+		for (size_t g = 0; g < metrics.size(); ++g) {
+			byname.push_back(make_pair(metrics[g], g));
+		}
+		sort(byname.begin(), byname.end());
+		for (size_t i = 0; i < byname.size(); ++i) {
+			writer.shards[shard_hash(byname[i].first) % nshards].push_back(byname[i].second);
+		}
+		for (size_t k = 0; k < nshards; ++k) {
+			stringstream name;
+			name << output << "-" << k << ext;
+			writer.filenames.push_back(name.str());
+		}
+	}
+	writer.ninserts.assign(writer.shards.size(), 0);
 
-		timeit(false, ninserts);
+	double start = wall_seconds();
+	parallel_for(writer.shards.size(), writer, nthreads);
+	double secs = wall_seconds() - start;
 
-		ts.close();
-		vs.close();
+	long total = 0;
+	for (size_t k = 0; k < writer.ninserts.size(); ++k) {
+		total += writer.ninserts[k];
 	}
+	cerr << total << " inserts to " << writer.shards.size() << " shards in " << secs << "s ("
+			<< (secs > 0 ? total / secs : 0) << "/s)" << endl;
 }
 
 /**
- * @brief Write opentsdb stream to stdout for tagged metrics
- * the keys are simply increasing values for a metric name, prefixed by "m"
+ * Writes the series print_opentsdb_inserts would for Data(DataMulti) (one
+ *  "m<index>" metric per value stream, indexed in stream name order) to
+ *  one file, block by block: each series stays in time order, but the
+ *  series of a group are interleaved at block granularity.
  */
-void print_opentsdb_inserts_multi(DataMulti data, int twidth, int vwidth) {
-	char tbuf[twidth];
-	char vbuf[vwidth];
+class OpenTsdbSink : public GroupSink {
+private:
+	ofstream out;
+	map<string, int> metricdx;
+	vector<OpenTsdbSeries*> series;
+	vector<string> columns;
+
+	void clear() {
+		for (unsigned i = 0; i < series.size(); ++i) {
+			delete series[i];
+		}
+		series.clear();
+	}
 
-	char metricname[1024];
-	char insertbuf[4096];
-	int metricdx = 0;
+public:
+	/**
+	 * @param names every value stream that will be written
+	 * @param output inserts file; metric names go to output.metrics
+	 */
+	OpenTsdbSink(const set<string> &names, const string &output) :
+		out(output.c_str(), ios::binary | ios::out | ios::trunc) {
+		ofstream metout((output + ".metrics").c_str(), ios::out);
+		int dx = 0;
+		for (set<string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+			metricdx[*it] = ++dx;
+			metout << "m" << dx << " ";
+		}
+		metout << endl;
+	}
 
-	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
-		++metricdx;
-		sprintf(metricname, "m%d", metricdx);
+	~OpenTsdbSink() {
+		clear();
+	}
 
-		int tagid = 0;
+	const char* name() const {
+		return "opentsdb";
+	}
 
-		string tsname = data.get_name((*it).first, TS);
+	void begin_group(int groupdx, const string &key, const GroupReader &group) {
+		clear();
+		columns = group.columns;
+		char metricname[32];
+		for (unsigned col = 0; col < columns.size(); ++col) {
+			sprintf(metricname, "m%d", metricdx[columns[col]]);
+			series.push_back(new OpenTsdbSeries(metricname, "t=v"));
+		}
+	}
 
-		for (set<string>::const_iterator sit = (*it).second.begin(); sit != (*it).second.end(); ++sit) {
-			long ninserts = 0;
-			long nolder = 0;
+	void write_block(const GroupBlock &blk) {
+		for (unsigned col = 0; col < series.size(); ++col) {
+			const int32_t *vals = blk.vals[col];
+			for (size_t r = 0; r < blk.nrows; ++r) {
+				series[col]->push(blk.ts[r], vals[r], out);
+			}
+		}
+	}
 
-			++tagid;
+	void end_group() {
+		for (unsigned col = 0; col < series.size(); ++col) {
+			series[col]->finish(out, columns[col]);
+		}
+		clear();
+	}
+};
 
-			string vsname = data.get_name(*sit, VS);
-			ifstream ts(tsname.c_str(), ios::binary | ios::in);
-			ifstream vs(vsname.c_str(), ios::binary | ios::in);
-			cerr << "inserting " << *sit << endl;
+/**
+ * Writes every group row as one InfluxDB line protocol point,
+ *  "m<group> <column>=<value>i,... <ts>", timestamps in seconds (import
+ *  with precision=s). Lines of a block are formatted into one buffer.
+ */
+class InfluxSink : public GroupSink {
+private:
+	ofstream out;
+	string measurement;
+	//"<column>=" per value column
+	vector<string> keys;
+	string lines;
+
+public:
+	InfluxSink(const string &output) : out(output.c_str(), ios::binary | ios::out | ios::trunc) {}
+
+	const char* name() const {
+		return "influx";
+	}
 
-			if (!ts.good()) {
-				cerr << "could not find timestamp file " << tsname << endl;
-				break;
-			}
-			if (!vs.good()) {
-				cerr << "could not find value file " << vsname << endl;
+	void begin_group(int groupdx, const string &key, const GroupReader &group) {
+		stringstream m;
+		m << "m" << groupdx << " ";
+		measurement = m.str();
+		keys.clear();
+		for (unsigned i = 0; i < group.columns.size(); ++i) {
+			keys.push_back(group.columns[i] + "=");
+		}
+	}
+
+	void write_block(const GroupBlock &blk) {
+		char num[16];
+		lines.clear();
+		for (size_t r = 0; r < blk.nrows; ++r) {
+			lines += measurement;
+			for (unsigned i = 0; i < blk.vals.size(); ++i) {
+				if (i) {
+					lines += ',';
+				}
+				lines += keys[i];
+				sprintf(num, "%di", blk.vals[i][r]);
+				lines += num;
 			}
+			sprintf(num, " %d\n", blk.ts[r]);
+			lines += num;
+		}
+		out.write(lines.data(), lines.size());
+	}
 
-			timeit(true);
+	void end_group() {
+		out.flush();
+	}
+};
 
-			int oldts = 0;
-			while (ts.good()) {
-				if (!vs.good()) {
-					cerr << "values were not the same length as timestamps!" << endl;
-					break;
-				}
-				ts.read(tbuf, twidth);
-				vs.read(vbuf, vwidth);
-				int newts = *((int*) tbuf);
-				int newvs = *((int*) vbuf);
-				if (newts <= oldts) {
-					++nolder;
-				} else {
-					//opentsdb wire format:
-					//put http.hits 1234567890 34877
-					//put <metric> <timestamp> <value>
-					//batch import format has no "put"
-					sprintf(insertbuf, "%s %d %d t=%d",
-							metricname,
-							newts,
-							newvs,
-							tagid);
-					cout << insertbuf << endl;
-
-					++ninserts;
-					oldts = newts;
+void pb_varint(vector<uint8_t> &out, uint64_t v) {
+	while (v >= 0x80) {
+		out.push_back((uint8_t) (v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t) v);
+}
+
+/**
+ * @brief Append a length delimited protobuf field
+ */
+void pb_bytes(vector<uint8_t> &out, int field, const uint8_t *p, size_t len) {
+	pb_varint(out, (field << 3) | 2);
+	pb_varint(out, len);
+	out.insert(out.end(), p, p + len);
+}
+
+void pb_label(vector<uint8_t> &out, const string &name, const string &value) {
+	vector<uint8_t> label;
+	pb_bytes(label, 1, (const uint8_t*) name.data(), name.size());
+	pb_bytes(label, 2, (const uint8_t*) value.data(), value.size());
+	pb_bytes(out, 1, &label[0], label.size());
+}
+
+/**
+ * Writes Prometheus remote write batches: every --rows block of a group
+ *  becomes one snappy compressed WriteRequest holding a series per value
+ *  column (labels __name__=<column>, group=<group key>; millisecond
+ *  timestamps), stored as a u32 length then the compressed bytes.
+ */
+class PromWriteSink : public GroupSink {
+private:
+	ofstream out;
+	string groupkey;
+	vector<string> columns;
+	vector<uint8_t> request;
+	vector<uint8_t> series;
+	vector<uint8_t> packed;
+
+public:
+	uint64_t rawbytes;
+	uint64_t totalbytes;
+
+	PromWriteSink(const string &output) : out(output.c_str(), ios::binary | ios::out | ios::trunc),
+		rawbytes(0), totalbytes(0) {}
+
+	const char* name() const {
+		return "promwrite";
+	}
+
+	void begin_group(int groupdx, const string &key, const GroupReader &group) {
+		groupkey = key;
+		columns = group.columns;
+	}
+
+	void write_block(const GroupBlock &blk) {
+		request.clear();
+		for (unsigned i = 0; i < blk.vals.size(); ++i) {
+			series.clear();
+			//labels sorted by name
+			pb_label(series, "__name__", columns[i]);
+			pb_label(series, "group", groupkey);
+			for (size_t r = 0; r < blk.nrows; ++r) {
+				//Sample: double value = 1, int64 timestamp = 2
+				uint8_t sample[24];
+				uint8_t *p = sample;
+				double v = blk.vals[i][r];
+				*p++ = 0x09;
+				memcpy(p, &v, 8);
+				p += 8;
+				*p++ = 0x10;
+				uint64_t ms = (uint64_t) ((int64_t) blk.ts[r] * 1000);
+				while (ms >= 0x80) {
+					*p++ = (uint8_t) (ms | 0x80);
+					ms >>= 7;
 				}
+				*p++ = (uint8_t) ms;
+				pb_bytes(series, 2, sample, p - sample);
 			}
+			pb_bytes(request, 1, &series[0], series.size());
+		}
 
-			if (0 != nolder) {
-				cerr << "Got timestamps older than stream tail!" << endl;
-				cerr << "  count: " << nolder << endl;
-				cerr << "  in " << *sit << "" << endl;
-			}
+		packed.clear();
+		snappy_compress(request.empty() ? NULL : &request[0], request.size(), packed);
+		write_pod(out, (uint32_t) packed.size());
+		out.write((const char*) &packed[0], packed.size());
+		rawbytes += request.size();
+		totalbytes += packed.size() + 4;
+	}
 
-			timeit(false, ninserts);
+	void end_group() {
+		out.flush();
+	}
+
+	void finish() {
+		cerr << "remote write bytes " << totalbytes << " (" << rawbytes << " before snappy)" << endl;
+	}
+};
+
+/**
+ * @returns every value stream name of data; opentsdb metric m<N> is the
+ *  N-th of them
+ */
+set<string> opentsdb_stream_names(DataMulti &data) {
+	set<string> names;
+	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
+		names.insert((*it).second.begin(), (*it).second.end());
+	}
+	return names;
+}
 
+/**
+ * @brief Write to out one series per value stream, metric m<N> for the
+ *  N-th stream by name and tag t=v, in stream name order with each series
+ *  whole. Streams are read through their group's GroupReader, so that
+ *  --lateness, --dedup and --reorder_rows apply; a group is opened once
+ *  and rewound for each of its streams.
+ */
+void print_opentsdb_inserts_grouped(DataMulti data, int twidth, int vwidth, ostream &out) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "opentsdb multi only supports 4 byte samples" << endl;
+		return;
+	}
+
+	map<string, map<string, set<string> >::const_iterator> groupof;
+	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
+		for (set<string>::const_iterator sit = (*it).second.begin(); sit != (*it).second.end(); ++sit) {
+			groupof[*sit] = it;
+		}
+	}
+
+	char metricname[32];
+	int metricdx = 0;
+	size_t blockrows = group_block_rows();
+	GroupReader *group = NULL;
+	map<string, set<string> >::const_iterator opened = data.end();
+
+	for (map<string, map<string, set<string> >::const_iterator>::const_iterator it = groupof.begin();
+			it != groupof.end(); ++it) {
+		++metricdx;
+		sprintf(metricname, "m%d", metricdx);
+
+		timeit(true);
+
+		if (NULL == group || opened != it->second) {
+			delete group;
+			group = open_group(data, it->second);
+			opened = it->second;
+		} else {
+			group->rewind();
 		}
+		cerr << "inserting " << it->first << endl;
+
+		if (!group->ok()) {
+			cerr << "could not find timestamp file " << group->tsname << endl;
+			timeit(false);
+			break;
+		}
+
+		unsigned col = find(group->columns.begin(), group->columns.end(), it->first) - group->columns.begin();
+		OpenTsdbSeries series(metricname, "t=v");
+		GroupBlock blk;
+		while (group->next(blk, blockrows)) {
+			const int32_t *vals = blk.vals[col];
+			for (size_t r = 0; r < blk.nrows; ++r) {
+				series.push(blk.ts[r], vals[r], out);
+			}
+		}
+		series.finish(out, it->first);
+
+		timeit(false, series.ninserts);
+	}
+
+	delete group;
+}
+
+/**
+ * @brief Write opentsdb stream to stdout
+ * the keys are simply increasing values for a metric name, prefixed by "m"
+ */
+void print_opentsdb_inserts(Data data, int twidth, int vwidth) {
+	print_opentsdb_inserts_grouped(data.as_multi(), twidth, vwidth, cout);
+}
+
+/**
+ * @brief Write data as InfluxDB line protocol to output
+ */
+void insert_influx_multi(DataMulti data, int twidth, int vwidth, const char *output) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "influx only supports 4 byte samples" << endl;
+		return;
+	}
+
+	InfluxSink influx(output);
+	vector<GroupSink*> sinks(1, &influx);
+	run_sinks(data, sinks);
+}
+
+/**
+ * @brief Write data as Prometheus remote write batches to output
+ */
+void insert_promwrite_multi(DataMulti data, int twidth, int vwidth, const char *output) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "remote write only supports 4 byte samples" << endl;
+		return;
 	}
+
+	PromWriteSink prom(output);
+	vector<GroupSink*> sinks(1, &prom);
+	run_sinks(data, sinks);
 }
 
 void test_opentsdb() {
@@ -211,4 +793,39 @@ void test_opentsdb_multi() {
 	print_opentsdb_inserts_multi(data, 4, 4);
 }
 
+void test_opentsdb_sharded() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	options()["shards"] = "3";
+	print_opentsdb_inserts_sharded(data, 4, 4, "out-tsdb");
+	options()["shard_by"] = "metric";
+	options()["gzip"] = "1";
+	print_opentsdb_inserts_sharded(data, 4, 4, "out-tsdb");
+	options().erase("shards");
+	options().erase("shard_by");
+	options().erase("gzip");
+}
+
+void test_promwrite_multi() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	insert_influx_multi(data, 4, 4, "out.influx");
+	insert_promwrite_multi(data, 4, 4, "out.prw");
+
+	//every batch must decompress to what was compressed
+	MappedFile f("out.prw");
+	const uint8_t *p = (const uint8_t*) f.data;
+	const uint8_t *end = p + f.size;
+	vector<uint8_t> raw;
+	long nbatches = 0;
+	bool ok = f.ok;
+	while (ok && p + 4 <= end) {
+		uint32_t len = get_u32(p);
+		ok = p + len <= end && snappy_decompress(p, len, raw);
+		p += len;
+		++nbatches;
+	}
+	cerr << "remote write batches " << nbatches << (ok && p == end ? " ok" : " CORRUPT") << endl;
+}
+
 #endif /* OPENTSDB_HPP_ */
@@ -0,0 +1,77 @@
+/*
+ * options.hpp
+ * --key=value command line options shared by all subcommands
+ */
+
+#ifndef OPTIONS_HPP_
+#define OPTIONS_HPP_
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+map<string, string>& options() {
+	static map<string, string> opts;
+	return opts;
+}
+
+/**
+ * @brief Pull --key=value arguments out of argv so positional arguments
+ *  keep their indices regardless of where options were given.
+ * @returns the new argc
+ */
+int parse_options(int argc, char** argv) {
+	int outdx = 1;
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		const char* eq = strchr(arg, '=');
+		if (arg[0] == '-' && arg[1] == '-' && eq != NULL) {
+			options()[string(arg + 2, eq)] = string(eq + 1);
+		} else {
+			argv[outdx++] = argv[i];
+		}
+	}
+	argv[outdx] = NULL;
+	return outdx;
+}
+
+bool has_opt(const char* key) {
+	return options().find(key) != options().end();
+}
+
+string opt_str(const char* key, const char* def) {
+	map<string, string>::const_iterator it = options().find(key);
+	return (it == options().end()) ? string(def) : it->second;
+}
+
+long opt_int(const char* key, long def) {
+	map<string, string>::const_iterator it = options().find(key);
+	return (it == options().end()) ? def : strtol(it->second.c_str(), NULL, 10);
+}
+
+/**
+ * @returns the comma separated items of --key, or of def if not given
+ */
+vector<string> opt_list(const char* key, const char* def) {
+	vector<string> items;
+	string item;
+	stringstream in(opt_str(key, def));
+	while (getline(in, item, ',')) {
+		if (!item.empty()) {
+			items.push_back(item);
+		}
+	}
+	return items;
+}
+
+double opt_double(const char* key, double def) {
+	map<string, string>::const_iterator it = options().find(key);
+	return (it == options().end()) ? def : strtod(it->second.c_str(), NULL);
+}
+
+#endif /* OPTIONS_HPP_ */
@@ -0,0 +1,85 @@
+/*
+ * parallel.hpp
+ * Minimal pthread work sharing
+ */
+
+#ifndef PARALLEL_HPP_
+#define PARALLEL_HPP_
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "options.hpp"
+
+using namespace std;
+
+/**
+ * @returns monotonic wall clock seconds, for rate measurements
+ */
+double wall_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @returns worker count: --threads if given, otherwise online cpus
+ */
+unsigned default_threads() {
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	long n = opt_int("threads", ncpu > 0 ? ncpu : 1);
+	return n > 0 ? (unsigned) n : 1;
+}
+
+template <class F>
+struct ParallelFor {
+	F *fn;
+	size_t n;
+	volatile size_t next;
+};
+
+template <class F>
+void* parallel_for_worker(void *arg) {
+	ParallelFor<F> *pf = (ParallelFor<F>*) arg;
+	size_t i;
+	while ((i = __sync_fetch_and_add(&pf->next, 1)) < pf->n) {
+		(*pf->fn)(i);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Call fn(i) for i in [0, n), handing indices out to nthreads workers.
+ *  Runs inline if there is only one thread or one item.
+ */
+template <class F>
+void parallel_for(size_t n, F &fn, unsigned nthreads) {
+	if (nthreads > n) {
+		nthreads = n;
+	}
+	if (nthreads <= 1) {
+		for (size_t i = 0; i < n; ++i) {
+			fn(i);
+		}
+		return;
+	}
+
+	ParallelFor<F> pf;
+	pf.fn = &fn;
+	pf.n = n;
+	pf.next = 0;
+
+	vector<pthread_t> threads(nthreads - 1);
+	for (unsigned t = 0; t < threads.size(); ++t) {
+		pthread_create(&threads[t], NULL, parallel_for_worker<F>, &pf);
+	}
+	//the calling thread works too
+	parallel_for_worker<F>(&pf);
+	for (unsigned t = 0; t < threads.size(); ++t) {
+		pthread_join(threads[t], NULL);
+	}
+}
+
+#endif /* PARALLEL_HPP_ */
@@ -0,0 +1,466 @@
+/*
+ * parquet.hpp
+ * Parquet backend: each merge group as a file of uncompressed row groups.
+ *  Timestamps are DELTA_BINARY_PACKED; value columns are dictionary
+ *  encoded (RLE/bit-packed hybrid codes) when that is smaller, PLAIN
+ *  otherwise. Every page carries min/max statistics.
+ */
+
+#ifndef PARQUET_HPP_
+#define PARQUET_HPP_
+
+#include <stdint.h>
+
+#include "bits.hpp"
+#include "data.hpp"
+#include "dict.hpp"
+#include "parallel.hpp"
+#include "sink.hpp"
+#include "stats.hpp"
+#include "thrift.hpp"
+
+using namespace std;
+
+const char PARQUET_MAGIC[4] = {'P', 'A', 'R', '1'};
+
+//parquet.thrift constants
+const int PQ_TYPE_INT32 = 1;
+const int PQ_REQUIRED = 0;
+const int PQ_CODEC_UNCOMPRESSED = 0;
+const int PQ_PAGE_DATA = 0;
+const int PQ_PAGE_DICTIONARY = 2;
+const int PQ_ENC_PLAIN = 0;
+const int PQ_ENC_PLAIN_DICTIONARY = 2;
+const int PQ_ENC_RLE = 3;
+const int PQ_ENC_DELTA_BINARY_PACKED = 5;
+const int PQ_ENC_RLE_DICTIONARY = 8;
+
+//DELTA_BINARY_PACKED layout
+const size_t PQ_DELTA_BLOCK = 128;
+const size_t PQ_DELTA_MINIBLOCKS = 4;
+
+/**
+ * One encoded column chunk; offsets are relative to the start of bytes
+ *  until the row group is placed in the file
+ */
+struct ParquetChunk {
+	vector<uint8_t> bytes;
+	int64_t dict_offset;
+	int64_t data_offset;
+	int64_t nvalues;
+	//bytes of all pages
+	int64_t size;
+	int32_t min;
+	int32_t max;
+	vector<int> encodings;
+};
+
+struct ParquetRowGroup {
+	size_t nrows;
+	vector<ParquetChunk> cols;
+};
+
+string pq_plain(int32_t v) {
+	return string((const char*) &v, 4);
+}
+
+void pq_statistics(ThriftWriter &t, int id, int32_t min, int32_t max) {
+	t.begin_struct(id);
+	//deprecated max/min too, for readers predating column orders
+	t.binary(1, pq_plain(max));
+	t.binary(2, pq_plain(min));
+	t.i64(3, 0);
+	t.binary(5, pq_plain(max));
+	t.binary(6, pq_plain(min));
+	t.end_struct();
+}
+
+/**
+ * @brief DELTA_BINARY_PACKED: header, then per block of 128 deltas the
+ *  minimum delta and four 32 value miniblocks packed at their own width.
+ *  Deltas wrap in 32 bits, as the format allows.
+ */
+void pq_delta_encode(const int32_t *in, size_t n, vector<uint8_t> &out) {
+	ThriftWriter t(out);
+	t.varint(PQ_DELTA_BLOCK);
+	t.varint(PQ_DELTA_MINIBLOCKS);
+	t.varint(n);
+	t.zigzag(n ? in[0] : 0);
+
+	const size_t mbsize = PQ_DELTA_BLOCK / PQ_DELTA_MINIBLOCKS;
+	uint32_t deltas[PQ_DELTA_BLOCK];
+	for (size_t start = 1; start < n; start += PQ_DELTA_BLOCK) {
+		size_t cnt = min(PQ_DELTA_BLOCK, n - start);
+		int32_t mindelta = 0;
+		for (size_t i = 0; i < cnt; ++i) {
+			int32_t d = (int32_t) ((uint32_t) in[start + i] - (uint32_t) in[start + i - 1]);
+			deltas[i] = (uint32_t) d;
+			mindelta = (i == 0 || d < mindelta) ? d : mindelta;
+		}
+		for (size_t i = 0; i < cnt; ++i) {
+			deltas[i] -= (uint32_t) mindelta;
+		}
+		memset(deltas + cnt, 0, (PQ_DELTA_BLOCK - cnt) * sizeof(uint32_t));
+
+		t.zigzag(mindelta);
+		size_t nmb = (cnt + mbsize - 1) / mbsize;
+		int widths[PQ_DELTA_MINIBLOCKS];
+		for (size_t m = 0; m < PQ_DELTA_MINIBLOCKS; ++m) {
+			uint32_t maxv = 0;
+			for (size_t i = m * mbsize; m < nmb && i < (m + 1) * mbsize; ++i) {
+				maxv = max(maxv, deltas[i]);
+			}
+			widths[m] = bit_width(maxv);
+			out.push_back((uint8_t) widths[m]);
+		}
+		//unused trailing miniblocks have a width but no body
+		for (size_t m = 0; m < nmb; ++m) {
+			pack_bits(deltas + m * mbsize, mbsize, widths[m], out);
+		}
+	}
+}
+
+/**
+ * @brief RLE/bit-packed hybrid: groups of 8 equal codes extend RLE runs,
+ *  anything else goes into bit-packed runs (the last padded with zeros)
+ */
+void pq_rle_hybrid(const uint32_t *codes, size_t n, int width, vector<uint8_t> &out) {
+	ThriftWriter t(out);
+	int valbytes = (width + 7) / 8;
+	size_t i = 0;
+	while (i < n) {
+		size_t run = 1;
+		while (i + run < n && codes[i + run] == codes[i]) {
+			++run;
+		}
+		if (run >= 8 || i + run == n) {
+			t.varint((uint64_t) run << 1);
+			for (int b = 0; b < valbytes; ++b) {
+				out.push_back((uint8_t) (codes[i] >> (8 * b)));
+			}
+			i += run;
+			continue;
+		}
+
+		//literal groups of 8 until a group starts a long enough run
+		size_t end = i;
+		while (end < n) {
+			size_t r = 1;
+			while (end + r < n && codes[end + r] == codes[end]) {
+				++r;
+			}
+			if (r >= 8) {
+				break;
+			}
+			end = min(n, end + 8);
+		}
+		size_t ngroups = (end - i + 7) / 8;
+		t.varint(((uint64_t) ngroups << 1) | 1);
+		BitWriter bw(out);
+		for (size_t k = 0; k < ngroups * 8; ++k) {
+			bw.put(i + k < end ? codes[i + k] : 0, width);
+		}
+		bw.flush();
+		i = end;
+	}
+}
+
+/**
+ * @brief Append a page (thrift PageHeader then body) to the chunk
+ */
+void pq_page(ParquetChunk &c, int type, const vector<uint8_t> &body, size_t nvalues,
+		int encoding, int32_t min, int32_t max) {
+	vector<uint8_t> header;
+	ThriftWriter t(header);
+	t.i32(1, type);
+	t.i32(2, body.size());
+	t.i32(3, body.size());
+	if (type == PQ_PAGE_DICTIONARY) {
+		t.begin_struct(7);
+		t.i32(1, nvalues);
+		t.i32(2, encoding);
+		t.end_struct();
+	} else {
+		t.begin_struct(5);
+		t.i32(1, nvalues);
+		t.i32(2, encoding);
+		t.i32(3, PQ_ENC_RLE);
+		t.i32(4, PQ_ENC_RLE);
+		pq_statistics(t, 5, min, max);
+		t.end_struct();
+	}
+	t.finish();
+
+	c.bytes.insert(c.bytes.end(), header.begin(), header.end());
+	c.bytes.insert(c.bytes.end(), body.begin(), body.end());
+}
+
+/**
+ * @brief Encode n values as one column chunk of pages of up to pagerows
+ * @param delta DELTA_BINARY_PACKED instead of dictionary/PLAIN
+ */
+void pq_encode_chunk(const int32_t *vals, size_t n, bool delta, size_t pagerows, ParquetChunk &c) {
+	c.bytes.clear();
+	c.encodings.clear();
+	c.nvalues = n;
+	c.dict_offset = -1;
+	c.min = n ? *min_element(vals, vals + n) : 0;
+	c.max = n ? *max_element(vals, vals + n) : 0;
+
+	//dictionary codes, kept only if they beat PLAIN
+	DictHash hash;
+	vector<uint32_t> codes;
+	int width = 0;
+	if (!delta) {
+		codes.resize(n);
+		for (size_t i = 0; i < n; ++i) {
+			codes[i] = hash.insert(vals[i]);
+		}
+		size_t ndict = hash.values().size();
+		width = dict_code_width(ndict);
+		if (ndict * 4 + n * width / 8 >= n * 4) {
+			codes.clear();
+		}
+	}
+
+	int encoding;
+	vector<uint8_t> body;
+	if (delta) {
+		encoding = PQ_ENC_DELTA_BINARY_PACKED;
+	} else if (!codes.empty()) {
+		encoding = PQ_ENC_RLE_DICTIONARY;
+		const vector<int32_t> &dict = hash.values();
+		body.assign((const uint8_t*) &dict[0], (const uint8_t*) &dict[0] + dict.size() * 4);
+		c.dict_offset = 0;
+		pq_page(c, PQ_PAGE_DICTIONARY, body, dict.size(), PQ_ENC_PLAIN_DICTIONARY, 0, 0);
+		c.encodings.push_back(PQ_ENC_PLAIN_DICTIONARY);
+	} else {
+		encoding = PQ_ENC_PLAIN;
+	}
+	c.encodings.push_back(encoding);
+	c.encodings.push_back(PQ_ENC_RLE);
+
+	c.data_offset = c.bytes.size();
+	for (size_t start = 0; start < n; start += pagerows) {
+		size_t cnt = min(pagerows, n - start);
+		const int32_t *p = vals + start;
+		body.clear();
+		if (encoding == PQ_ENC_DELTA_BINARY_PACKED) {
+			pq_delta_encode(p, cnt, body);
+		} else if (encoding == PQ_ENC_RLE_DICTIONARY) {
+			body.push_back((uint8_t) width);
+			pq_rle_hybrid(&codes[start], cnt, width, body);
+		} else {
+			body.assign((const uint8_t*) p, (const uint8_t*) (p + cnt));
+		}
+		pq_page(c, PQ_PAGE_DATA, body, cnt, encoding,
+				*min_element(p, p + cnt), *max_element(p, p + cnt));
+	}
+	c.size = c.bytes.size();
+}
+
+struct ParquetRowGroupEncoder {
+	const vector<vector<int32_t> > *cols;
+	vector<ParquetRowGroup> *groups;
+	size_t rgrows;
+	size_t pagerows;
+
+	void operator()(size_t k) {
+		ParquetRowGroup &rg = (*groups)[k];
+		size_t start = k * rgrows;
+		rg.nrows = min(rgrows, (*cols)[0].size() - start);
+		rg.cols.resize(cols->size());
+		for (unsigned c = 0; c < cols->size(); ++c) {
+			pq_encode_chunk(&(*cols)[c][start], rg.nrows, c == 0, pagerows, rg.cols[c]);
+		}
+	}
+};
+
+/**
+ * Writes each merge group as output-N.parquet. Rows are buffered until
+ *  every thread can encode a row group (--rg_rows rows, pages of
+ *  --page_rows), then the encoded row groups are written in order.
+ */
+class ParquetSink : public GroupSink {
+private:
+	string output;
+	size_t rgrows;
+	size_t pagerows;
+	unsigned nthreads;
+	ofstream out;
+	vector<string> names;
+	vector<vector<int32_t> > pending;
+	//row groups already in the file: bytes dropped, offsets absolute
+	vector<ParquetRowGroup> written;
+	int64_t nrows;
+
+	/**
+	 * @param all also write a final short row group
+	 */
+	void write_row_groups(bool all) {
+		if (pending.empty() || pending[0].empty()) {
+			return;
+		}
+		size_t ngroups = all ? (pending[0].size() + rgrows - 1) / rgrows : pending[0].size() / rgrows;
+		vector<ParquetRowGroup> groups(ngroups);
+		ParquetRowGroupEncoder enc;
+		enc.cols = &pending;
+		enc.groups = &groups;
+		enc.rgrows = rgrows;
+		enc.pagerows = pagerows;
+		parallel_for(groups.size(), enc, nthreads);
+
+		for (unsigned k = 0; k < groups.size(); ++k) {
+			ParquetRowGroup &rg = groups[k];
+			for (unsigned c = 0; c < rg.cols.size(); ++c) {
+				ParquetChunk &ch = rg.cols[c];
+				int64_t base = out.tellp();
+				out.write((const char*) &ch.bytes[0], ch.bytes.size());
+				ch.data_offset += base;
+				if (ch.dict_offset >= 0) {
+					ch.dict_offset += base;
+				}
+				vector<uint8_t>().swap(ch.bytes);
+			}
+			nrows += rg.nrows;
+			written.push_back(rg);
+		}
+		//keep rows short of a full row group for the next round
+		size_t used = min(pending[0].size(), ngroups * rgrows);
+		for (unsigned c = 0; c < pending.size(); ++c) {
+			pending[c].erase(pending[c].begin(), pending[c].begin() + used);
+		}
+	}
+
+	void write_footer() {
+		vector<uint8_t> meta;
+		ThriftWriter t(meta);
+		t.i32(1, 1);
+		t.begin_list(2, T_STRUCT, names.size() + 1);
+		t.begin_struct(0);
+		t.binary(4, "schema");
+		t.i32(5, names.size());
+		t.end_struct();
+		for (unsigned c = 0; c < names.size(); ++c) {
+			t.begin_struct(0);
+			t.i32(1, PQ_TYPE_INT32);
+			t.i32(3, PQ_REQUIRED);
+			t.binary(4, names[c]);
+			t.end_struct();
+		}
+		t.i64(3, nrows);
+
+		t.begin_list(4, T_STRUCT, written.size());
+		for (unsigned k = 0; k < written.size(); ++k) {
+			const ParquetRowGroup &rg = written[k];
+			int64_t rgbytes = 0;
+			t.begin_struct(0);
+			t.begin_list(1, T_STRUCT, rg.cols.size());
+			for (unsigned c = 0; c < rg.cols.size(); ++c) {
+				const ParquetChunk &ch = rg.cols[c];
+				rgbytes += ch.size;
+				t.begin_struct(0);
+				t.i64(2, ch.dict_offset >= 0 ? ch.dict_offset : ch.data_offset);
+				t.begin_struct(3);
+				t.i32(1, PQ_TYPE_INT32);
+				t.begin_list(2, T_I32, ch.encodings.size());
+				for (unsigned e = 0; e < ch.encodings.size(); ++e) {
+					t.list_i32(ch.encodings[e]);
+				}
+				t.begin_list(3, T_BINARY, 1);
+				t.list_binary(names[c]);
+				t.i32(4, PQ_CODEC_UNCOMPRESSED);
+				t.i64(5, ch.nvalues);
+				t.i64(6, ch.size);
+				t.i64(7, ch.size);
+				t.i64(9, ch.data_offset);
+				if (ch.dict_offset >= 0) {
+					t.i64(11, ch.dict_offset);
+				}
+				pq_statistics(t, 12, ch.min, ch.max);
+				t.end_struct();
+				t.end_struct();
+			}
+			t.i64(2, rgbytes);
+			t.i64(3, rg.nrows);
+			t.end_struct();
+		}
+		t.binary(6, "tscomparison");
+		//TypeDefinedOrder for every column, so min_value/max_value are used
+		t.begin_list(7, T_STRUCT, names.size());
+		for (unsigned c = 0; c < names.size(); ++c) {
+			t.begin_struct(0);
+			t.begin_struct(1);
+			t.end_struct();
+			t.end_struct();
+		}
+		t.finish();
+
+		out.write((const char*) &meta[0], meta.size());
+		write_pod(out, (uint32_t) meta.size());
+		out.write(PARQUET_MAGIC, 4);
+	}
+
+public:
+	uint64_t totalbytes;
+
+	ParquetSink(const char *_output) : output(_output), rgrows(opt_int("rg_rows", 131072)),
+		pagerows(opt_int("page_rows", 16384)), nthreads(default_threads()), nrows(0), totalbytes(0) {}
+
+	const char* name() const {
+		return "parquet";
+	}
+
+	void begin_group(int groupdx, const string &key, const GroupReader &group) {
+		stringstream name;
+		name << output << "-" << groupdx << ".parquet";
+		out.open(name.str().c_str(), ios::binary | ios::out | ios::trunc);
+		out.write(PARQUET_MAGIC, 4);
+
+		names.assign(1, "ts");
+		names.insert(names.end(), group.columns.begin(), group.columns.end());
+		pending.assign(names.size(), vector<int32_t>());
+		written.clear();
+		nrows = 0;
+	}
+
+	void write_block(const GroupBlock &blk) {
+		pending[0].insert(pending[0].end(), blk.ts, blk.ts + blk.nrows);
+		for (unsigned i = 0; i < blk.vals.size(); ++i) {
+			pending[i + 1].insert(pending[i + 1].end(), blk.vals[i], blk.vals[i] + blk.nrows);
+		}
+		if (pending[0].size() >= rgrows * nthreads) {
+			write_row_groups(false);
+		}
+	}
+
+	void end_group() {
+		write_row_groups(true);
+		write_footer();
+		totalbytes += out.tellp();
+		out.close();
+	}
+
+	void finish() {
+		cerr << "parquet bytes " << totalbytes << endl;
+	}
+};
+
+void insert_parquet_multi(DataMulti data, int twidth, int vwidth, const char *output) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "parquet only supports 4 byte samples" << endl;
+		return;
+	}
+
+	ParquetSink parquet(output);
+	vector<GroupSink*> sinks(1, &parquet);
+	run_sinks(data, sinks);
+}
+
+void test_parquet_multi() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	insert_parquet_multi(data, 4, 4, "out-parquet");
+}
+
+#endif /* PARQUET_HPP_ */
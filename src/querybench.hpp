@@ -0,0 +1,774 @@
+/*
+ * querybench.hpp
+ * Point lookups, range scans and aggregations over what each backend
+ *  wrote, timed with a warm or a cold page cache
+ */
+
+#ifndef QUERYBENCH_HPP_
+#define QUERYBENCH_HPP_
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+
+#include "csv.hpp"
+#include "mapped.hpp"
+#include "opentsdb.hpp"
+#include "sink.hpp"
+#include "sqlite.hpp"
+#include "tscol.hpp"
+
+using namespace std;
+
+/**
+ * What the queries need to know about a loaded group
+ */
+struct QueryGroup {
+	string key;
+	vector<string> columns;
+	int32_t tmin;
+	int32_t tmax;
+	long nrows;
+	//uniform sample of the group's timestamps, for point lookups
+	vector<int32_t> sample;
+};
+
+/**
+ * Collects a QueryGroup per group while the backends load
+ */
+class QueryCatalogSink : public GroupSink {
+private:
+	size_t cap;
+	uint64_t seed;
+
+public:
+	vector<QueryGroup> groups;
+
+	QueryCatalogSink() : cap(4096), seed(1) {}
+
+	const char* name() const {
+		return "catalog";
+	}
+
+	void begin_group(int groupdx, const string &key, const GroupReader &group) {
+		groups.push_back(QueryGroup());
+		QueryGroup &g = groups.back();
+		g.key = key;
+		g.columns = group.columns;
+		g.tmin = numeric_limits<int32_t>::max();
+		g.tmax = numeric_limits<int32_t>::min();
+		g.nrows = 0;
+	}
+
+	void write_block(const GroupBlock &blk) {
+		QueryGroup &g = groups.back();
+		for (size_t r = 0; r < blk.nrows; ++r) {
+			int32_t ts = blk.ts[r];
+			g.tmin = min(g.tmin, ts);
+			g.tmax = max(g.tmax, ts);
+			++g.nrows;
+			//reservoir sampling, with a private generator so other sinks
+			// running alongside can't disturb it
+			if (g.sample.size() < cap) {
+				g.sample.push_back(ts);
+			} else {
+				seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+				uint64_t j = (seed >> 33) % g.nrows;
+				if (j < cap) {
+					g.sample[j] = ts;
+				}
+			}
+		}
+	}
+
+	void end_group() {}
+};
+
+enum QueryKind { QUERY_POINT, QUERY_RANGE, QUERY_AGG };
+
+/**
+ * Column col of group over t0 <= ts <= t1 (t0 == t1 for point lookups)
+ */
+struct TsQuery {
+	size_t group;
+	unsigned col;
+	int32_t t0;
+	int32_t t1;
+};
+
+/**
+ * Count, sum, min and max of the matched values; range queries also
+ *  hand back the rows themselves
+ */
+struct QueryResult {
+	bool keeprows;
+	long rows;
+	int64_t sum;
+	int32_t min;
+	int32_t max;
+	vector<int32_t> ts;
+	vector<int32_t> vals;
+
+	void clear(bool _keeprows) {
+		keeprows = _keeprows;
+		rows = 0;
+		sum = 0;
+		min = numeric_limits<int32_t>::max();
+		max = numeric_limits<int32_t>::min();
+		ts.clear();
+		vals.clear();
+	}
+
+	void add(int32_t t, int32_t v) {
+		++rows;
+		sum += v;
+		min = std::min(min, v);
+		max = std::max(max, v);
+		if (keeprows) {
+			ts.push_back(t);
+			vals.push_back(v);
+		}
+	}
+};
+
+/**
+ * One backend's output, answering queries. open and close bracket a run
+ *  of queries; files lists what a cold run evicts from the page cache.
+ */
+class QueryBackend {
+public:
+	virtual ~QueryBackend() {}
+	virtual const char* name() const = 0;
+	virtual bool open() = 0;
+	virtual void close() = 0;
+	virtual vector<string> files() const = 0;
+	virtual bool run(const TsQuery &q, QueryKind kind, QueryResult &r) = 0;
+
+	/**
+	 * @brief Delete the backend's output
+	 */
+	virtual void remove() {
+		vector<string> names = files();
+		for (unsigned i = 0; i < names.size(); ++i) {
+			unlink(names[i].c_str());
+		}
+	}
+};
+
+/**
+ * output.db as written by SqliteSink, opened with sqlite_config() (so
+ *  --vfs=zpage and the cache pragmas apply); statements are prepared once
+ */
+class SqliteQueryBackend : public QueryBackend {
+private:
+	string dbname;
+	const vector<QueryGroup> &groups;
+	sqlite3 *db;
+	map<string, sqlite3_stmt*> stmts;
+
+	sqlite3_stmt* prepared(const string &sql) {
+		map<string, sqlite3_stmt*>::iterator it = stmts.find(sql);
+		if (it != stmts.end()) {
+			return it->second;
+		}
+		sqlite3_stmt *stmt = NULL;
+		if (SQLITE_OK != sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL)) {
+			cerr << "couldn't prepare " << sql << ": " << sqlite3_errmsg(db) << endl;
+		}
+		stmts[sql] = stmt;
+		return stmt;
+	}
+
+public:
+	SqliteQueryBackend(const string &_dbname, const vector<QueryGroup> &_groups) :
+		dbname(_dbname), groups(_groups), db(NULL) {}
+
+	~SqliteQueryBackend() {
+		close();
+	}
+
+	const char* name() const {
+		return "sqlite";
+	}
+
+	bool open() {
+		db = new_sqlite_db(dbname.c_str(), sqlite_config());
+		return db != NULL;
+	}
+
+	void close() {
+		for (map<string, sqlite3_stmt*>::iterator it = stmts.begin(); it != stmts.end(); ++it) {
+			sqlite3_finalize(it->second);
+		}
+		stmts.clear();
+		sqlite3_close(db);
+		db = NULL;
+	}
+
+	vector<string> files() const {
+		return vector<string>(1, dbname);
+	}
+
+	void remove() {
+		remove_sqlite_files(dbname);
+	}
+
+	bool run(const TsQuery &q, QueryKind kind, QueryResult &r) {
+		const QueryGroup &g = groups[q.group];
+		const string &col = g.columns[q.col];
+		string sql = kind == QUERY_AGG ?
+				"select count(*), sum(" + col + "), min(" + col + "), max(" + col + ") from t" + g.key :
+				"select time, " + col + " from t" + g.key;
+		sqlite3_stmt *stmt = prepared(sql + " where time between ?1 and ?2");
+		if (NULL == stmt) {
+			return false;
+		}
+		sqlite3_bind_int(stmt, 1, q.t0);
+		sqlite3_bind_int(stmt, 2, q.t1);
+		int rc;
+		while (SQLITE_ROW == (rc = sqlite3_step(stmt))) {
+			if (kind != QUERY_AGG) {
+				r.add(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1));
+			} else if (sqlite3_column_int64(stmt, 0) > 0) {
+				r.rows = sqlite3_column_int64(stmt, 0);
+				r.sum = sqlite3_column_int64(stmt, 1);
+				r.min = sqlite3_column_int(stmt, 2);
+				r.max = sqlite3_column_int(stmt, 3);
+			}
+		}
+		sqlite3_reset(stmt);
+		return SQLITE_DONE == rc;
+	}
+};
+
+/**
+ * @brief Parse a decimal int at p, leaving p after it
+ */
+int32_t query_parse_int(const char *&p, const char *end) {
+	bool neg = p < end && '-' == *p;
+	if (neg) {
+		++p;
+	}
+	int64_t v = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		v = v * 10 + (*p++ - '0');
+	}
+	return (int32_t) (neg ? -v : v);
+}
+
+/**
+ * A set of per group files, mapped the first time a query needs them
+ */
+class MappedGroupFiles {
+private:
+	vector<MappedFile*> mapped;
+
+public:
+	vector<string> names;
+
+	~MappedGroupFiles() {
+		close();
+	}
+
+	const MappedFile* get(size_t g) {
+		if (mapped.size() < names.size()) {
+			mapped.resize(names.size(), NULL);
+		}
+		if (NULL == mapped[g]) {
+			mapped[g] = new MappedFile(names[g].c_str());
+		}
+		return mapped[g]->ok ? mapped[g] : NULL;
+	}
+
+	void close() {
+		for (unsigned i = 0; i < mapped.size(); ++i) {
+			delete mapped[i];
+		}
+		mapped.clear();
+	}
+};
+
+/**
+ * output-N.csv as written by CsvSink. There is no index: each query scans
+ *  from the top of the file, stopping past t1 as rows are in time order.
+ */
+class CsvQueryBackend : public QueryBackend {
+private:
+	MappedGroupFiles groupfiles;
+
+public:
+	CsvQueryBackend(const string &output, size_t ngroups) {
+		for (size_t g = 0; g < ngroups; ++g) {
+			stringstream name;
+			name << output << "-" << (g + 1) << ".csv";
+			groupfiles.names.push_back(name.str());
+		}
+	}
+
+	const char* name() const {
+		return "csv";
+	}
+
+	bool open() {
+		return true;
+	}
+
+	void close() {
+		groupfiles.close();
+	}
+
+	vector<string> files() const {
+		return groupfiles.names;
+	}
+
+	void remove() {
+		QueryBackend::remove();
+		for (unsigned g = 0; g < groupfiles.names.size(); ++g) {
+			string xml = groupfiles.names[g];
+			unlink(xml.replace(xml.size() - 4, 4, ".xml").c_str());
+		}
+	}
+
+	bool run(const TsQuery &q, QueryKind kind, QueryResult &r) {
+		const MappedFile *f = groupfiles.get(q.group);
+		if (NULL == f) {
+			return false;
+		}
+		const char *p = f->data;
+		const char *end = p + f->size;
+		while (p < end) {
+			int32_t ts = query_parse_int(p, end);
+			if (ts > q.t1) {
+				break;
+			}
+			if (ts >= q.t0) {
+				for (unsigned c = 0; c <= q.col; ++c) {
+					p = find_either(p, end, ',', '\n');
+					if (p < end && ',' == *p) {
+						++p;
+					}
+				}
+				r.add(ts, query_parse_int(p, end));
+			}
+			p = find_byte(p, end, '\n') + 1;
+		}
+		return true;
+	}
+};
+
+/**
+ * output-N.tsc as written by TscolSink: the footer index narrows a query
+ *  to the chunks whose time range overlaps it
+ */
+class TscolQueryBackend : public QueryBackend {
+private:
+	vector<string> names;
+	vector<TscolFile*> opened;
+	vector<int32_t> ts;
+	vector<int32_t> vals;
+	vector<uint8_t> scratch;
+	vector<size_t> ks;
+
+public:
+	TscolQueryBackend(const string &output, size_t ngroups) {
+		for (size_t g = 0; g < ngroups; ++g) {
+			stringstream name;
+			name << output << "-" << (g + 1) << ".tsc";
+			names.push_back(name.str());
+		}
+	}
+
+	~TscolQueryBackend() {
+		close();
+	}
+
+	const char* name() const {
+		return "tscol";
+	}
+
+	bool open() {
+		opened.assign(names.size(), NULL);
+		return true;
+	}
+
+	void close() {
+		for (unsigned i = 0; i < opened.size(); ++i) {
+			delete opened[i];
+		}
+		opened.clear();
+	}
+
+	vector<string> files() const {
+		return names;
+	}
+
+	bool run(const TsQuery &q, QueryKind kind, QueryResult &r) {
+		if (NULL == opened[q.group]) {
+			opened[q.group] = new TscolFile(names[q.group].c_str());
+		}
+		const TscolFile &file = *opened[q.group];
+		if (!file.ok) {
+			return false;
+		}
+		file.chunks_in_range(q.t0, q.t1, ks);
+		for (unsigned i = 0; i < ks.size(); ++i) {
+			if (!file.read(0, ks[i], ts, scratch) || !file.read(q.col + 1, ks[i], vals, scratch)) {
+				return false;
+			}
+			for (size_t k = 0; k < ts.size(); ++k) {
+				if (ts[k] >= q.t0 && ts[k] <= q.t1) {
+					r.add(ts[k], vals[k]);
+				}
+			}
+		}
+		return true;
+	}
+};
+
+/**
+ * output-m<N>.tsdb as written by ins_opentsdb_sharded --shard_by=metric:
+ *  one metric per group, one "t=<column>" series per column, lines in time
+ *  order. Like opentsdb's row keys (metric, then base time), a query
+ *  binary searches the metric's file for t0, then reads forward.
+ */
+class TsdbQueryBackend : public QueryBackend {
+private:
+	MappedGroupFiles groupfiles;
+
+	/**
+	 * @returns the first line starting at or after off
+	 */
+	static const char* line_at(const MappedFile *f, size_t off) {
+		const char *end = f->data + f->size;
+		if (0 == off) {
+			return f->data;
+		}
+		const char *p = find_byte(f->data + off - 1, end, '\n');
+		return p < end ? p + 1 : end;
+	}
+
+	/**
+	 * @brief Parse "metric ts value t=col" at p, leaving p at the next line
+	 */
+	static void parse_line(const char *&p, const char *end, int32_t &ts, int32_t &v, unsigned &col) {
+		p = find_byte(p, end, ' ') + 1;
+		ts = query_parse_int(p, end);
+		++p;
+		v = query_parse_int(p, end);
+		p = find_byte(p, end, '=') + 1;
+		col = query_parse_int(p, end);
+		p = find_byte(p, end, '\n') + 1;
+	}
+
+public:
+	TsdbQueryBackend(const string &output, size_t ngroups) {
+		for (size_t g = 0; g < ngroups; ++g) {
+			stringstream name;
+			name << output << "-m" << (g + 1) << ".tsdb";
+			groupfiles.names.push_back(name.str());
+		}
+	}
+
+	const char* name() const {
+		return "opentsdb";
+	}
+
+	bool open() {
+		return true;
+	}
+
+	void close() {
+		groupfiles.close();
+	}
+
+	vector<string> files() const {
+		return groupfiles.names;
+	}
+
+	bool run(const TsQuery &q, QueryKind kind, QueryResult &r) {
+		const MappedFile *f = groupfiles.get(q.group);
+		if (NULL == f) {
+			return false;
+		}
+		const char *end = f->data + f->size;
+		int32_t ts;
+		int32_t v;
+		unsigned col;
+		//smallest offset whose next line is at or past t0
+		size_t lo = 0;
+		size_t hi = f->size;
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			const char *p = line_at(f, mid);
+			if (p >= end) {
+				hi = mid;
+				continue;
+			}
+			parse_line(p, end, ts, v, col);
+			if (ts >= q.t0) {
+				hi = mid;
+			} else {
+				lo = mid + 1;
+			}
+		}
+		for (const char *p = line_at(f, lo); p < end; ) {
+			parse_line(p, end, ts, v, col);
+			if (ts > q.t1) {
+				break;
+			}
+			if (col == q.col + 1) {
+				r.add(ts, v);
+			}
+		}
+		return true;
+	}
+};
+
+/**
+ * @brief Write back and drop a file's cached pages, so the next read
+ *  comes from the disk
+ */
+void evict_file(const string &fname) {
+	int fd = ::open(fname.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	fdatasync(fd);
+#ifdef POSIX_FADV_DONTNEED
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+	::close(fd);
+}
+
+/**
+ * @brief nqueries queries of one kind over random groups and columns, the
+ *  same for every backend: point lookups of sampled timestamps, or ranges
+ *  of width seconds
+ */
+vector<TsQuery> make_queries(const vector<QueryGroup> &groups, QueryKind kind, int64_t width, long nqueries) {
+	vector<size_t> usable;
+	for (size_t g = 0; g < groups.size(); ++g) {
+		if (groups[g].nrows > 0 && !groups[g].columns.empty()) {
+			usable.push_back(g);
+		}
+	}
+	vector<TsQuery> queries;
+	srand(1);
+	for (long i = 0; i < nqueries && !usable.empty(); ++i) {
+		TsQuery q;
+		q.group = usable[rand() % usable.size()];
+		const QueryGroup &g = groups[q.group];
+		q.col = rand() % g.columns.size();
+		if (kind == QUERY_POINT) {
+			q.t0 = q.t1 = g.sample[rand() % g.sample.size()];
+		} else {
+			int64_t span = max((int64_t) 1, (int64_t) g.tmax - g.tmin - width + 1);
+			q.t0 = g.tmin + rand() % span;
+			q.t1 = (int32_t) min((int64_t) numeric_limits<int32_t>::max(), q.t0 + width - 1);
+		}
+		queries.push_back(q);
+	}
+	return queries;
+}
+
+/**
+ * @brief Run queries against backend, warm (after an untimed pass over the
+ *  same queries) or cold (files evicted and the backend reopened before
+ *  each query, the reopen timed with it)
+ * @param results set to count and sum per query, to compare backends
+ * @param rowsread set to the rows the queries matched
+ * @returns each query's latency in seconds, sorted; empty on failure
+ */
+vector<double> time_queries(QueryBackend &backend, const vector<TsQuery> &queries, QueryKind kind, bool cold,
+		vector<pair<long, int64_t> > &results, long &rowsread) {
+	vector<double> lat;
+	vector<string> files = backend.files();
+	QueryResult r;
+	results.clear();
+	rowsread = 0;
+	if (!cold) {
+		if (!backend.open()) {
+			return lat;
+		}
+		for (unsigned i = 0; i < queries.size(); ++i) {
+			r.clear(kind == QUERY_RANGE);
+			backend.run(queries[i], kind, r);
+		}
+	}
+	for (unsigned i = 0; i < queries.size(); ++i) {
+		if (cold) {
+			for (unsigned f = 0; f < files.size(); ++f) {
+				evict_file(files[f]);
+			}
+		}
+		r.clear(kind == QUERY_RANGE);
+		double start = wall_seconds();
+		bool ok = (!cold || backend.open()) && backend.run(queries[i], kind, r);
+		if (cold) {
+			backend.close();
+		}
+		lat.push_back(wall_seconds() - start);
+		if (!ok) {
+			cerr << backend.name() << " query failed" << endl;
+			lat.clear();
+			break;
+		}
+		results.push_back(make_pair(r.rows, r.sum));
+		rowsread += r.rows;
+	}
+	if (!cold) {
+		backend.close();
+	}
+	sort(lat.begin(), lat.end());
+	return lat;
+}
+
+/**
+ * @brief Load data into each of --backends (sqlite, csv, tscol, opentsdb;
+ *  all by default) in one pass, then time --queries point lookups, range
+ *  scans and aggregations over each --query_widths seconds, with --cache=
+ *  warm,cold, one tab separated line each. Every backend gets the same
+ *  queries and must return the same rows. Outputs are output.db,
+ *  output-N.csv, output-N.tsc and output-mN.tsdb, removed afterwards unless
+ *  --keep=1.
+ */
+void print_query_bench(DataMulti data, const char *output, ostream &out) {
+	vector<string> names = opt_list("backends", "sqlite,csv,tscol,opentsdb");
+	vector<string> widths = opt_list("query_widths", "60,3600,86400");
+	vector<string> caches = opt_list("cache", "warm,cold");
+	long nqueries = opt_int("queries", 100);
+	string prefix = output;
+	bool has[4] = {false, false, false, false};
+	const char *known[4] = {"sqlite", "csv", "tscol", "opentsdb"};
+	for (unsigned i = 0; i < names.size(); ++i) {
+		unsigned k = find(known, known + 4, names[i]) - known;
+		if (k < 4) {
+			has[k] = true;
+		} else {
+			cerr << "unknown backend " << names[i] << endl;
+		}
+	}
+
+	QueryCatalogSink catalog;
+	vector<GroupSink*> sinks(1, &catalog);
+	string dbname = prefix + ".db";
+	SqliteSink *sqlite = NULL;
+	if (has[0]) {
+		remove_sqlite_files(dbname);
+		sqlite = new SqliteSink(dbname.c_str());
+		sinks.push_back(sqlite);
+	}
+	CsvSink csv(output);
+	if (has[1]) {
+		sinks.push_back(&csv);
+	}
+	TscolSink tscol(output);
+	if (has[2]) {
+		sinks.push_back(&tscol);
+	}
+	run_sinks(data, sinks);
+	delete sqlite;
+	if (has[3]) {
+		map<string, string> saved = options();
+		options()["shard_by"] = "metric";
+		options()["gzip"] = "0";
+		print_opentsdb_inserts_sharded(data, 4, 4, prefix);
+		options() = saved;
+	}
+	const vector<QueryGroup> &groups = catalog.groups;
+
+	vector<QueryBackend*> backends;
+	if (has[0]) {
+		backends.push_back(new SqliteQueryBackend(dbname, groups));
+	}
+	if (has[1]) {
+		backends.push_back(new CsvQueryBackend(prefix, groups.size()));
+	}
+	if (has[2]) {
+		backends.push_back(new TscolQueryBackend(prefix, groups.size()));
+	}
+	if (has[3]) {
+		backends.push_back(new TsdbQueryBackend(prefix, groups.size()));
+	}
+
+	for (unsigned b = 0; b < backends.size(); ++b) {
+		vector<string> files = backends[b]->files();
+		off_t bytes = 0;
+		for (unsigned f = 0; f < files.size(); ++f) {
+			bytes += file_bytes(files[f]);
+		}
+		out << backends[b]->name() << " " << bytes << " bytes" << endl;
+	}
+
+	//point lookups, then each width as a range scan and an aggregation
+	vector<pair<QueryKind, int64_t> > workloads(1, make_pair(QUERY_POINT, (int64_t) 0));
+	for (unsigned w = 0; w < widths.size(); ++w) {
+		workloads.push_back(make_pair(QUERY_RANGE, (int64_t) atol(widths[w].c_str())));
+		workloads.push_back(make_pair(QUERY_AGG, (int64_t) atol(widths[w].c_str())));
+	}
+	const char *kindnames[] = {"point", "range", "agg"};
+
+	out << "backend\tcache\tquery\twidth_s\tqueries\tp50_ms\tp90_ms\tp99_ms\tmax_ms\tqueries/s\trows/s" << endl;
+	long mismatches = 0;
+	for (unsigned w = 0; w < workloads.size(); ++w) {
+		QueryKind kind = workloads[w].first;
+		vector<TsQuery> queries = make_queries(groups, kind, workloads[w].second, nqueries);
+		for (unsigned c = 0; c < caches.size(); ++c) {
+			bool cold = caches[c] == "cold";
+			vector<pair<long, int64_t> > expected;
+			for (unsigned b = 0; b < backends.size(); ++b) {
+				vector<pair<long, int64_t> > results;
+				long rowsread;
+				vector<double> lat = time_queries(*backends[b], queries, kind, cold, results, rowsread);
+				out << backends[b]->name() << "\t" << (cold ? "cold" : "warm") << "\t" << kindnames[kind] << "\t";
+				if (kind == QUERY_POINT) {
+					out << "-";
+				} else {
+					out << workloads[w].second;
+				}
+				out << "\t" << lat.size();
+				if (lat.empty()) {
+					out << "\t-\t-\t-\t-\t-\t-" << endl;
+					continue;
+				}
+				double total = 0;
+				for (unsigned i = 0; i < lat.size(); ++i) {
+					total += lat[i];
+				}
+				out << "\t" << lat[lat.size() / 2] * 1e3 << "\t" << lat[lat.size() * 9 / 10] * 1e3 << "\t"
+						<< lat[min(lat.size() - 1, lat.size() * 99 / 100)] * 1e3 << "\t" << lat.back() * 1e3
+						<< "\t" << (total > 0 ? lat.size() / total : 0) << "\t" << (total > 0 ? rowsread / total : 0)
+						<< endl;
+				if (expected.empty()) {
+					expected = results;
+				} else if (results != expected) {
+					cerr << backends[b]->name() << " " << kindnames[kind] << " results differ from "
+							<< backends[0]->name() << endl;
+					++mismatches;
+				}
+			}
+		}
+	}
+	out << "results " << (mismatches ? "DIFFER" : "match") << " across backends" << endl;
+
+	for (unsigned b = 0; b < backends.size(); ++b) {
+		if (!opt_int("keep", 0)) {
+			backends[b]->remove();
+		}
+		delete backends[b];
+	}
+}
+
+void test_query_bench() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	options()["queries"] = "20";
+	print_query_bench(data, "out-query", cerr);
+	options().erase("queries");
+}
+
+#endif /* QUERYBENCH_HPP_ */
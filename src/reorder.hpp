@@ -0,0 +1,535 @@
+/*
+ * reorder.hpp
+ * Reorder buffer for late and duplicate timestamps, applied to merge groups
+ *  before any backend sees them, so all backends keep the same rows
+ */
+
+#ifndef REORDER_HPP_
+#define REORDER_HPP_
+
+#include <stdint.h>
+
+#include <cstdio>
+#include <limits>
+#include <map>
+
+#include "data.hpp"
+#include "options.hpp"
+
+using namespace std;
+
+enum DedupPolicy { DEDUP_LAST, DEDUP_FIRST };
+
+/**
+ * Buffered rows spilled to a temporary file in timestamp order, as
+ *  (ts, values...) records, read back a batch at a time while merging
+ */
+class ReorderRun {
+private:
+	FILE *f;
+	size_t width;
+	vector<int32_t> buf;
+	size_t pos;
+
+	ReorderRun(const ReorderRun&);
+	ReorderRun& operator=(const ReorderRun&);
+
+	void fill() {
+		const size_t batch = 4096;
+		buf.resize(batch * width);
+		size_t n = fread(&buf[0], width * sizeof(int32_t), batch, f);
+		buf.resize(n * width);
+		pos = 0;
+	}
+
+public:
+	ReorderRun(size_t _width) : f(tmpfile()), width(_width), pos(0) {}
+
+	~ReorderRun() {
+		if (f) {
+			fclose(f);
+		}
+	}
+
+	bool ok() const {
+		return f != NULL;
+	}
+
+	void write(const int32_t *row) {
+		fwrite(row, sizeof(int32_t), width, f);
+	}
+
+	/**
+	 * @brief Done writing: start reading from the first row
+	 */
+	void start_reading() {
+		fflush(f);
+		rewind(f);
+		fill();
+	}
+
+	bool empty() const {
+		return pos >= buf.size();
+	}
+
+	const int32_t* head() const {
+		return &buf[pos];
+	}
+
+	void pop() {
+		pos += width;
+		if (pos >= buf.size()) {
+			fill();
+		}
+	}
+};
+
+/**
+ * Hands out the rows of another reader in timestamp order, with one row
+ *  per timestamp. A row may arrive up to --lateness seconds behind the
+ *  newest timestamp seen so far; later ones are dropped and counted.
+ *  --dedup=last (default) keeps the last row written for a timestamp,
+ *  --dedup=first the first. Past --reorder_rows buffered rows the buffer
+ *  is spilled to a temporary file, and spilled runs are merged back.
+ */
+class ReorderReader : public GroupReader {
+private:
+	GroupReader *source;
+	int64_t lateness;
+	DedupPolicy policy;
+	size_t memrows;
+	//ts and values per row
+	size_t width;
+
+	//buffered rows: timestamp -> slot of width ints
+	map<int32_t, size_t> pending;
+	vector<int32_t> slots;
+	vector<size_t> freeslots;
+	//oldest first
+	vector<ReorderRun*> runs;
+	int64_t maxts;
+	bool drained;
+
+	//rows ready to hand out, by column
+	vector<int32_t> outts;
+	vector<vector<int32_t> > outvals;
+	size_t outpos;
+	size_t pos;
+
+	void clear() {
+		pending.clear();
+		slots.clear();
+		freeslots.clear();
+		for (unsigned i = 0; i < runs.size(); ++i) {
+			delete runs[i];
+		}
+		runs.clear();
+		maxts = numeric_limits<int64_t>::min();
+		drained = false;
+		outts.clear();
+		outvals.assign(columns.size(), vector<int32_t>());
+		outpos = 0;
+		pos = 0;
+		nlate = 0;
+		nduplicates = 0;
+		nspilled = 0;
+	}
+
+	void add(const GroupBlock &blk, size_t r) {
+		int32_t ts = blk.ts[r];
+		if (maxts != numeric_limits<int64_t>::min() && ts < maxts - lateness) {
+			++nlate;
+			return;
+		}
+		maxts = max(maxts, (int64_t) ts);
+
+		size_t before = pending.size();
+		map<int32_t, size_t>::iterator it = pending.insert(pending.end(), make_pair(ts, (size_t) 0));
+		if (pending.size() == before) {
+			++nduplicates;
+			if (policy == DEDUP_FIRST) {
+				return;
+			}
+		} else if (!freeslots.empty()) {
+			it->second = freeslots.back();
+			freeslots.pop_back();
+		} else {
+			it->second = slots.size() / width;
+			slots.resize(slots.size() + width);
+		}
+		int32_t *row = &slots[it->second * width];
+		row[0] = ts;
+		for (size_t c = 0; c + 1 < width; ++c) {
+			row[c + 1] = blk.vals[c][r];
+		}
+
+		if (pending.size() >= memrows) {
+			spill();
+		}
+	}
+
+	void spill() {
+		ReorderRun *run = new ReorderRun(width);
+		if (!run->ok()) {
+			cerr << "could not create a temporary file, keeping rows in memory" << endl;
+			delete run;
+			memrows *= 2;
+			return;
+		}
+		for (map<int32_t, size_t>::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+			run->write(&slots[it->second * width]);
+		}
+		nspilled += pending.size();
+		run->start_reading();
+		runs.push_back(run);
+		pending.clear();
+		slots.clear();
+		freeslots.clear();
+	}
+
+	void emit(const int32_t *row) {
+		outts.push_back(row[0]);
+		for (size_t c = 0; c + 1 < width; ++c) {
+			outvals[c].push_back(row[c + 1]);
+		}
+	}
+
+	/**
+	 * @brief Move rows older than watermark to the output, merging the
+	 *  spilled runs (oldest first) with the in-memory rows (newest)
+	 */
+	void release(int64_t watermark) {
+		for (;;) {
+			int64_t low = watermark;
+			for (unsigned i = 0; i < runs.size(); ++i) {
+				if (!runs[i]->empty()) {
+					low = min(low, (int64_t) runs[i]->head()[0]);
+				}
+			}
+			if (!pending.empty()) {
+				low = min(low, (int64_t) pending.begin()->first);
+			}
+			if (low >= watermark) {
+				break;
+			}
+
+			//every source holding this timestamp, oldest to newest
+			const int32_t *chosen = NULL;
+			int nmatches = 0;
+			for (unsigned i = 0; i < runs.size(); ++i) {
+				if (!runs[i]->empty() && runs[i]->head()[0] == low) {
+					if (NULL == chosen || policy == DEDUP_LAST) {
+						chosen = runs[i]->head();
+					}
+					++nmatches;
+				}
+			}
+			bool inmemory = !pending.empty() && pending.begin()->first == low;
+			if (inmemory) {
+				if (NULL == chosen || policy == DEDUP_LAST) {
+					chosen = &slots[pending.begin()->second * width];
+				}
+				++nmatches;
+			}
+			emit(chosen);
+			nduplicates += nmatches - 1;
+
+			for (unsigned i = 0; i < runs.size(); ++i) {
+				if (!runs[i]->empty() && runs[i]->head()[0] == low) {
+					runs[i]->pop();
+				}
+			}
+			if (inmemory) {
+				freeslots.push_back(pending.begin()->second);
+				pending.erase(pending.begin());
+			}
+		}
+
+		for (unsigned i = 0; i < runs.size(); ) {
+			if (runs[i]->empty()) {
+				delete runs[i];
+				runs.erase(runs.begin() + i);
+			} else {
+				++i;
+			}
+		}
+	}
+
+public:
+	long nlate;
+	long nduplicates;
+	long nspilled;
+
+	/**
+	 * @param _source reader to reorder, deleted with this one
+	 */
+	ReorderReader(GroupReader *_source) : source(_source) {
+		tsname = source->tsname;
+		columns = source->columns;
+		vsnames = source->vsnames;
+		//an upper bound until drained, when next() sets the rows handed out
+		nrows = source->nrows;
+		lateness = opt_int("lateness", 0);
+		policy = opt_str("dedup", "last") == "first" ? DEDUP_FIRST : DEDUP_LAST;
+		memrows = max(1L, opt_int("reorder_rows", 1 << 20));
+		width = 1 + columns.size();
+		clear();
+	}
+
+	~ReorderReader() {
+		clear();
+		delete source;
+	}
+
+	bool ok() const {
+		return source->ok();
+	}
+
+	void rewind() {
+		source->rewind();
+		clear();
+	}
+
+	bool strictly_increasing() const {
+		return true;
+	}
+
+	bool next(GroupBlock &blk, size_t maxrows) {
+		//rows handed out last time are no longer referenced: drop them once
+		// they are half the buffer, which keeps the copying linear
+		if (outpos > 0 && outpos >= outts.size() - outpos) {
+			outts.erase(outts.begin(), outts.begin() + outpos);
+			for (unsigned c = 0; c < outvals.size(); ++c) {
+				outvals[c].erase(outvals[c].begin(), outvals[c].begin() + outpos);
+			}
+			outpos = 0;
+		}
+
+		GroupBlock in;
+		while (outts.size() - outpos < maxrows && !drained) {
+			if (!source->next(in, maxrows)) {
+				drained = true;
+				release(numeric_limits<int64_t>::max());
+				nrows = pos + outts.size() - outpos;
+				if (nlate || nduplicates || nspilled) {
+					cerr << tsname << ": " << nlate << " late rows dropped, " << nduplicates
+							<< " duplicates, " << nspilled << " rows spilled" << endl;
+				}
+				break;
+			}
+			for (size_t r = 0; r < in.nrows; ++r) {
+				add(in, r);
+			}
+			n_vstream_failures = source->n_vstream_failures;
+			if (maxts != numeric_limits<int64_t>::min()) {
+				release(maxts - lateness);
+			}
+		}
+
+		if (outpos == outts.size()) {
+			return false;
+		}
+		blk.start = pos;
+		blk.nrows = min(maxrows, outts.size() - outpos);
+		blk.ts = &outts[outpos];
+		blk.vals.resize(outvals.size());
+		for (unsigned c = 0; c < outvals.size(); ++c) {
+			blk.vals[c] = &outvals[c][outpos];
+		}
+		outpos += blk.nrows;
+		pos += blk.nrows;
+		return true;
+	}
+};
+
+/**
+ * @returns group, or a ReorderReader over it if --lateness is given
+ */
+GroupReader* reorder_group(GroupReader *group) {
+	if (!has_opt("lateness")) {
+		return group;
+	}
+	return new ReorderReader(group);
+}
+
+/**
+ * @returns a reader for one merge group, reordered if asked to; caller deletes
+ */
+GroupReader* open_group(DataMulti &data, map<string, set<string> >::const_iterator group) {
+	return reorder_group(new GroupReader(data, group));
+}
+
+void test_reorder_multi() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	//the test data is in order: reordering, even through spills, must
+	// hand out the very same rows
+	options()["lateness"] = "3600";
+	options()["reorder_rows"] = "1000";
+	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
+		GroupReader plain(data, it);
+		GroupReader *reordered = open_group(data, it);
+		GroupBlock a;
+		GroupBlock b;
+		size_t rows = 0;
+		long mismatches = 0;
+		while (plain.next(a, 4096)) {
+			for (size_t r = 0; r < a.nrows; ++r, ++rows) {
+				if (0 == rows % 1000 && !reordered->next(b, 1000)) {
+					++mismatches;
+					break;
+				}
+				mismatches += a.ts[r] != b.ts[rows % 1000];
+				for (unsigned c = 0; c < a.vals.size(); ++c) {
+					mismatches += a.vals[c][r] != b.vals[c][rows % 1000];
+				}
+			}
+		}
+		mismatches += reordered->next(b, 1000);
+		cerr << (*it).first << " rows " << rows << (mismatches ? " MISMATCH" : " ok") << endl;
+		delete reordered;
+	}
+	options().erase("lateness");
+	options().erase("reorder_rows");
+}
+
+/**
+ * Rows held in memory, handed out in the order they were added
+ */
+class VectorGroupReader : public GroupReader {
+private:
+	size_t pos;
+
+public:
+	vector<int32_t> ts;
+	vector<vector<int32_t> > vals;
+
+	VectorGroupReader(size_t ncols) : pos(0), vals(ncols) {
+		tsname = "memory";
+		for (size_t c = 0; c < ncols; ++c) {
+			stringstream name;
+			name << "v" << c;
+			columns.push_back(name.str());
+		}
+		vsnames.assign(ncols, "");
+	}
+
+	void add(int32_t t, const int32_t *row) {
+		ts.push_back(t);
+		for (size_t c = 0; c < vals.size(); ++c) {
+			vals[c].push_back(row[c]);
+		}
+		nrows = ts.size();
+	}
+
+	bool ok() const {
+		return true;
+	}
+
+	void rewind() {
+		pos = 0;
+	}
+
+	bool next(GroupBlock &blk, size_t maxrows) {
+		if (pos >= ts.size()) {
+			return false;
+		}
+		blk.start = pos;
+		blk.nrows = min(maxrows, ts.size() - pos);
+		blk.ts = &ts[pos];
+		blk.vals.resize(vals.size());
+		for (unsigned c = 0; c < vals.size(); ++c) {
+			blk.vals[c] = &vals[c][pos];
+		}
+		pos += blk.nrows;
+		return true;
+	}
+};
+
+void test_reorder_shuffled() {
+	const int64_t lateness = 100;
+	options()["lateness"] = "100";
+	options()["reorder_rows"] = "64";
+	const char *policies[] = {"last", "first"};
+	for (int p = 0; p < 2; ++p) {
+		options()["dedup"] = policies[p];
+		DedupPolicy policy = p ? DEDUP_FIRST : DEDUP_LAST;
+
+		//rows 10s apart, shuffled within windows of 8 (70s at most, inside
+		// the lateness), with duplicates of recent rows and rows far too late
+		VectorGroupReader *input = new VectorGroupReader(2);
+		uint32_t seed = 12345;
+		int32_t window[8];
+		for (int32_t base = 0; base < 5000; base += 8) {
+			for (int i = 0; i < 8; ++i) {
+				window[i] = 100000 + 10 * (base + i);
+			}
+			for (int i = 7; i > 0; --i) {
+				seed = seed * 1103515245 + 12345;
+				swap(window[i], window[(seed >> 16) % (i + 1)]);
+			}
+			for (int i = 0; i < 8; ++i) {
+				seed = seed * 1103515245 + 12345;
+				int32_t row[2] = {(int32_t) (seed >> 16), base + i};
+				input->add(window[i], row);
+				if (0 == (seed >> 8) % 5) {
+					row[1] = -row[1];
+					input->add(window[(seed >> 12) % (i + 1)], row);
+				}
+				if (0 == (seed >> 4) % 23) {
+					input->add(window[i] - 1000, row);
+				}
+			}
+		}
+
+		//reference: the same acceptance rule applied row by row, kept in a map
+		map<int32_t, pair<int32_t, int32_t> > expect;
+		long nlate = 0;
+		long nduplicates = 0;
+		int64_t maxts = numeric_limits<int64_t>::min();
+		for (size_t r = 0; r < input->ts.size(); ++r) {
+			int32_t t = input->ts[r];
+			if (maxts != numeric_limits<int64_t>::min() && t < maxts - lateness) {
+				++nlate;
+				continue;
+			}
+			maxts = max(maxts, (int64_t) t);
+			pair<int32_t, int32_t> row(input->vals[0][r], input->vals[1][r]);
+			if (expect.count(t)) {
+				++nduplicates;
+				if (policy == DEDUP_LAST) {
+					expect[t] = row;
+				}
+			} else {
+				expect[t] = row;
+			}
+		}
+
+		ReorderReader reordered(input);
+		GroupBlock blk;
+		long mismatches = 0;
+		map<int32_t, pair<int32_t, int32_t> >::const_iterator it = expect.begin();
+		while (reordered.next(blk, 1000)) {
+			for (size_t r = 0; r < blk.nrows; ++r) {
+				if (it == expect.end()) {
+					++mismatches;
+					continue;
+				}
+				mismatches += blk.ts[r] != it->first || blk.vals[0][r] != it->second.first
+						|| blk.vals[1][r] != it->second.second;
+				++it;
+			}
+		}
+		mismatches += it != expect.end();
+		bool ok = 0 == mismatches && reordered.nlate == nlate && reordered.nduplicates == nduplicates
+				&& reordered.nspilled > 0;
+		cerr << "dedup=" << policies[p] << ": " << expect.size() << " rows, " << nlate << " late, "
+				<< nduplicates << " duplicates, " << reordered.nspilled << " spilled: "
+				<< (ok ? "ok" : "MISMATCH") << endl;
+	}
+	options().erase("lateness");
+	options().erase("reorder_rows");
+	options().erase("dedup");
+}
+
+#endif /* REORDER_HPP_ */
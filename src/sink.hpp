@@ -0,0 +1,107 @@
+/*
+ * sink.hpp
+ * Backends as consumers of merge group row blocks, so one scan of the
+ *  input can feed several of them at once
+ */
+
+#ifndef SINK_HPP_
+#define SINK_HPP_
+
+#include "data.hpp"
+#include "parallel.hpp"
+#include "reorder.hpp"
+
+using namespace std;
+
+/**
+ * A backend fed one merge group at a time. write_block may run
+ *  concurrently with other sinks' write_block on the same block, so sinks
+ *  must only touch their own state.
+ */
+class GroupSink {
+public:
+	virtual ~GroupSink() {}
+	virtual const char* name() const = 0;
+	/**
+	 * @param groupdx 1-based group index, for output naming
+	 * @param key timestamp stream name shared by the group
+	 * @param group for its columns and names; group.nrows may only be an
+	 *  upper bound here (see GroupReader::nrows), so sinks don't size
+	 *  output from it
+	 */
+	virtual void begin_group(int groupdx, const string &key, const GroupReader &group) = 0;
+	virtual void write_block(const GroupBlock &blk) = 0;
+	virtual void end_group() = 0;
+	/**
+	 * @brief Called once after the last group
+	 */
+	virtual void finish() {}
+};
+
+struct SinkBlockWriter {
+	vector<GroupSink*> *sinks;
+	const GroupBlock *blk;
+	void operator()(size_t i) {
+		(*sinks)[i]->write_block(*blk);
+	}
+};
+
+/**
+ * @brief Hand every block of one group to all sinks, concurrently (up to
+ *  --threads)
+ */
+void feed_sinks(GroupReader &group, int groupdx, const string &key, vector<GroupSink*> &sinks) {
+	size_t blockrows = group_block_rows();
+	unsigned nthreads = default_threads();
+
+	timeit(true);
+
+	for (unsigned s = 0; s < sinks.size(); ++s) {
+		sinks[s]->begin_group(groupdx, key, group);
+	}
+
+	GroupBlock blk;
+	SinkBlockWriter writer;
+	writer.sinks = &sinks;
+	writer.blk = &blk;
+	while (group.next(blk, blockrows)) {
+		parallel_for(sinks.size(), writer, nthreads);
+	}
+
+	for (unsigned s = 0; s < sinks.size(); ++s) {
+		sinks[s]->end_group();
+	}
+
+	if (0 != group.n_vstream_failures) {
+		cerr << "some value streams were incomplete or missing: count="
+				<< group.n_vstream_failures << endl;
+	}
+
+	timeit(false, group.nrows);
+}
+
+/**
+ * @brief Read every group of data once, feeding each to all sinks
+ */
+void run_sinks(DataMulti &data, vector<GroupSink*> &sinks) {
+	int groupdx = 0;
+
+	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
+		++groupdx;
+
+		GroupReader *group = open_group(data, it);
+		if (!group->ok()) {
+			cerr << "could not find timestamp file " << group->tsname << endl;
+			delete group;
+			break;
+		}
+		feed_sinks(*group, groupdx, (*it).first, sinks);
+		delete group;
+	}
+
+	for (unsigned s = 0; s < sinks.size(); ++s) {
+		sinks[s]->finish();
+	}
+}
+
+#endif /* SINK_HPP_ */
@@ -0,0 +1,165 @@
+/*
+ * snappy.hpp
+ * Snappy raw block format (as used by Prometheus remote write): a greedy
+ *  single-probe compressor and a checking decompressor
+ */
+
+#ifndef SNAPPY_HPP_
+#define SNAPPY_HPP_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "bits.hpp"
+
+using namespace std;
+
+const int SNAPPY_HASH_BITS = 14;
+const size_t SNAPPY_MAX_OFFSET = 65535;
+
+uint32_t snappy_hash(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return (v * 0x1e35a7bdU) >> (32 - SNAPPY_HASH_BITS);
+}
+
+void snappy_literal(vector<uint8_t> &out, const uint8_t *p, size_t len) {
+	if (0 == len) {
+		return;
+	}
+	size_t n = len - 1;
+	if (n < 60) {
+		out.push_back((uint8_t) (n << 2));
+	} else {
+		int nbytes = n < 0x100 ? 1 : n < 0x10000 ? 2 : n < 0x1000000 ? 3 : 4;
+		out.push_back((uint8_t) ((59 + nbytes) << 2));
+		for (int b = 0; b < nbytes; ++b) {
+			out.push_back((uint8_t) (n >> (8 * b)));
+		}
+	}
+	out.insert(out.end(), p, p + len);
+}
+
+/**
+ * @brief Copies with a 2 byte offset carry at most 64 bytes each
+ */
+void snappy_copy(vector<uint8_t> &out, size_t offset, size_t len) {
+	while (len > 0) {
+		size_t l = min(len, (size_t) 64);
+		out.push_back((uint8_t) (((l - 1) << 2) | 2));
+		out.push_back((uint8_t) offset);
+		out.push_back((uint8_t) (offset >> 8));
+		len -= l;
+	}
+}
+
+/**
+ * @brief Compress n bytes (n < 4 GiB), appending to out
+ */
+void snappy_compress(const uint8_t *in, size_t n, vector<uint8_t> &out) {
+	put_varint(out, n);
+	vector<int64_t> table(1 << SNAPPY_HASH_BITS, -1);
+	size_t anchor = 0;
+	size_t i = 0;
+	while (i + 4 <= n) {
+		uint32_t h = snappy_hash(in + i);
+		int64_t cand = table[h];
+		table[h] = i;
+		if (cand < 0 || i - cand > SNAPPY_MAX_OFFSET || 0 != memcmp(in + cand, in + i, 4)) {
+			++i;
+			continue;
+		}
+		size_t len = 4;
+		while (i + len < n && in[cand + len] == in[i + len]) {
+			++len;
+		}
+		snappy_literal(out, in + anchor, i - anchor);
+		snappy_copy(out, i - cand, len);
+		i += len;
+		anchor = i;
+	}
+	snappy_literal(out, in + anchor, n - anchor);
+}
+
+/**
+ * @returns false unless in is a well formed snappy block
+ */
+bool snappy_decompress(const uint8_t *in, size_t n, vector<uint8_t> &out) {
+	const uint8_t *p = in;
+	const uint8_t *end = in + n;
+	uint64_t outlen = 0;
+	for (int shift = 0; ; shift += 7) {
+		if (p >= end || shift > 28) {
+			return false;
+		}
+		outlen |= (uint64_t) (*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			break;
+		}
+	}
+	out.clear();
+	out.reserve(outlen);
+	while (p < end) {
+		uint8_t tag = *p++;
+		size_t len;
+		size_t offset;
+		switch (tag & 3) {
+		case 0:
+			len = tag >> 2;
+			if (len >= 60) {
+				int nbytes = len - 59;
+				if (end - p < nbytes) {
+					return false;
+				}
+				len = 0;
+				for (int b = 0; b < nbytes; ++b) {
+					len |= (size_t) p[b] << (8 * b);
+				}
+				p += nbytes;
+			}
+			++len;
+			if ((size_t) (end - p) < len) {
+				return false;
+			}
+			out.insert(out.end(), p, p + len);
+			p += len;
+			continue;
+		case 1:
+			if (p >= end) {
+				return false;
+			}
+			len = 4 + ((tag >> 2) & 7);
+			offset = ((size_t) (tag >> 5) << 8) | *p++;
+			break;
+		case 2:
+			if (end - p < 2) {
+				return false;
+			}
+			len = (tag >> 2) + 1;
+			offset = p[0] | (p[1] << 8);
+			p += 2;
+			break;
+		default:
+			if (end - p < 4) {
+				return false;
+			}
+			len = (tag >> 2) + 1;
+			offset = p[0] | (p[1] << 8) | (p[2] << 16) | ((size_t) p[3] << 24);
+			p += 4;
+			break;
+		}
+		if (0 == offset || offset > out.size()) {
+			return false;
+		}
+		size_t from = out.size() - offset;
+		for (size_t k = 0; k < len; ++k) {
+			out.push_back(out[from + k]);
+		}
+	}
+	return out.size() == outlen;
+}
+
+#endif /* SNAPPY_HPP_ */
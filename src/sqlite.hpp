@@ -9,6 +9,8 @@
 
 #include "../inc/sqlite3.h"
 #include "data.hpp"
+#include "sink.hpp"
+#include "sqlitevfs.hpp"
 
 using namespace std;
 
@@ -26,22 +28,95 @@ int check_exec(sqlite3* db, const char *sql) {
 	return 0;
 }
 
+/**
+ * Page size, table layout and pragmas of a sqlite db. The defaults are the
+ *  fixed setup every db used to get.
+ */
+struct SqliteConfig {
+	//0 keeps sqlite's default
+	int page_size;
+	bool without_rowid;
+	string journal_mode;
+	//0 keeps sqlite's default; negative is KiB, as in PRAGMA cache_size
+	long cache_size;
+	long mmap_size;
+	//load groups whose timestamps strictly increase without conflict
+	// checks, creating indexes after the rows
+	bool presorted;
+	//index every value column
+	bool value_index;
+	//VFS to open the db with, empty for the default; "zpage" compresses pages
+	string vfs;
+
+	SqliteConfig() : page_size(0), without_rowid(false), journal_mode("MEMORY"), cache_size(0), mmap_size(0),
+		presorted(false), value_index(false) {}
+
+	/**
+	 * @returns false if the linked sqlite can't build this layout
+	 *  (WITHOUT ROWID needs 3.8.2)
+	 */
+	bool supported() const {
+		return !without_rowid || sqlite3_libversion_number() >= 3008002;
+	}
+
+	string describe() const {
+		stringstream ss;
+		ss << page_size << "\t" << (without_rowid ? "without_rowid" : "rowid") << "\t" << journal_mode
+				<< "\t" << cache_size << "\t" << mmap_size;
+		return ss.str();
+	}
+};
+
+/**
+ * @returns the config given by --page_size, --without_rowid=1, --journal,
+ *  --cache_size, --mmap_size, --presorted=1, --value_index=1 and --vfs
+ */
+SqliteConfig sqlite_config() {
+	SqliteConfig config;
+	config.page_size = opt_int("page_size", 0);
+	config.without_rowid = opt_int("without_rowid", 0) != 0;
+	config.journal_mode = opt_str("journal", "MEMORY");
+	config.cache_size = opt_int("cache_size", 0);
+	config.mmap_size = opt_int("mmap_size", 0);
+	config.presorted = opt_int("presorted", 0) != 0;
+	config.value_index = opt_int("value_index", 0) != 0;
+	config.vfs = opt_str("vfs", "");
+	return config;
+}
+
 /**
  * Open a new sqlite db at the given file
  */
-sqlite3* new_sqlite_db(const char *output) {
+sqlite3* new_sqlite_db(const char *output, const SqliteConfig &config = SqliteConfig()) {
 	sqlite3 *db;
-	int rc = sqlite3_open(output, &db);
+	if (config.vfs == "zpage" && !zpage_register()) {
+		cerr << "couldn't register the zpage vfs" << endl;
+		return NULL;
+	}
+	int rc = sqlite3_open_v2(output, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+			config.vfs.empty() ? NULL : config.vfs.c_str());
 	if (rc) {
 		cerr << "couldn't open db" << sqlite3_errmsg(db) << endl;
 		sqlite3_close(db);
 		return NULL;
 	}
 
-	check_exec(db, "PRAGMA synchronous=OFF");
-	check_exec(db, "PRAGMA count_changes=OFF");
-	check_exec(db, "PRAGMA journal_mode=MEMORY");
-	check_exec(db, "PRAGMA temp_store=MEMORY");
+	stringstream pragmas;
+	//page size has to be set before the first table (and WAL)
+	if (config.page_size) {
+		pragmas << "PRAGMA page_size=" << config.page_size << ";";
+	}
+	pragmas << "PRAGMA synchronous=OFF;";
+	pragmas << "PRAGMA count_changes=OFF;";
+	pragmas << "PRAGMA journal_mode=" << config.journal_mode << ";";
+	pragmas << "PRAGMA temp_store=MEMORY;";
+	if (config.cache_size) {
+		pragmas << "PRAGMA cache_size=" << config.cache_size << ";";
+	}
+	if (config.mmap_size) {
+		pragmas << "PRAGMA mmap_size=" << config.mmap_size << ";";
+	}
+	check_exec(db, pragmas.str().c_str());
 
 	return db;
 }
@@ -125,95 +200,106 @@ void insert_sqlite(Data data, int twidth, int vwidth, const char* output) {
 }
 
 /**
- * @brief Insert schemaed data
- * @param data source
- * @param twidth timestamp width
- * @param vwidth value width
- * @param output sqlite file location to write
+ * Inserts each merge group as table t<tsname>, one column per value stream,
+ *  in one transaction per group. The time column is the rowid, so rows in
+ *  time order are appended to the table's b-tree. With config.presorted,
+ *  groups verified to be strictly increasing skip the conflict clause and
+ *  get their value indexes after their rows.
  */
-void insert_sqlite_multi(DataMulti data, int twidth, int vwidth, const char* output) {
-	sqlite3 *db = new_sqlite_db(output);
+class SqliteSink : public GroupSink {
+private:
+	SqliteConfig config;
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	vector<int> lastbound;
+	vector<bool> bound;
+	bool failed;
+	bool bulk;
+	vector<string> indexsql;
+
+public:
+	SqliteSink(const char *output, const SqliteConfig &_config = sqlite_config()) :
+		config(_config), db(new_sqlite_db(output, config)), stmt(NULL), failed(false), bulk(false) {}
+
+	~SqliteSink() {
+		sqlite3_close(db);
+	}
 
-	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
-		long ninserts = 0;
+	const char* name() const {
+		return "sqlite";
+	}
 
+	void begin_group(int groupdx, const string &key, const GroupReader &group) {
 		check_exec(db, "BEGIN TRANSACTION");
 
-		timeit(true);
-
-		//grab the timestamp stream
-		string tsloc = data.get_name((*it).first, TS);
-		ifstream ts(tsloc.c_str(), ios::binary | ios::in);
-		vector<ifstream*> vs((*it).second.size());
+		//no duplicate times to ignore if they strictly increase
+		bulk = config.presorted && group.strictly_increasing();
+		if (config.presorted && !bulk) {
+			cerr << group.tsname << " is not strictly increasing, loading with conflict checks" << endl;
+		}
 
 		//build the create table and insert statements
 		//  for the time stream and value streams
 		stringstream createsql;
-		createsql << "create table t" << (*it).first;
-		createsql << "(time integer primary key on conflict ignore";
+		createsql << "create table t" << key;
+		createsql << (bulk ? "(time integer primary key" : "(time integer primary key on conflict ignore");
 
-		cerr << "tsloc was" << tsloc << endl;
+		cerr << "tsloc was" << group.tsname << endl;
 
 		stringstream isql;
-		isql << "insert into t" << (*it).first << " VALUES(?1";
-
-		int dx = 0;
-		for (set<string>::const_iterator sit = (*it).second.begin(); sit != (*it).second.end(); ++sit) {
-			string vloc = data.get_name(*sit, VS);
-			vs[dx] = new ifstream(vloc.c_str(), ios::binary | ios::in);
-			if (!vs[dx]->good()) {
-				cerr << "Missing value stream: " << vloc << endl;
-			}
-			createsql << ", " << *sit << " integer";
+		isql << "insert into t" << key << " VALUES(?1";
+
+		for (unsigned dx = 0; dx < group.columns.size(); ++dx) {
+			createsql << ", " << group.columns[dx] << " integer";
 
 			isql << ", ?";
 			isql << (dx+2);
-
-			++dx;
 		}
 
 		createsql << ")";
+		if (config.without_rowid) {
+			createsql << " without rowid";
+		}
 		isql << ")";
 
 		//create the table!
 		check_exec(db, createsql.str().c_str());
 		cerr << "created table: " << createsql.str() << endl;
 
-		char tbuf[twidth];
-		char vbufs[vs.size()][vwidth];
+		indexsql.clear();
+		for (unsigned dx = 0; config.value_index && dx < group.columns.size(); ++dx) {
+			stringstream ix;
+			ix << "create index i" << key << "_" << dx << " on t" << key << "(" << group.columns[dx] << ")";
+			indexsql.push_back(ix.str());
+			if (!bulk) {
+				check_exec(db, ix.str().c_str());
+			}
+		}
 
 		//prep the insert statement.
 		string isqlstr = isql.str();
-		char* cstr = new char[isqlstr.length()+1];
-		strcpy(cstr, isqlstr.c_str());
-		sqlite3_stmt* stmt;
-		sqlite3_prepare_v2(db, cstr, -1, &stmt, NULL);
+		sqlite3_prepare_v2(db, isqlstr.c_str(), -1, &stmt, NULL);
 
-		cerr << "inserting: " << cstr << endl;
+		cerr << "inserting: " << isqlstr << endl;
 
-		if (!ts.good()) {
-			cerr << "could not find timestamp file " << tsloc << endl;
-			break;
-		}
-
-		//how many value streams couldn't we insert?
-		unsigned n_vstream_failures = 0;
-
-		while (ts.good()) {
-			ts.read(tbuf, twidth);
-			sqlite3_bind_int(stmt, 1, *((int*) tbuf));
+		lastbound.assign(group.columns.size(), 0);
+		bound.assign(group.columns.size(), false);
+		failed = false;
+	}
 
-			//grab a value from each value stream and insert
-			//	(hope that the ifstreams will be buffered)
-			for (unsigned i = 0; i < vs.size(); ++i) {
-				if (!vs[i]->good()) {
-					++n_vstream_failures;
-					//XXX: do something better about missing value stream entries?
-					// for now insert zero
-					sqlite3_bind_int(stmt, i+2, 0);
-				} else {
-					vs[i]->read(vbufs[i], vwidth);
-					sqlite3_bind_int(stmt, i+2, *((int*) vbufs[i]));
+	void write_block(const GroupBlock &blk) {
+		for (size_t r = 0; r < blk.nrows && !failed; ++r) {
+			sqlite3_bind_int(stmt, 1, blk.ts[r]);
+
+			//one value from each value stream; missing values are zero
+			for (unsigned i = 0; i < blk.vals.size(); ++i) {
+				int v = blk.vals[i][r];
+				//sqlite3_reset keeps bindings, so repeats (idle zero runs,
+				// mostly) don't need rebinding
+				if (!bound[i] || v != lastbound[i]) {
+					sqlite3_bind_int(stmt, i+2, v);
+					lastbound[i] = v;
+					bound[i] = true;
 				}
 			}
 
@@ -222,30 +308,498 @@ void insert_sqlite_multi(DataMulti data, int twidth, int vwidth, const char* out
 				cerr << "insert failed. Error was: ";
 				cerr << sqlite3_errmsg(db) << endl;
 				cerr << "Moving to next table." << endl;
-				break;
-			} else {
-				++ninserts;
+				failed = true;
 			}
 
 			sqlite3_reset(stmt);
 		}
+	}
 
-		if (0 != n_vstream_failures) {
-			cerr << "some value streams were incomplete or missing: count="
-					<< n_vstream_failures << endl;
+	void end_group() {
+		sqlite3_finalize(stmt);
+		stmt = NULL;
+		for (unsigned i = 0; bulk && i < indexsql.size(); ++i) {
+			check_exec(db, indexsql[i].c_str());
 		}
-
 		check_exec(db, "COMMIT TRANSACTION");
+	}
+};
 
-		timeit(false, ninserts);
+/**
+ * @brief Insert schemaed data
+ * @param data source
+ * @param twidth timestamp width
+ * @param vwidth value width
+ * @param output sqlite file location to write
+ */
+void insert_sqlite_multi(DataMulti data, int twidth, int vwidth, const char* output) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "sqlite multi only supports 4 byte samples" << endl;
+		return;
+	}
 
+	SqliteSink sqlite(output);
+	vector<GroupSink*> sinks(1, &sqlite);
+	run_sinks(data, sinks);
+}
 
-		for (unsigned i = 0; i < vs.size(); ++i) {
-			vs[i]->close();
-			delete vs[i];
+/**
+ * @brief Remove a db file and its journals
+ */
+void remove_sqlite_files(const string &db) {
+	unlink(db.c_str());
+	unlink((db + "-wal").c_str());
+	unlink((db + "-shm").c_str());
+	unlink((db + "-journal").c_str());
+}
+
+/**
+ * Loads one database per shard, each on its own thread and connection
+ */
+struct SqliteShardLoader {
+	DataMulti *data;
+	//(1-based group index, group) per shard
+	vector<vector<pair<int, map<string, set<string> >::const_iterator> > > shards;
+	vector<string> dbnames;
+	SqliteConfig config;
+	vector<long> nrows;
+
+	void operator()(size_t s) {
+		remove_sqlite_files(dbnames[s]);
+		SqliteSink sqlite(dbnames[s].c_str(), config);
+		size_t blockrows = group_block_rows();
+		for (unsigned i = 0; i < shards[s].size(); ++i) {
+			GroupReader *group = open_group(*data, shards[s][i].second);
+			if (!group->ok()) {
+				cerr << "could not find timestamp file " << group->tsname << endl;
+				delete group;
+				continue;
+			}
+			sqlite.begin_group(shards[s][i].first, (*shards[s][i].second).first, *group);
+			GroupBlock blk;
+			while (group->next(blk, blockrows)) {
+				sqlite.write_block(blk);
+			}
+			sqlite.end_group();
+			nrows[s] += group->nrows;
+			delete group;
 		}
-		ts.close();
+		sqlite.finish();
+	}
+};
+
+/**
+ * @returns (name, sql) of every schema object of the given type in the
+ *  schema (e.g. "main", "shard"), skipping sqlite's own and implicit ones
+ */
+vector<pair<string, string> > sqlite_schema_sql(sqlite3 *db, const string &schema, const char *type) {
+	vector<pair<string, string> > objs;
+	string sql = "select name, sql from " + schema + ".sqlite_master where type=?1"
+			" and sql is not null and name not like 'sqlite_%' order by name";
+	sqlite3_stmt *stmt;
+	sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+	sqlite3_bind_text(stmt, 1, type, -1, SQLITE_STATIC);
+	while (SQLITE_ROW == sqlite3_step(stmt)) {
+		objs.push_back(make_pair(string((const char*) sqlite3_column_text(stmt, 0)),
+				string((const char*) sqlite3_column_text(stmt, 1))));
+	}
+	sqlite3_finalize(stmt);
+	return objs;
+}
+
+/**
+ * @brief Copy every table of each shard db into output, keeping the
+ *  shards' table definitions. Indexes are recreated after their table's
+ *  rows are in, which is cheaper than maintaining them during the copy.
+ *  Each shard is copied in one transaction; on any failure it is rolled
+ *  back and output removed.
+ * @returns false if any copy failed
+ */
+bool merge_sqlite_shards(const vector<string> &dbnames, const char *output, const SqliteConfig &config) {
+	remove_sqlite_files(output);
+	sqlite3 *db = new_sqlite_db(output, config);
+	if (NULL == db) {
+		remove_sqlite_files(output);
+		return false;
+	}
+	bool ok = true;
+	for (unsigned s = 0; s < dbnames.size() && ok; ++s) {
+		//attach takes the file name as an expression
+		char *attach = sqlite3_mprintf("ATTACH DATABASE %Q AS shard", dbnames[s].c_str());
+		ok = 0 == check_exec(db, attach);
+		sqlite3_free(attach);
+		if (!ok) {
+			break;
+		}
+
+		vector<pair<string, string> > tables = sqlite_schema_sql(db, "shard", "table");
+		vector<pair<string, string> > indexes = sqlite_schema_sql(db, "shard", "index");
+
+		ok = 0 == check_exec(db, "BEGIN TRANSACTION");
+		for (unsigned t = 0; t < tables.size() && ok; ++t) {
+			string copy = "insert into main." + tables[t].first + " select * from shard." + tables[t].first;
+			ok = 0 == check_exec(db, tables[t].second.c_str()) && 0 == check_exec(db, copy.c_str());
+		}
+		for (unsigned i = 0; i < indexes.size() && ok; ++i) {
+			ok = 0 == check_exec(db, indexes[i].second.c_str());
+		}
+		if (ok) {
+			ok = 0 == check_exec(db, "COMMIT TRANSACTION");
+		}
+		if (!ok) {
+			sqlite3_exec(db, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+		}
+		check_exec(db, "DETACH DATABASE shard");
+	}
+	sqlite3_close(db);
+	if (!ok) {
+		remove_sqlite_files(output);
+	}
+	return ok;
+}
+
+/**
+ * @brief Load merge groups into --shards (default: threads) databases
+ *  output-K.db in parallel, groups assigned by a hash of their timestamp
+ *  stream name. With --merge=1 the shards are then copied into output and
+ *  removed (kept with --keep=1).
+ */
+void insert_sqlite_sharded(DataMulti data, int twidth, int vwidth, const char *output) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "sqlite multi only supports 4 byte samples" << endl;
+		return;
+	}
+
+	unsigned nthreads = default_threads();
+	size_t nshards = max(1L, opt_int("shards", nthreads));
+
+	SqliteShardLoader loader;
+	loader.data = &data;
+	loader.config = sqlite_config();
+	loader.shards.resize(nshards);
+	loader.nrows.assign(nshards, 0);
+	int groupdx = 0;
+	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
+		loader.shards[shard_hash((*it).first) % nshards].push_back(make_pair(++groupdx, it));
 	}
+	for (size_t s = 0; s < nshards; ++s) {
+		stringstream name;
+		name << output << "-" << s << ".db";
+		loader.dbnames.push_back(name.str());
+	}
+
+	double start = wall_seconds();
+	parallel_for(nshards, loader, nthreads);
+	double load = wall_seconds() - start;
+	long nrows = 0;
+	for (size_t s = 0; s < nshards; ++s) {
+		nrows += loader.nrows[s];
+	}
+	cerr << nrows << " rows into " << nshards << " shards in " << load << "s ("
+			<< (load > 0 ? nrows / load : 0) << " rows/s)" << endl;
+
+	if (opt_int("merge", 0)) {
+		start = wall_seconds();
+		bool ok = merge_sqlite_shards(loader.dbnames, output, loader.config);
+		cerr << (ok ? "merged into " : "merge failed for ") << output << " in " << wall_seconds() - start << "s" << endl;
+		if (ok && !opt_int("keep", 0)) {
+			for (size_t s = 0; s < nshards; ++s) {
+				remove_sqlite_files(loader.dbnames[s]);
+			}
+		}
+	}
+}
+
+/**
+ * A loaded table, as seen by the range query benchmark
+ */
+struct SqliteTable {
+	string name;
+	string column;
+	int64_t tmin;
+	int64_t tmax;
+	long nrows;
+};
+
+/**
+ * @returns every table of db with its time range and first value column
+ */
+vector<SqliteTable> sqlite_tables(sqlite3 *db) {
+	vector<SqliteTable> tables;
+	sqlite3_stmt *stmt;
+	sqlite3_prepare_v2(db, "select name from sqlite_master where type='table'", -1, &stmt, NULL);
+	while (SQLITE_ROW == sqlite3_step(stmt)) {
+		SqliteTable t;
+		t.name = (const char*) sqlite3_column_text(stmt, 0);
+		tables.push_back(t);
+	}
+	sqlite3_finalize(stmt);
+
+	for (unsigned i = 0; i < tables.size(); ++i) {
+		SqliteTable &t = tables[i];
+		string sql = "select min(time), max(time), count(*) from " + t.name;
+		sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+		sqlite3_step(stmt);
+		t.tmin = sqlite3_column_int64(stmt, 0);
+		t.tmax = sqlite3_column_int64(stmt, 1);
+		t.nrows = sqlite3_column_int64(stmt, 2);
+		sqlite3_finalize(stmt);
+
+		sql = "select * from " + t.name + " limit 0";
+		sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+		t.column = sqlite3_column_count(stmt) > 1 ? sqlite3_column_name(stmt, 1) : "time";
+		sqlite3_finalize(stmt);
+	}
+	return tables;
+}
+
+/**
+ * @brief Run nqueries count/sum queries over random width second ranges of
+ *  random tables (the same ranges for every db with the same tables)
+ * @param rowsread set to the rows the queries covered
+ * @returns each query's latency in seconds, sorted
+ */
+vector<double> time_sqlite_ranges(sqlite3 *db, const vector<SqliteTable> &tables, long nqueries,
+		int64_t width, long &rowsread) {
+	vector<double> lat;
+	rowsread = 0;
+	if (tables.empty()) {
+		return lat;
+	}
+	vector<sqlite3_stmt*> stmts(tables.size());
+	for (unsigned i = 0; i < tables.size(); ++i) {
+		string sql = "select count(*), sum(" + tables[i].column + ") from " + tables[i].name +
+				" where time between ?1 and ?2";
+		sqlite3_prepare_v2(db, sql.c_str(), -1, &stmts[i], NULL);
+	}
+
+	srand(1);
+	for (long q = 0; q < nqueries; ++q) {
+		unsigned i = rand() % tables.size();
+		int64_t span = max((int64_t) 1, tables[i].tmax - tables[i].tmin - width + 1);
+		int64_t t0 = tables[i].tmin + rand() % span;
+		double start = wall_seconds();
+		sqlite3_bind_int64(stmts[i], 1, t0);
+		sqlite3_bind_int64(stmts[i], 2, t0 + width - 1);
+		if (SQLITE_ROW == sqlite3_step(stmts[i])) {
+			rowsread += sqlite3_column_int64(stmts[i], 0);
+		}
+		sqlite3_reset(stmts[i]);
+		lat.push_back(wall_seconds() - start);
+	}
+
+	for (unsigned i = 0; i < stmts.size(); ++i) {
+		sqlite3_finalize(stmts[i]);
+	}
+	sort(lat.begin(), lat.end());
+	return lat;
+}
+
+/**
+ * @brief Load data once per sqlite layout in the cross product of
+ *  --page_sizes, --layouts (rowid, without_rowid), --journals, --cache_sizes
+ *  and --mmap_sizes, then time --queries range queries of --query_width
+ *  seconds against each, reporting one tab separated line per layout.
+ *  Each db is output-N.db, removed afterwards unless --keep=1.
+ */
+void print_sqlite_matrix(DataMulti data, const char *output, ostream &out) {
+	vector<string> pages = opt_list("page_sizes", "1024,4096,16384");
+	vector<string> layouts = opt_list("layouts", "rowid,without_rowid");
+	vector<string> journals = opt_list("journals", "OFF,WAL");
+	vector<string> caches = opt_list("cache_sizes", "-2000");
+	vector<string> mmaps = opt_list("mmap_sizes", "0,268435456");
+	long nqueries = opt_int("queries", 200);
+	int64_t width = opt_int("query_width", 3600);
+
+	vector<SqliteConfig> configs;
+	for (unsigned p = 0; p < pages.size(); ++p) {
+		for (unsigned l = 0; l < layouts.size(); ++l) {
+			for (unsigned j = 0; j < journals.size(); ++j) {
+				for (unsigned c = 0; c < caches.size(); ++c) {
+					for (unsigned m = 0; m < mmaps.size(); ++m) {
+						SqliteConfig config;
+						config.page_size = atoi(pages[p].c_str());
+						config.without_rowid = layouts[l] == "without_rowid";
+						config.journal_mode = journals[j];
+						config.cache_size = atol(caches[c].c_str());
+						config.mmap_size = atol(mmaps[m].c_str());
+						configs.push_back(config);
+					}
+				}
+			}
+		}
+	}
+
+	out << "sqlite " << sqlite3_libversion() << ", " << nqueries << " queries of " << width << "s" << endl;
+	out << "page_size\tlayout\tjournal\tcache_size\tmmap_size\tdb_bytes\tbytes/row\tload_rows/s"
+			<< "\tq_p50_ms\tq_p99_ms\tq_rows/s" << endl;
+	for (unsigned i = 0; i < configs.size(); ++i) {
+		const SqliteConfig &config = configs[i];
+		if (!config.supported()) {
+			out << config.describe() << "\tunsupported by this sqlite" << endl;
+			continue;
+		}
+		stringstream name;
+		name << output << "-" << (i + 1) << ".db";
+		string dbname = name.str();
+		remove_sqlite_files(dbname);
+
+		double start = wall_seconds();
+		{
+			SqliteSink sqlite(dbname.c_str(), config);
+			vector<GroupSink*> sinks(1, &sqlite);
+			run_sinks(data, sinks);
+		}
+		double load = wall_seconds() - start;
+		off_t bytes = file_bytes(dbname) + file_bytes(dbname + "-wal");
+
+		sqlite3 *db = new_sqlite_db(dbname.c_str(), config);
+		vector<SqliteTable> tables = sqlite_tables(db);
+		long nrows = 0;
+		for (unsigned t = 0; t < tables.size(); ++t) {
+			nrows += tables[t].nrows;
+		}
+		long rowsread;
+		start = wall_seconds();
+		vector<double> lat = time_sqlite_ranges(db, tables, nqueries, width, rowsread);
+		double qsecs = wall_seconds() - start;
+		sqlite3_close(db);
+
+		out << config.describe() << "\t" << bytes << "\t" << (nrows ? (double) bytes / nrows : 0)
+				<< "\t" << (load > 0 ? nrows / load : 0);
+		if (lat.empty()) {
+			out << "\t-\t-\t-" << endl;
+		} else {
+			out << "\t" << lat[lat.size() / 2] * 1e3 << "\t" << lat[min(lat.size() - 1, lat.size() * 99 / 100)] * 1e3
+					<< "\t" << (qsecs > 0 ? rowsread / qsecs : 0) << endl;
+		}
+
+		if (!opt_int("keep", 0)) {
+			remove_sqlite_files(dbname);
+		}
+	}
+}
+
+/**
+ * @brief Load data with conflict checks, then presorted, into
+ *  output-checked.db and output-presorted.db, and report both load rates
+ *  and the speedup. The dbs are removed afterwards unless --keep=1.
+ */
+void print_sqlite_bulk_bench(DataMulti data, const char *output, ostream &out) {
+	const char *modes[] = {"checked", "presorted"};
+	double secs[2];
+	long nrows[2];
+	out << "mode\tload_s\trows/s\tdb_bytes" << endl;
+	for (int m = 0; m < 2; ++m) {
+		SqliteConfig config = sqlite_config();
+		config.presorted = m == 1;
+		string dbname = string(output) + "-" + modes[m] + ".db";
+		remove_sqlite_files(dbname);
+
+		double start = wall_seconds();
+		{
+			SqliteSink sqlite(dbname.c_str(), config);
+			vector<GroupSink*> sinks(1, &sqlite);
+			run_sinks(data, sinks);
+		}
+		secs[m] = wall_seconds() - start;
+
+		sqlite3 *db = new_sqlite_db(dbname.c_str(), config);
+		vector<SqliteTable> tables = sqlite_tables(db);
+		sqlite3_close(db);
+		nrows[m] = 0;
+		for (unsigned t = 0; t < tables.size(); ++t) {
+			nrows[m] += tables[t].nrows;
+		}
+		out << modes[m] << "\t" << secs[m] << "\t" << (secs[m] > 0 ? nrows[m] / secs[m] : 0) << "\t"
+				<< file_bytes(dbname) << endl;
+
+		if (!opt_int("keep", 0)) {
+			remove_sqlite_files(dbname);
+		}
+	}
+	if (nrows[0] != nrows[1]) {
+		out << "row counts differ: " << nrows[0] << " vs " << nrows[1] << endl;
+	}
+	out << "speedup " << (secs[1] > 0 ? secs[0] / secs[1] : 0) << "x" << endl;
+}
+
+/**
+ * @returns sum over every table of every column, to compare db contents
+ */
+uint64_t sqlite_checksum(sqlite3 *db, const vector<SqliteTable> &tables) {
+	uint64_t sum = 0;
+	for (unsigned t = 0; t < tables.size(); ++t) {
+		string sql = "select * from " + tables[t].name;
+		sqlite3_stmt *stmt;
+		sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+		int ncols = sqlite3_column_count(stmt);
+		while (SQLITE_ROW == sqlite3_step(stmt)) {
+			for (int c = 0; c < ncols; ++c) {
+				sum = sum * 31 + (uint64_t) sqlite3_column_int64(stmt, c);
+			}
+		}
+		sqlite3_finalize(stmt);
+	}
+	return sum;
+}
+
+/**
+ * @brief Load data into output.db as usual and into output.zdb through the
+ *  zpage vfs (--zpage_level), then report both sizes, load rates and range
+ *  query latencies, and check the contents match. The dbs are removed
+ *  afterwards unless --keep=1.
+ */
+void print_sqlite_zpage(DataMulti data, const char *output, ostream &out) {
+	const char *exts[] = {".db", ".zdb"};
+	off_t bytes[2];
+	uint64_t sums[2];
+	out << "vfs\tdb_bytes\tbytes/row\tload_rows/s\tq_p50_ms\tq_p99_ms" << endl;
+	for (int z = 0; z < 2; ++z) {
+		SqliteConfig config = sqlite_config();
+		config.vfs = z ? "zpage" : "";
+		string dbname = string(output) + exts[z];
+		remove_sqlite_files(dbname);
+
+		double start = wall_seconds();
+		{
+			SqliteSink sqlite(dbname.c_str(), config);
+			vector<GroupSink*> sinks(1, &sqlite);
+			run_sinks(data, sinks);
+		}
+		double load = wall_seconds() - start;
+		bytes[z] = file_bytes(dbname);
+
+		sqlite3 *db = new_sqlite_db(dbname.c_str(), config);
+		vector<SqliteTable> tables = sqlite_tables(db);
+		long nrows = 0;
+		for (unsigned t = 0; t < tables.size(); ++t) {
+			nrows += tables[t].nrows;
+		}
+		long rowsread;
+		vector<double> lat = time_sqlite_ranges(db, tables, opt_int("queries", 200),
+				opt_int("query_width", 3600), rowsread);
+		sums[z] = sqlite_checksum(db, tables);
+		sqlite3_close(db);
+
+		out << (z ? "zpage" : "default") << "\t" << bytes[z] << "\t" << (nrows ? (double) bytes[z] / nrows : 0)
+				<< "\t" << (load > 0 ? nrows / load : 0);
+		if (lat.empty()) {
+			out << "\t-\t-" << endl;
+		} else {
+			out << "\t" << lat[lat.size() / 2] * 1e3 << "\t"
+					<< lat[min(lat.size() - 1, lat.size() * 99 / 100)] * 1e3 << endl;
+		}
+
+		if (!opt_int("keep", 0)) {
+			remove_sqlite_files(dbname);
+		}
+	}
+
+	const ZPageStats &st = zpage_last_stats();
+	out << "zpage: " << st.pages << " pages, " << st.logical << " bytes uncompressed, " << st.live
+			<< " compressed, ratio " << (bytes[1] > 0 ? (double) bytes[0] / bytes[1] : 0) << endl;
+	out << "contents " << (sums[0] == sums[1] ? "match" : "DIFFER") << endl;
 }
 
 void test_insert_sqlite_multi() {
@@ -254,4 +808,70 @@ void test_insert_sqlite_multi() {
 	insert_sqlite_multi(data, 4, 4, "out.db");
 }
 
+void test_insert_sqlite_sharded() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	options()["shards"] = "2";
+	options()["merge"] = "1";
+	options()["keep"] = "1";
+	options()["value_index"] = "1";
+	insert_sqlite_sharded(data, 4, 4, "out-sharded.db");
+
+	//the merged db must hold every shard's rows and indexes
+	map<string, long> rows;
+	vector<pair<string, string> > indexes;
+	for (int s = 0; s < 2; ++s) {
+		stringstream name;
+		name << "out-sharded.db-" << s << ".db";
+		sqlite3 *db;
+		sqlite3_open_v2(name.str().c_str(), &db, SQLITE_OPEN_READONLY, NULL);
+		vector<SqliteTable> tables = sqlite_tables(db);
+		for (unsigned t = 0; t < tables.size(); ++t) {
+			rows[tables[t].name] = tables[t].nrows;
+		}
+		vector<pair<string, string> > ix = sqlite_schema_sql(db, "main", "index");
+		indexes.insert(indexes.end(), ix.begin(), ix.end());
+		sqlite3_close(db);
+		remove_sqlite_files(name.str());
+	}
+	sort(indexes.begin(), indexes.end());
+
+	sqlite3 *db;
+	sqlite3_open_v2("out-sharded.db", &db, SQLITE_OPEN_READONLY, NULL);
+	vector<SqliteTable> tables = sqlite_tables(db);
+	bool ok = tables.size() == rows.size() && sqlite_schema_sql(db, "main", "index") == indexes;
+	for (unsigned t = 0; t < tables.size(); ++t) {
+		ok = ok && rows.count(tables[t].name) && rows[tables[t].name] == tables[t].nrows;
+	}
+	sqlite3_close(db);
+	remove_sqlite_files("out-sharded.db");
+	cerr << "merged " << tables.size() << " tables, " << indexes.size() << " indexes: "
+			<< (ok ? "match" : "MISMATCH") << endl;
+
+	options().erase("shards");
+	options().erase("merge");
+	options().erase("keep");
+	options().erase("value_index");
+}
+
+void test_sqlite_bulk_bench() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	print_sqlite_bulk_bench(data, "out-bulk", cerr);
+}
+
+void test_sqlite_zpage() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	print_sqlite_zpage(data, "out-zpage", cerr);
+}
+
+void test_sqlite_matrix() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	options()["page_sizes"] = "4096";
+	options()["mmap_sizes"] = "0";
+	print_sqlite_matrix(data, "out-matrix", cerr);
+}
+
 #endif /* SQLITE_HPP_ */
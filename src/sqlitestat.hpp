@@ -0,0 +1,448 @@
+/*
+ * sqlitestat.hpp
+ * Where the bytes of a loaded sqlite db go: payload, overhead and unused
+ *  space per b-tree, from the dbstat virtual table or a walk of the pages
+ */
+
+#ifndef SQLITESTAT_HPP_
+#define SQLITESTAT_HPP_
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+
+#include "sqlite.hpp"
+
+using namespace std;
+
+/**
+ * Space used by one table or index b-tree, overflow pages included.
+ *  Overhead is what is neither payload nor unused: page and cell headers,
+ *  cell pointers, child pointers and rowids of interior pages.
+ */
+struct SqliteBtreeStats {
+	string name;
+	//table the b-tree belongs to (itself for tables)
+	string table;
+	long pages;
+	long overflow_pages;
+	int depth;
+	//entries: the rows of a table, which index b-trees (and WITHOUT ROWID
+	// tables) also keep in interior cells
+	long cells;
+	int64_t bytes;
+	int64_t payload;
+	int64_t unused;
+
+	SqliteBtreeStats() : pages(0), overflow_pages(0), depth(0), cells(0), bytes(0), payload(0), unused(0) {}
+
+	int64_t overhead() const {
+		return bytes - payload - unused;
+	}
+
+	bool operator<(const SqliteBtreeStats &o) const {
+		return bytes > o.bytes;
+	}
+};
+
+/**
+ * @brief Fill stats (by b-tree name) from the dbstat virtual table
+ * @returns false if the linked sqlite was built without it
+ */
+bool sqlite_dbstat(sqlite3 *db, map<string, SqliteBtreeStats> &stats) {
+	//path is / for the root, /000/ for its first child, and so on; overflow
+	// pages get a +000000 suffix and don't count towards depth
+	const char *sql = "select name, count(*), sum(pagetype='overflow'),"
+			" max(case when pagetype!='overflow' then (length(path) - 1) / 4 + 1 end),"
+			" sum(case when pagetype='leaf' or (pagetype='internal' and payload > 0) then ncell else 0 end),"
+			" sum(pgsize), sum(payload), sum(unused) from dbstat group by name";
+	sqlite3_stmt *stmt;
+	if (SQLITE_OK != sqlite3_prepare_v2(db, sql, -1, &stmt, NULL)) {
+		return false;
+	}
+	while (SQLITE_ROW == sqlite3_step(stmt)) {
+		string name = (const char*) sqlite3_column_text(stmt, 0);
+		//3.33 renamed it
+		SqliteBtreeStats &s = stats[name == "sqlite_schema" ? "sqlite_master" : name];
+		s.pages = sqlite3_column_int64(stmt, 1);
+		s.overflow_pages = sqlite3_column_int64(stmt, 2);
+		s.depth = sqlite3_column_int(stmt, 3);
+		s.cells = sqlite3_column_int64(stmt, 4);
+		s.bytes = sqlite3_column_int64(stmt, 5);
+		s.payload = sqlite3_column_int64(stmt, 6);
+		s.unused = sqlite3_column_int64(stmt, 7);
+	}
+	sqlite3_finalize(stmt);
+	return true;
+}
+
+/**
+ * Reads the b-tree pages of the main db through its open file (so through
+ *  any vfs), accounting the same way dbstat does
+ */
+class SqlitePageWalker {
+private:
+	sqlite3_file *file;
+	uint32_t pagesize;
+	uint32_t usable;
+	vector<bool> seen;
+	vector<uint8_t> page;
+
+	static uint32_t get2(const uint8_t *p) {
+		return (p[0] << 8) | p[1];
+	}
+
+	static uint32_t get4(const uint8_t *p) {
+		return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+
+	static int varint(const uint8_t *p, uint64_t &v) {
+		v = 0;
+		for (int i = 0; i < 8; ++i) {
+			v = (v << 7) | (p[i] & 0x7f);
+			if (!(p[i] & 0x80)) {
+				return i + 1;
+			}
+		}
+		v = (v << 8) | p[8];
+		return 9;
+	}
+
+	/**
+	 * @returns bytes of a total byte payload kept on the b-tree page
+	 */
+	uint32_t local_payload(uint8_t type, uint64_t total) const {
+		uint32_t minlocal = (usable - 12) * 32 / 255 - 23;
+		uint32_t maxlocal = type == 0x0d ? usable - 35 : (usable - 12) * 64 / 255 - 23;
+		if (total <= maxlocal) {
+			return total;
+		}
+		uint32_t local = minlocal + (total - minlocal) % (usable - 4);
+		return local > maxlocal ? minlocal : local;
+	}
+
+	/**
+	 * @returns false if pg is out of range, already seen or unreadable
+	 */
+	bool read_page(uint32_t pg) {
+		if (pg < 1 || pg >= seen.size() || seen[pg]) {
+			return false;
+		}
+		seen[pg] = true;
+		return SQLITE_OK == file->pMethods->xRead(file, &page[0], pagesize, (sqlite3_int64) (pg - 1) * pagesize);
+	}
+
+	void walk_overflow(uint32_t pg, uint64_t left, SqliteBtreeStats &s) {
+		while (pg && left > 0 && read_page(pg)) {
+			uint32_t n = min(left, (uint64_t) (usable - 4));
+			++s.pages;
+			++s.overflow_pages;
+			s.bytes += pagesize;
+			s.payload += n;
+			s.unused += usable - 4 - n;
+			left -= n;
+			pg = get4(&page[0]);
+		}
+	}
+
+	void walk(uint32_t pg, int depth, SqliteBtreeStats &s) {
+		if (!read_page(pg)) {
+			return;
+		}
+		uint32_t hdr = 1 == pg ? 100 : 0;
+		uint8_t type = page[hdr];
+		bool interior = type == 0x02 || type == 0x05;
+		if (!interior && type != 0x0a && type != 0x0d) {
+			return;
+		}
+		uint32_t nhdr = hdr + (interior ? 12 : 8);
+		uint32_t ncell = get2(&page[hdr + 3]);
+		uint32_t content = get2(&page[hdr + 5]);
+		if (0 == content) {
+			content = 65536;
+		}
+
+		++s.pages;
+		s.bytes += pagesize;
+		s.depth = max(s.depth, depth);
+		s.unused += (int64_t) content - nhdr - 2 * ncell + page[hdr + 7];
+		//freeblocks are chained in increasing offset order
+		for (uint32_t fb = get2(&page[hdr + 1]), prev = 0; fb > prev && fb + 4 <= usable; prev = fb, fb = get2(&page[fb])) {
+			s.unused += get2(&page[fb + 2]);
+		}
+		if (type != 0x05) {
+			s.cells += ncell;
+		}
+
+		//children and overflow chains are read over this page: note them first
+		vector<uint32_t> children;
+		vector<pair<uint32_t, uint64_t> > overflows;
+		for (uint32_t i = 0; i < ncell && nhdr + 2 * i + 2 <= usable; ++i) {
+			uint32_t off = get2(&page[nhdr + 2 * i]);
+			if (off >= usable) {
+				continue;
+			}
+			if (interior) {
+				children.push_back(get4(&page[off]));
+				off += 4;
+			}
+			if (type == 0x05) {
+				continue;
+			}
+			uint64_t total;
+			off += varint(&page[off], total);
+			if (type == 0x0d) {
+				uint64_t rowid;
+				off += varint(&page[off], rowid);
+			}
+			uint32_t local = local_payload(type, total);
+			s.payload += local;
+			if (local < total && off + local + 4 <= usable) {
+				overflows.push_back(make_pair(get4(&page[off + local]), total - local));
+			}
+		}
+		if (interior) {
+			children.push_back(get4(&page[hdr + 8]));
+		}
+
+		for (unsigned i = 0; i < overflows.size(); ++i) {
+			walk_overflow(overflows[i].first, overflows[i].second, s);
+		}
+		for (unsigned i = 0; i < children.size(); ++i) {
+			walk(children[i], depth + 1, s);
+		}
+	}
+
+public:
+	SqlitePageWalker() : file(NULL), pagesize(0), usable(0) {}
+
+	/**
+	 * @brief Fill stats (by b-tree name) for every b-tree of db, which may
+	 *  be open read-only
+	 * @returns false if the db file can't be read, or if it has a WAL whose
+	 *  pages the file doesn't hold yet
+	 */
+	bool run(sqlite3 *db, map<string, SqliteBtreeStats> &stats) {
+		//the walk reads the db file, not the WAL, and checkpointing is a write
+		string wal = string(sqlite3_db_filename(db, "main")) + "-wal";
+		struct stat st;
+		if (0 == stat(wal.c_str(), &st) && st.st_size > 0) {
+			cerr << wal << " isn't checkpointed, the page walk would miss its pages" << endl;
+			return false;
+		}
+
+		sqlite3_stmt *stmt;
+		//a read transaction keeps the file still while it is walked
+		check_exec(db, "BEGIN");
+		sqlite3_prepare_v2(db, "select name, rootpage from sqlite_master where rootpage > 0", -1, &stmt, NULL);
+		vector<pair<string, uint32_t> > roots(1, make_pair(string("sqlite_master"), (uint32_t) 1));
+		while (SQLITE_ROW == sqlite3_step(stmt)) {
+			roots.push_back(make_pair(string((const char*) sqlite3_column_text(stmt, 0)),
+					(uint32_t) sqlite3_column_int64(stmt, 1)));
+		}
+		sqlite3_finalize(stmt);
+
+		sqlite3_prepare_v2(db, "PRAGMA page_size", -1, &stmt, NULL);
+		pagesize = SQLITE_ROW == sqlite3_step(stmt) ? sqlite3_column_int(stmt, 0) : 0;
+		sqlite3_finalize(stmt);
+		sqlite3_prepare_v2(db, "PRAGMA page_count", -1, &stmt, NULL);
+		long npages = SQLITE_ROW == sqlite3_step(stmt) ? sqlite3_column_int64(stmt, 0) : 0;
+		sqlite3_finalize(stmt);
+
+		bool ok = pagesize >= 512 && SQLITE_OK == sqlite3_file_control(db, "main", SQLITE_FCNTL_FILE_POINTER, &file)
+				&& file && file->pMethods;
+		if (ok) {
+			//slack past the page for varints of a cell cut short by corruption
+			page.assign(pagesize + 16, 0);
+			seen.assign(npages + 1, false);
+			//reserved bytes at the end of each page, from the db header
+			ok = SQLITE_OK == file->pMethods->xRead(file, &page[0], 100, 0);
+			usable = pagesize - page[20];
+		}
+		for (unsigned i = 0; ok && i < roots.size(); ++i) {
+			walk(roots[i].second, 1, stats[roots[i].first]);
+		}
+		check_exec(db, "COMMIT");
+		return ok;
+	}
+};
+
+/**
+ * @brief Open an existing db read-only, without any pragmas, so a report
+ *  leaves the file (and its journal mode) as it was
+ * @returns NULL if it doesn't exist or can't be opened
+ */
+sqlite3* open_sqlite_readonly(const char *path, const string &vfs) {
+	struct stat st;
+	if (0 != stat(path, &st)) {
+		cerr << "no db at " << path << endl;
+		return NULL;
+	}
+	if (vfs == "zpage" && !zpage_register()) {
+		cerr << "couldn't register the zpage vfs" << endl;
+		return NULL;
+	}
+	sqlite3 *db;
+	if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, vfs.empty() ? NULL : vfs.c_str())) {
+		cerr << "couldn't open " << path << ": " << sqlite3_errmsg(db) << endl;
+		sqlite3_close(db);
+		return NULL;
+	}
+	return db;
+}
+
+/**
+ * @brief Report where the bytes of the db at path go, one line per table
+ *  and index, biggest first: pages, b-tree depth, payload, overhead and
+ *  unused bytes, and each of those per sample (a value of a row) of the
+ *  table. Uses dbstat if the linked sqlite has it (the bundled one is built
+ *  with SQLITE_ENABLE_DBSTAT_VTAB), else walks the pages itself; --walk=1
+ *  forces the walk. Open with --vfs for zpage dbs. The db is opened
+ *  read-only and left as it was.
+ */
+void print_sqlite_storage(const char *path, ostream &out) {
+	sqlite3 *db = open_sqlite_readonly(path, opt_str("vfs", ""));
+	if (NULL == db) {
+		return;
+	}
+
+	map<string, SqliteBtreeStats> stats;
+	const char *method = "dbstat";
+	if (opt_int("walk", 0) || !sqlite_dbstat(db, stats)) {
+		method = "page walk";
+		stats.clear();
+		if (!SqlitePageWalker().run(db, stats)) {
+			cerr << "couldn't read the pages of " << path << endl;
+			sqlite3_close(db);
+			return;
+		}
+	}
+
+	//owning tables, and value columns per table to count samples
+	map<string, int64_t> samples;
+	sqlite3_stmt *stmt;
+	sqlite3_prepare_v2(db, "select name, tbl_name, type from sqlite_master where rootpage > 0", -1, &stmt, NULL);
+	while (SQLITE_ROW == sqlite3_step(stmt)) {
+		string name = (const char*) sqlite3_column_text(stmt, 0);
+		stats[name].table = (const char*) sqlite3_column_text(stmt, 1);
+		if (0 == strcmp("table", (const char*) sqlite3_column_text(stmt, 2))) {
+			samples[name] = 0;
+		}
+	}
+	sqlite3_finalize(stmt);
+	stats["sqlite_master"].table = "sqlite_master";
+	int64_t totalsamples = 0;
+	for (map<string, int64_t>::iterator it = samples.begin(); it != samples.end(); ++it) {
+		string sql = "select * from " + it->first + " limit 0";
+		sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+		int ncols = sqlite3_column_count(stmt);
+		sqlite3_finalize(stmt);
+		it->second = stats[it->first].cells * max(1, ncols - 1);
+		totalsamples += it->second;
+	}
+
+	sqlite3_prepare_v2(db, "PRAGMA freelist_count", -1, &stmt, NULL);
+	long freepages = SQLITE_ROW == sqlite3_step(stmt) ? sqlite3_column_int64(stmt, 0) : 0;
+	sqlite3_finalize(stmt);
+	sqlite3_prepare_v2(db, "PRAGMA page_size", -1, &stmt, NULL);
+	long pagesize = SQLITE_ROW == sqlite3_step(stmt) ? sqlite3_column_int64(stmt, 0) : 0;
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+
+	vector<SqliteBtreeStats> sorted;
+	SqliteBtreeStats total;
+	for (map<string, SqliteBtreeStats>::iterator it = stats.begin(); it != stats.end(); ++it) {
+		it->second.name = it->first;
+		sorted.push_back(it->second);
+		total.pages += it->second.pages;
+		total.overflow_pages += it->second.overflow_pages;
+		total.depth = max(total.depth, it->second.depth);
+		total.bytes += it->second.bytes;
+		total.payload += it->second.payload;
+		total.unused += it->second.unused;
+	}
+	sort(sorted.begin(), sorted.end());
+	total.name = "total";
+	sorted.push_back(total);
+
+	out << path << ": " << method << ", page size " << pagesize << ", " << total.pages + freepages << " pages ("
+			<< freepages << " free), " << totalsamples << " samples" << endl;
+	out << "name\ttable\tpages\toverflow\tdepth\tbytes\tpayload\toverhead\tunused"
+			<< "\tbytes/sample\tpayload/sample\toverhead/sample\tunused/sample" << endl;
+	for (unsigned i = 0; i < sorted.size(); ++i) {
+		const SqliteBtreeStats &s = sorted[i];
+		int64_t n = i + 1 == sorted.size() ? totalsamples : samples[s.table];
+		out << s.name << "\t" << (s.table.empty() ? "-" : s.table) << "\t" << s.pages << "\t" << s.overflow_pages
+				<< "\t" << s.depth << "\t" << s.bytes << "\t" << s.payload << "\t" << s.overhead() << "\t" << s.unused;
+		if (n > 0) {
+			out << "\t" << (double) s.bytes / n << "\t" << (double) s.payload / n << "\t"
+					<< (double) s.overhead() / n << "\t" << (double) s.unused / n << endl;
+		} else {
+			out << "\t-\t-\t-\t-" << endl;
+		}
+	}
+	if (freepages > 0) {
+		out << "freelist: " << freepages * pagesize << " bytes";
+		if (totalsamples > 0) {
+			out << ", " << (double) freepages * pagesize / totalsamples << " per sample";
+		}
+		out << endl;
+	}
+}
+
+void test_sqlite_storage() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	options()["value_index"] = "1";
+	options()["journal"] = "WAL";
+	{
+		SqliteSink sqlite("out-storage.db", sqlite_config());
+		vector<GroupSink*> sinks(1, &sqlite);
+		run_sinks(data, sinks);
+	}
+	options().erase("value_index");
+	options().erase("journal");
+	print_sqlite_storage("out-storage.db", cerr);
+
+	//the report must neither create a missing db nor take one out of WAL
+	//  (header bytes 18 and 19 are 2 in WAL mode)
+	print_sqlite_storage("out-storage-missing.db", cerr);
+	struct stat st;
+	bool kept = 0 != stat("out-storage-missing.db", &st);
+	uint8_t header[20] = {0};
+	FILE *f = fopen("out-storage.db", "rb");
+	kept = kept && f && 1 == fread(header, sizeof(header), 1, f) && 2 == header[18] && 2 == header[19];
+	if (f) {
+		fclose(f);
+	}
+	cerr << "report left the dbs " << (kept ? "unchanged" : "CHANGED") << endl;
+
+	//the walk must account the same bytes dbstat does, where there is one
+	sqlite3 *db = open_sqlite_readonly("out-storage.db", "");
+	map<string, SqliteBtreeStats> fromstat;
+	map<string, SqliteBtreeStats> fromwalk;
+	bool hasstat = sqlite_dbstat(db, fromstat);
+	SqlitePageWalker().run(db, fromwalk);
+	sqlite3_close(db);
+	if (!hasstat) {
+		cerr << "no dbstat in sqlite " << sqlite3_libversion() << " to check the walk against" << endl;
+		return;
+	}
+	long mismatches = 0;
+	for (map<string, SqliteBtreeStats>::iterator it = fromstat.begin(); it != fromstat.end(); ++it) {
+		const SqliteBtreeStats &a = it->second;
+		const SqliteBtreeStats &b = fromwalk[it->first];
+		if (a.pages != b.pages || a.overflow_pages != b.overflow_pages || a.depth != b.depth || a.cells != b.cells
+				|| a.payload != b.payload || a.unused != b.unused) {
+			cerr << it->first << " differs: pages " << a.pages << "/" << b.pages << " depth " << a.depth << "/"
+					<< b.depth << " payload " << a.payload << "/" << b.payload << " unused " << a.unused << "/"
+					<< b.unused << endl;
+			++mismatches;
+		}
+	}
+	cerr << "page walk vs dbstat: " << (mismatches || fromstat.size() != fromwalk.size() ? "MISMATCH" : "ok") << endl;
+}
+
+#endif /* SQLITESTAT_HPP_ */
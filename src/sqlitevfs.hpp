@@ -0,0 +1,589 @@
+/*
+ * sqlitevfs.hpp
+ * "zpage" SQLite VFS shim: the main db file is stored as blockz compressed
+ *  pages plus a page map; journals and everything else go to the default
+ *  VFS untouched
+ */
+
+#ifndef SQLITEVFS_HPP_
+#define SQLITEVFS_HPP_
+
+#include <stdint.h>
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../inc/sqlite3.h"
+#include "blockz.hpp"
+#include "options.hpp"
+
+using namespace std;
+
+/*
+ * File layout:
+ *  header: "TSZPAGE1", u32 page size
+ *  page records, each a blockz block, or the raw page if that's no smaller
+ *  page map: (u64 offset, u32 length, u32 capacity) per page, length 0
+ *   for an all zero page
+ *  trailer: u64 pages, u64 logical size, u64 page map offset, "TSZMAP01"
+ * The map and trailer are rewritten at every sync and close. Pages
+ *  rewritten larger than their record move to the end of the file, and
+ *  close compacts the file if that left more than an eighth of it dead.
+ * This is NOT crash safe: page records are overwritten in place and new
+ *  records overwrite the previous map, so a crash or power loss between
+ *  syncs can leave a file that no map describes, which sqlite's journal
+ *  cannot roll back. Use it to measure size and speed only, never for
+ *  durability measurements.
+ */
+const char ZPAGE_MAGIC[8] = {'T', 'S', 'Z', 'P', 'A', 'G', 'E', '1'};
+const char ZPAGE_MAP_MAGIC[8] = {'T', 'S', 'Z', 'M', 'A', 'P', '0', '1'};
+const size_t ZPAGE_HEADER = 12;
+const size_t ZPAGE_TRAILER = 32;
+const size_t ZPAGE_MAX_IO = 65536;
+
+struct ZPageEntry {
+	uint64_t offset;
+	uint32_t length;
+	uint32_t capacity;
+};
+
+/**
+ * Byte counts of the last zpage file closed, for reports
+ */
+struct ZPageStats {
+	uint64_t logical;
+	uint64_t live;
+	uint64_t physical;
+	uint64_t pages;
+};
+
+ZPageStats& zpage_last_stats() {
+	static ZPageStats stats;
+	return stats;
+}
+
+/**
+ * The page map and page cache of one open zpage file, doing its I/O
+ *  through the real file underneath
+ */
+class ZPageStore {
+private:
+	sqlite3_file *real;
+	string path;
+	int level;
+	uint32_t pagesize;
+	uint64_t logical;
+	uint64_t dataend;
+	uint64_t dead;
+	vector<ZPageEntry> pagemap;
+	bool dirty;
+
+	//last page read or written, decompressed
+	uint64_t cachedpage;
+	vector<uint8_t> cache;
+	vector<uint8_t> packed;
+
+	//VFSes only see page sized I/O from sqlite (the unix one truncates
+	// anything past 128KiB), so the page map goes through in pieces
+	int raw_read(void *buf, size_t amt, sqlite3_int64 off) {
+		int rc = SQLITE_OK;
+		for (size_t at = 0; at < amt && SQLITE_OK == rc; at += ZPAGE_MAX_IO) {
+			rc = real->pMethods->xRead(real, (char*) buf + at, min(amt - at, ZPAGE_MAX_IO), off + at);
+		}
+		return rc;
+	}
+
+	int raw_write(const void *buf, size_t amt, sqlite3_int64 off) {
+		int rc = SQLITE_OK;
+		for (size_t at = 0; at < amt && SQLITE_OK == rc; at += ZPAGE_MAX_IO) {
+			rc = real->pMethods->xWrite(real, (const char*) buf + at, min(amt - at, ZPAGE_MAX_IO), off + at);
+		}
+		return rc;
+	}
+
+	/**
+	 * @returns the page's bytes, zeros if it was never written
+	 */
+	const uint8_t* get_page(uint64_t pg, int &rc) {
+		rc = SQLITE_OK;
+		if (pg == cachedpage) {
+			return &cache[0];
+		}
+		cache.assign(pagesize, 0);
+		cachedpage = pg;
+		if (pg >= pagemap.size() || 0 == pagemap[pg].length) {
+			return &cache[0];
+		}
+		const ZPageEntry &e = pagemap[pg];
+		if (e.length == pagesize) {
+			rc = raw_read(&cache[0], pagesize, e.offset);
+		} else {
+			packed.resize(e.length);
+			rc = raw_read(&packed[0], e.length, e.offset);
+			if (SQLITE_OK == rc && !blockz_decompress(&packed[0], e.length, &cache[0], pagesize)) {
+				rc = SQLITE_CORRUPT;
+			}
+		}
+		if (SQLITE_OK != rc) {
+			cachedpage = (uint64_t) -1;
+		}
+		return &cache[0];
+	}
+
+	int put_page(uint64_t pg, const uint8_t *data) {
+		if (pg >= pagemap.size()) {
+			ZPageEntry none = {0, 0, 0};
+			pagemap.resize(pg + 1, none);
+		}
+		cache.assign(data, data + pagesize);
+		cachedpage = pg;
+		ZPageEntry &e = pagemap[pg];
+
+		const uint8_t *rec = data;
+		uint32_t len = pagesize;
+		size_t nz = 0;
+		while (nz < pagesize && 0 == data[nz]) {
+			++nz;
+		}
+		if (nz == pagesize) {
+			len = 0;
+		} else {
+			packed.clear();
+			blockz_compress(data, pagesize, packed, level);
+			if (packed.size() < pagesize) {
+				rec = &packed[0];
+				len = packed.size();
+			}
+		}
+
+		int rc = SQLITE_OK;
+		if (len > e.capacity) {
+			dead += e.capacity;
+			e.offset = dataend;
+			e.capacity = len;
+			dataend += len;
+		}
+		if (len > 0) {
+			rc = raw_write(rec, len, e.offset);
+		}
+		e.length = len;
+		dirty = true;
+		return rc;
+	}
+
+public:
+	ZPageStore(sqlite3_file *_real, const char *_path) : real(_real), path(_path ? _path : ""),
+		level(opt_int("zpage_level", 1)), pagesize(0), logical(0), dataend(ZPAGE_HEADER), dead(0),
+		dirty(false), cachedpage((uint64_t) -1) {}
+
+	/**
+	 * @brief Read the header and page map of an existing file
+	 */
+	int load() {
+		sqlite3_int64 size;
+		int rc = real->pMethods->xFileSize(real, &size);
+		if (SQLITE_OK != rc || 0 == size) {
+			return rc;
+		}
+		uint8_t head[ZPAGE_HEADER];
+		uint8_t trailer[ZPAGE_TRAILER];
+		if ((size_t) size < ZPAGE_HEADER + ZPAGE_TRAILER || SQLITE_OK != raw_read(head, ZPAGE_HEADER, 0) ||
+				SQLITE_OK != raw_read(trailer, ZPAGE_TRAILER, size - ZPAGE_TRAILER) ||
+				0 != memcmp(head, ZPAGE_MAGIC, 8) || 0 != memcmp(trailer + 24, ZPAGE_MAP_MAGIC, 8)) {
+			return SQLITE_NOTADB;
+		}
+		uint64_t npages;
+		memcpy(&pagesize, head + 8, 4);
+		memcpy(&npages, trailer, 8);
+		memcpy(&logical, trailer + 8, 8);
+		memcpy(&dataend, trailer + 16, 8);
+		if (dataend + npages * sizeof(ZPageEntry) + ZPAGE_TRAILER != (uint64_t) size) {
+			return SQLITE_CORRUPT;
+		}
+		pagemap.resize(npages);
+		if (npages > 0) {
+			rc = raw_read(&pagemap[0], npages * sizeof(ZPageEntry), dataend);
+		}
+		uint64_t used = ZPAGE_HEADER;
+		for (size_t p = 0; p < npages; ++p) {
+			used += pagemap[p].capacity;
+		}
+		dead = dataend - used;
+		return rc;
+	}
+
+	int read(void *buf, int amt, sqlite3_int64 off) {
+		uint8_t *out = (uint8_t*) buf;
+		int rc = SQLITE_OK;
+		uint64_t end = off + amt;
+		uint64_t have = min(end, logical);
+		for (uint64_t at = off; at < have && SQLITE_OK == rc; ) {
+			uint64_t pg = at / pagesize;
+			size_t inpage = at % pagesize;
+			size_t n = min((uint64_t) (pagesize - inpage), have - at);
+			const uint8_t *page = get_page(pg, rc);
+			memcpy(out + (at - off), page + inpage, n);
+			at += n;
+		}
+		if (SQLITE_OK != rc) {
+			return SQLITE_IOERR_READ;
+		}
+		if (have < end) {
+			size_t from = have > (uint64_t) off ? have - off : 0;
+			memset(out + from, 0, amt - from);
+			return SQLITE_IOERR_SHORT_READ;
+		}
+		return SQLITE_OK;
+	}
+
+	int write(const void *buf, int amt, sqlite3_int64 off) {
+		int rc = SQLITE_OK;
+		if (0 == pagesize) {
+			//sqlite writes whole pages: the first write gives the page size
+			pagesize = (amt >= 512 && amt <= 65536 && 0 == (amt & (amt - 1))) ? amt : 4096;
+			uint8_t head[ZPAGE_HEADER];
+			memcpy(head, ZPAGE_MAGIC, 8);
+			memcpy(head + 8, &pagesize, 4);
+			rc = raw_write(head, ZPAGE_HEADER, 0);
+		}
+		const uint8_t *in = (const uint8_t*) buf;
+		uint64_t end = off + amt;
+		vector<uint8_t> page;
+		for (uint64_t at = off; at < end && SQLITE_OK == rc; ) {
+			uint64_t pg = at / pagesize;
+			size_t inpage = at % pagesize;
+			size_t n = min((uint64_t) (pagesize - inpage), end - at);
+			if (n == pagesize) {
+				rc = put_page(pg, in + (at - off));
+			} else {
+				const uint8_t *old = get_page(pg, rc);
+				page.assign(old, old + pagesize);
+				memcpy(&page[inpage], in + (at - off), n);
+				if (SQLITE_OK == rc) {
+					rc = put_page(pg, &page[0]);
+				}
+			}
+			at += n;
+		}
+		logical = max(logical, end);
+		return SQLITE_OK == rc ? SQLITE_OK : SQLITE_IOERR_WRITE;
+	}
+
+	int truncate(sqlite3_int64 size) {
+		int rc = SQLITE_OK;
+		if ((uint64_t) size < logical && pagesize > 0) {
+			uint64_t keep = (size + pagesize - 1) / pagesize;
+			for (uint64_t pg = keep; pg < pagemap.size(); ++pg) {
+				dead += pagemap[pg].capacity;
+			}
+			if (keep < pagemap.size()) {
+				pagemap.resize(keep);
+			}
+			if (size % pagesize) {
+				//zero the tail of the last page kept
+				const uint8_t *old = get_page(keep - 1, rc);
+				vector<uint8_t> page(old, old + pagesize);
+				memset(&page[size % pagesize], 0, pagesize - size % pagesize);
+				if (SQLITE_OK == rc) {
+					rc = put_page(keep - 1, &page[0]);
+				}
+			}
+			cachedpage = (uint64_t) -1;
+		}
+		logical = size;
+		dirty = true;
+		return rc;
+	}
+
+	sqlite3_int64 size() const {
+		return logical;
+	}
+
+	/**
+	 * @brief Write the page map and trailer after the page records
+	 */
+	int flush() {
+		if (!dirty) {
+			return SQLITE_OK;
+		}
+		vector<uint8_t> tail(pagemap.size() * sizeof(ZPageEntry) + ZPAGE_TRAILER);
+		if (!pagemap.empty()) {
+			memcpy(&tail[0], &pagemap[0], pagemap.size() * sizeof(ZPageEntry));
+		}
+		uint8_t *t = &tail[pagemap.size() * sizeof(ZPageEntry)];
+		uint64_t npages = pagemap.size();
+		memcpy(t, &npages, 8);
+		memcpy(t + 8, &logical, 8);
+		memcpy(t + 16, &dataend, 8);
+		memcpy(t + 24, ZPAGE_MAP_MAGIC, 8);
+		int rc = raw_write(&tail[0], tail.size(), dataend);
+		if (SQLITE_OK == rc) {
+			rc = real->pMethods->xTruncate(real, dataend + tail.size());
+		}
+		dirty = false;
+		return rc;
+	}
+
+	/**
+	 * @brief Rewrite the closed file with its records back to back, if
+	 *  rewrites left more than an eighth of it dead
+	 */
+	void compact() {
+		if (path.empty() || dead * 8 <= dataend) {
+			return;
+		}
+		string tmp = path + "-zcompact";
+		FILE *in = fopen(path.c_str(), "rb");
+		FILE *out = fopen(tmp.c_str(), "wb");
+		bool ok = in && out;
+		vector<char> buf(pagesize);
+		if (ok) {
+			uint8_t head[ZPAGE_HEADER];
+			memcpy(head, ZPAGE_MAGIC, 8);
+			memcpy(head + 8, &pagesize, 4);
+			ok = 1 == fwrite(head, ZPAGE_HEADER, 1, out);
+		}
+		uint64_t at = ZPAGE_HEADER;
+		for (size_t p = 0; ok && p < pagemap.size(); ++p) {
+			ZPageEntry &e = pagemap[p];
+			if (e.length > 0) {
+				ok = 0 == fseeko(in, e.offset, SEEK_SET) && 1 == fread(&buf[0], e.length, 1, in) &&
+						1 == fwrite(&buf[0], e.length, 1, out);
+			}
+			e.offset = at;
+			e.capacity = e.length;
+			at += e.length;
+		}
+		if (ok) {
+			uint64_t npages = pagemap.size();
+			if (npages > 0) {
+				ok = 1 == fwrite(&pagemap[0], npages * sizeof(ZPageEntry), 1, out);
+			}
+			ok = ok && 1 == fwrite(&npages, 8, 1, out) && 1 == fwrite(&logical, 8, 1, out) &&
+					1 == fwrite(&at, 8, 1, out) && 1 == fwrite(ZPAGE_MAP_MAGIC, 8, 1, out);
+		}
+		if (in) {
+			fclose(in);
+		}
+		if (out) {
+			ok = 0 == fclose(out) && ok;
+		}
+		if (ok && 0 == rename(tmp.c_str(), path.c_str())) {
+			dataend = at;
+			dead = 0;
+		} else {
+			remove(tmp.c_str());
+		}
+	}
+
+	/**
+	 * @brief Record this file's byte counts in zpage_last_stats
+	 */
+	void record_stats() const {
+		ZPageStats &st = zpage_last_stats();
+		st.logical = logical;
+		st.pages = pagemap.size();
+		st.live = ZPAGE_HEADER;
+		for (size_t p = 0; p < pagemap.size(); ++p) {
+			st.live += pagemap[p].length;
+		}
+		st.live += pagemap.size() * sizeof(ZPageEntry) + ZPAGE_TRAILER;
+		st.physical = dataend + pagemap.size() * sizeof(ZPageEntry) + ZPAGE_TRAILER;
+	}
+};
+
+/**
+ * sqlite3_file of a zpage main db; the real file follows it in memory
+ */
+struct ZPageFile {
+	sqlite3_file base;
+	sqlite3_file *real;
+	ZPageStore *store;
+};
+
+sqlite3_vfs* zpage_real(sqlite3_vfs *vfs) {
+	return (sqlite3_vfs*) vfs->pAppData;
+}
+
+ZPageFile* zpage_file(sqlite3_file *f) {
+	return (ZPageFile*) f;
+}
+
+int zpage_close(sqlite3_file *f) {
+	ZPageFile *zf = zpage_file(f);
+	zf->store->flush();
+	int rc = zf->real->pMethods->xClose(zf->real);
+	zf->store->compact();
+	zf->store->record_stats();
+	delete zf->store;
+	zf->store = NULL;
+	return rc;
+}
+
+int zpage_read(sqlite3_file *f, void *buf, int amt, sqlite3_int64 off) {
+	return zpage_file(f)->store->read(buf, amt, off);
+}
+
+int zpage_write(sqlite3_file *f, const void *buf, int amt, sqlite3_int64 off) {
+	return zpage_file(f)->store->write(buf, amt, off);
+}
+
+int zpage_truncate(sqlite3_file *f, sqlite3_int64 size) {
+	return zpage_file(f)->store->truncate(size);
+}
+
+int zpage_sync(sqlite3_file *f, int flags) {
+	ZPageFile *zf = zpage_file(f);
+	int rc = zf->store->flush();
+	return SQLITE_OK == rc ? zf->real->pMethods->xSync(zf->real, flags) : rc;
+}
+
+int zpage_file_size(sqlite3_file *f, sqlite3_int64 *size) {
+	*size = zpage_file(f)->store->size();
+	return SQLITE_OK;
+}
+
+int zpage_lock(sqlite3_file *f, int lock) {
+	sqlite3_file *real = zpage_file(f)->real;
+	return real->pMethods->xLock(real, lock);
+}
+
+int zpage_unlock(sqlite3_file *f, int lock) {
+	sqlite3_file *real = zpage_file(f)->real;
+	return real->pMethods->xUnlock(real, lock);
+}
+
+int zpage_check_reserved(sqlite3_file *f, int *out) {
+	sqlite3_file *real = zpage_file(f)->real;
+	return real->pMethods->xCheckReservedLock(real, out);
+}
+
+int zpage_file_control(sqlite3_file *f, int op, void *arg) {
+	//size hints and the like are about the physical file: not ours to pass on
+	return SQLITE_NOTFOUND;
+}
+
+int zpage_sector_size(sqlite3_file *f) {
+	sqlite3_file *real = zpage_file(f)->real;
+	return real->pMethods->xSectorSize(real);
+}
+
+int zpage_device_characteristics(sqlite3_file *f) {
+	return 0;
+}
+
+/**
+ * Version 1 methods: no shared memory (so no WAL) and no memory mapping
+ */
+const sqlite3_io_methods ZPAGE_IO_METHODS = {
+	1, zpage_close, zpage_read, zpage_write, zpage_truncate, zpage_sync, zpage_file_size,
+	zpage_lock, zpage_unlock, zpage_check_reserved, zpage_file_control, zpage_sector_size,
+	zpage_device_characteristics
+};
+
+int zpage_open(sqlite3_vfs *vfs, const char *name, sqlite3_file *f, int flags, int *outflags) {
+	sqlite3_vfs *real = zpage_real(vfs);
+	if (!(flags & SQLITE_OPEN_MAIN_DB)) {
+		return real->xOpen(real, name, f, flags, outflags);
+	}
+	ZPageFile *zf = zpage_file(f);
+	memset(zf, 0, sizeof(ZPageFile));
+	zf->real = (sqlite3_file*) (zf + 1);
+	int rc = real->xOpen(real, name, zf->real, flags, outflags);
+	if (SQLITE_OK != rc) {
+		return rc;
+	}
+	//without a path close won't compact, which read-only opens must not do
+	zf->store = new ZPageStore(zf->real, (flags & SQLITE_OPEN_READONLY) ? NULL : name);
+	rc = zf->store->load();
+	if (SQLITE_OK != rc) {
+		delete zf->store;
+		zf->real->pMethods->xClose(zf->real);
+		return rc;
+	}
+	zf->base.pMethods = &ZPAGE_IO_METHODS;
+	return SQLITE_OK;
+}
+
+int zpage_delete(sqlite3_vfs *vfs, const char *name, int sync) {
+	return zpage_real(vfs)->xDelete(zpage_real(vfs), name, sync);
+}
+
+int zpage_access(sqlite3_vfs *vfs, const char *name, int flags, int *out) {
+	return zpage_real(vfs)->xAccess(zpage_real(vfs), name, flags, out);
+}
+
+int zpage_full_pathname(sqlite3_vfs *vfs, const char *name, int n, char *out) {
+	return zpage_real(vfs)->xFullPathname(zpage_real(vfs), name, n, out);
+}
+
+void* zpage_dl_open(sqlite3_vfs *vfs, const char *name) {
+	return zpage_real(vfs)->xDlOpen(zpage_real(vfs), name);
+}
+
+void zpage_dl_error(sqlite3_vfs *vfs, int n, char *msg) {
+	zpage_real(vfs)->xDlError(zpage_real(vfs), n, msg);
+}
+
+void (*zpage_dl_sym(sqlite3_vfs *vfs, void *lib, const char *sym))(void) {
+	return zpage_real(vfs)->xDlSym(zpage_real(vfs), lib, sym);
+}
+
+void zpage_dl_close(sqlite3_vfs *vfs, void *lib) {
+	zpage_real(vfs)->xDlClose(zpage_real(vfs), lib);
+}
+
+int zpage_randomness(sqlite3_vfs *vfs, int n, char *out) {
+	return zpage_real(vfs)->xRandomness(zpage_real(vfs), n, out);
+}
+
+int zpage_sleep(sqlite3_vfs *vfs, int usec) {
+	return zpage_real(vfs)->xSleep(zpage_real(vfs), usec);
+}
+
+int zpage_current_time(sqlite3_vfs *vfs, double *out) {
+	return zpage_real(vfs)->xCurrentTime(zpage_real(vfs), out);
+}
+
+int zpage_last_error(sqlite3_vfs *vfs, int n, char *out) {
+	return zpage_real(vfs)->xGetLastError(zpage_real(vfs), n, out);
+}
+
+/**
+ * @brief Register the "zpage" VFS over the default one (once)
+ * @returns false if there is no default VFS
+ */
+bool zpage_register() {
+	static sqlite3_vfs vfs;
+	if (NULL != sqlite3_vfs_find("zpage")) {
+		return true;
+	}
+	sqlite3_vfs *real = sqlite3_vfs_find(NULL);
+	if (NULL == real) {
+		return false;
+	}
+	memset(&vfs, 0, sizeof(vfs));
+	vfs.iVersion = 1;
+	vfs.szOsFile = sizeof(ZPageFile) + real->szOsFile;
+	vfs.mxPathname = real->mxPathname;
+	vfs.zName = "zpage";
+	vfs.pAppData = real;
+	vfs.xOpen = zpage_open;
+	vfs.xDelete = zpage_delete;
+	vfs.xAccess = zpage_access;
+	vfs.xFullPathname = zpage_full_pathname;
+	vfs.xDlOpen = zpage_dl_open;
+	vfs.xDlError = zpage_dl_error;
+	vfs.xDlSym = zpage_dl_sym;
+	vfs.xDlClose = zpage_dl_close;
+	vfs.xRandomness = zpage_randomness;
+	vfs.xSleep = zpage_sleep;
+	vfs.xCurrentTime = zpage_current_time;
+	vfs.xGetLastError = zpage_last_error;
+	return SQLITE_OK == sqlite3_vfs_register(&vfs, 0);
+}
+
+#endif /* SQLITEVFS_HPP_ */
@@ -0,0 +1,337 @@
+/*
+ * stats.hpp
+ * Per-stream statistics pre-pass used to pick encodings
+ */
+
+#ifndef STATS_HPP_
+#define STATS_HPP_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "data.hpp"
+
+using namespace std;
+
+const int HLL_BITS = 12;
+
+uint64_t mix64(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/**
+ * @returns bits needed to store v (0 for 0)
+ */
+int bit_width(uint32_t v) {
+	return v ? 32 - __builtin_clz(v) : 0;
+}
+
+uint32_t zigzag(int32_t v) {
+	return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+int32_t unzigzag(uint32_t v) {
+	return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
+
+/**
+ * HyperLogLog distinct count estimator, 2^HLL_BITS one-byte registers
+ */
+class HyperLogLog {
+private:
+	vector<uint8_t> reg;
+
+public:
+	HyperLogLog() : reg(1 << HLL_BITS) {}
+
+	void add(uint32_t v) {
+		uint64_t h = mix64(v);
+		unsigned idx = h >> (64 - HLL_BITS);
+		uint64_t rest = (h << HLL_BITS) | (1ULL << (HLL_BITS - 1));
+		uint8_t rank = __builtin_clzll(rest) + 1;
+		if (rank > reg[idx]) {
+			reg[idx] = rank;
+		}
+	}
+
+	double estimate() const {
+		double m = reg.size();
+		double sum = 0;
+		unsigned zeros = 0;
+		for (unsigned i = 0; i < reg.size(); ++i) {
+			sum += ldexp(1.0, -reg[i]);
+			zeros += (reg[i] == 0);
+		}
+		double est = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+		//small range correction: linear counting
+		if (est <= 2.5 * m && zeros != 0) {
+			est = m * log(m / zeros);
+		}
+		return est;
+	}
+};
+
+/**
+ * One-pass summary of an int32 stream
+ */
+struct StreamStats {
+	uint64_t n;
+	int32_t min;
+	int32_t max;
+	double distinct;
+	//samples that are zero / equal to their predecessor
+	uint64_t nzero;
+	uint64_t nrepeat;
+	uint64_t longest_zero_run;
+	//samples <= the last accepted one, as counted by the OpenTSDB writers
+	uint64_t nolder;
+	//delta_bits[b]: deltas whose zigzag encoding needs b bits
+	uint64_t delta_bits[33];
+	//same for delta-of-delta
+	uint64_t dod_bits[33];
+
+	double zero_frac() const {
+		return n ? (double) nzero / n : 0;
+	}
+	double repeat_frac() const {
+		return n ? (double) nrepeat / n : 0;
+	}
+	int range_bits() const {
+		return bit_width((uint32_t) max - (uint32_t) min);
+	}
+
+	/**
+	 * @returns smallest b covering fraction q of a bit width histogram
+	 */
+	static int quantile_bits(const uint64_t *hist, double q) {
+		uint64_t total = 0;
+		for (int b = 0; b <= 32; ++b) {
+			total += hist[b];
+		}
+		uint64_t seen = 0;
+		for (int b = 0; b <= 32; ++b) {
+			seen += hist[b];
+			if (seen >= q * total) {
+				return b;
+			}
+		}
+		return 32;
+	}
+};
+
+/**
+ * @brief Accumulates StreamStats over a stream fed in pieces, e.g. the
+ *  blocks of a GroupReader. Each piece is scanned block by block:
+ *  a branch-free loop the compiler vectorizes (min/max/zero/repeat counts)
+ *  followed by the hashing and histogram work on the same cached block.
+ */
+class StreamStatsBuilder {
+private:
+	StreamStats st;
+	HyperLogLog hll;
+	int32_t prev;
+	int32_t prevdelta;
+	int32_t oldts;
+	uint64_t zerorun;
+
+public:
+	StreamStatsBuilder() : prev(0), prevdelta(0), oldts(0), zerorun(0) {
+		memset(&st, 0, sizeof(st));
+	}
+
+	void add(const int32_t *vals, size_t n) {
+		if (0 == n) {
+			return;
+		}
+		if (0 == st.n) {
+			st.min = st.max = prev = vals[0];
+		}
+
+		const size_t block = 1024;
+		for (size_t start = 0; start < n; start += block) {
+			size_t end = min(n, start + block);
+
+			int32_t lo = st.min;
+			int32_t hi = st.max;
+			int32_t last = prev;
+			uint64_t nzero = 0;
+			uint64_t nrepeat = 0;
+			for (size_t i = start; i < end; ++i) {
+				int32_t v = vals[i];
+				lo = v < lo ? v : lo;
+				hi = v > hi ? v : hi;
+				nzero += (v == 0);
+				nrepeat += (v == (i > 0 ? vals[i - 1] : last));
+			}
+			st.min = lo;
+			st.max = hi;
+			st.nzero += nzero;
+			//the first sample of the stream has no predecessor
+			st.nrepeat += nrepeat - (0 == st.n && 0 == start);
+
+			for (size_t i = start; i < end; ++i, ++st.n) {
+				int32_t v = vals[i];
+				hll.add(v);
+
+				int32_t delta = (int32_t) ((uint32_t) v - (uint32_t) prev);
+				if (st.n > 0) {
+					++st.delta_bits[bit_width(zigzag(delta))];
+					if (st.n > 1) {
+						++st.dod_bits[bit_width(zigzag((int32_t) ((uint32_t) delta - (uint32_t) prevdelta)))];
+					}
+				}
+				prevdelta = delta;
+				prev = v;
+
+				if (v == 0) {
+					++zerorun;
+					st.longest_zero_run = max(st.longest_zero_run, zerorun);
+				} else {
+					zerorun = 0;
+				}
+
+				if (v <= oldts) {
+					++st.nolder;
+				} else {
+					oldts = v;
+				}
+			}
+		}
+	}
+
+	StreamStats finish() const {
+		StreamStats res = st;
+		//the sketch can overshoot; there can't be more distinct values than samples
+		res.distinct = st.n ? min(hll.estimate(), (double) st.n) : 0;
+		return res;
+	}
+};
+
+/**
+ * @brief Compute StreamStats over n samples in a single pass
+ */
+StreamStats compute_stats(const int32_t *vals, size_t n) {
+	StreamStatsBuilder b;
+	b.add(vals, n);
+	return b.finish();
+}
+
+/**
+ * @brief Compute StreamStats for a mapped .ts/.vs file
+ * @returns false if the file couldn't be read
+ */
+bool compute_file_stats(const string &fname, StreamStats &st) {
+	MappedFile f(fname.c_str());
+	if (!f.ok) {
+		return false;
+	}
+	st = compute_stats((const int32_t*) f.data, f.size / sizeof(int32_t));
+	return true;
+}
+
+/**
+ * @brief Cheapest encoding family for a stream, by estimated bits per sample.
+ *  Names match the codec registry in codec.hpp.
+ */
+string suggest_encoding(const StreamStats &st) {
+	if (st.n < 2 || st.min == st.max) {
+		return "rle";
+	}
+	if (st.repeat_frac() > 0.5) {
+		return "rle";
+	}
+
+	double dict_bits = bit_width((uint32_t) ceil(st.distinct));
+	double for_bits = st.range_bits();
+	double delta_bits = StreamStats::quantile_bits(st.delta_bits, 0.9);
+	double dod_bits = StreamStats::quantile_bits(st.dod_bits, 0.9);
+
+	//dictionaries pay for their entries; only worth it when small
+	if (st.distinct <= 4096 && dict_bits + 1 < min(for_bits, delta_bits)) {
+		return "dict";
+	}
+	if (dod_bits < delta_bits && dod_bits < for_bits) {
+		return "dod";
+	}
+	if (delta_bits < for_bits) {
+		return "delta";
+	}
+	return "for";
+}
+
+struct StatsJob {
+	const vector<string> *files;
+	vector<StreamStats> *stats;
+	vector<char> *found;
+	void operator()(size_t i) {
+		(*found)[i] = compute_file_stats((*files)[i], (*stats)[i]);
+	}
+};
+
+/**
+ * @brief Compute stats for every ts and vs stream of data in parallel
+ * @param names filled with the stream file names, in the order of the result
+ */
+vector<StreamStats> compute_multi_stats(DataMulti &data, vector<string> &names) {
+	for (map<string, set<string> >::const_iterator it = data.begin(); it != data.end(); ++it) {
+		names.push_back(data.get_name((*it).first, TS));
+		for (set<string>::const_iterator sit = (*it).second.begin(); sit != (*it).second.end(); ++sit) {
+			names.push_back(data.get_name(*sit, VS));
+		}
+	}
+
+	vector<StreamStats> stats(names.size());
+	vector<char> found(names.size());
+	StatsJob job;
+	job.files = &names;
+	job.stats = &stats;
+	job.found = &found;
+	parallel_for(names.size(), job, default_threads());
+
+	for (unsigned i = 0; i < names.size(); ++i) {
+		if (!found[i]) {
+			cerr << "could not read stream " << names[i] << endl;
+		}
+	}
+	return stats;
+}
+
+/**
+ * @brief Write a tab separated stats report, one stream per line
+ */
+void print_stats_multi(DataMulti data, ostream &out) {
+	vector<string> names;
+	vector<StreamStats> stats = compute_multi_stats(data, names);
+
+	out << "stream\tn\tmin\tmax\tdistinct\tzero_frac\trepeat_frac"
+			<< "\tlongest_zero_run\tnolder\tdelta_bits_p50\tdelta_bits_p99\tencoding" << endl;
+	for (unsigned i = 0; i < names.size(); ++i) {
+		const StreamStats &st = stats[i];
+		out << names[i] << "\t" << st.n << "\t" << st.min << "\t" << st.max
+				<< "\t" << (uint64_t) (st.distinct + 0.5)
+				<< "\t" << fixed << setprecision(4) << st.zero_frac()
+				<< "\t" << st.repeat_frac() << "\t" << st.longest_zero_run
+				<< "\t" << st.nolder
+				<< "\t" << StreamStats::quantile_bits(st.delta_bits, 0.5)
+				<< "\t" << StreamStats::quantile_bits(st.delta_bits, 0.99)
+				<< "\t" << suggest_encoding(st) << endl;
+	}
+}
+
+void test_stats_multi() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	print_stats_multi(data, cerr);
+}
+
+#endif /* STATS_HPP_ */
@@ -0,0 +1,119 @@
+/*
+ * thrift.hpp
+ * Thrift compact protocol writer, enough for Parquet metadata
+ */
+
+#ifndef THRIFT_HPP_
+#define THRIFT_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum ThriftType {
+	T_BOOL_TRUE = 1, T_BOOL_FALSE = 2, T_BYTE = 3, T_I16 = 4, T_I32 = 5,
+	T_I64 = 6, T_DOUBLE = 7, T_BINARY = 8, T_LIST = 9, T_SET = 10,
+	T_MAP = 11, T_STRUCT = 12
+};
+
+/**
+ * Writes one struct at a time: fields in increasing id order, nested
+ *  structs (as fields or list elements) between begin_struct/end_struct
+ */
+class ThriftWriter {
+private:
+	vector<uint8_t> &out;
+	//last field id of each open struct
+	vector<int> lastid;
+
+	void field(int id, int type) {
+		int delta = id - lastid.back();
+		if (delta > 0 && delta <= 15) {
+			out.push_back((uint8_t) ((delta << 4) | type));
+		} else {
+			out.push_back((uint8_t) type);
+			zigzag(id);
+		}
+		lastid.back() = id;
+	}
+
+public:
+	ThriftWriter(vector<uint8_t> &_out) : out(_out), lastid(1, 0) {}
+
+	void varint(uint64_t v) {
+		while (v >= 0x80) {
+			out.push_back((uint8_t) (v | 0x80));
+			v >>= 7;
+		}
+		out.push_back((uint8_t) v);
+	}
+
+	void zigzag(int64_t v) {
+		varint(((uint64_t) v << 1) ^ (uint64_t) (v >> 63));
+	}
+
+	void i32(int id, int32_t v) {
+		field(id, T_I32);
+		zigzag(v);
+	}
+
+	void i64(int id, int64_t v) {
+		field(id, T_I64);
+		zigzag(v);
+	}
+
+	void boolean(int id, bool v) {
+		field(id, v ? T_BOOL_TRUE : T_BOOL_FALSE);
+	}
+
+	void binary(int id, const string &v) {
+		field(id, T_BINARY);
+		list_binary(v);
+	}
+
+	/**
+	 * @brief Open a struct field; id 0 opens a list element instead
+	 */
+	void begin_struct(int id) {
+		if (id) {
+			field(id, T_STRUCT);
+		}
+		lastid.push_back(0);
+	}
+
+	void end_struct() {
+		out.push_back(0);
+		lastid.pop_back();
+	}
+
+	void begin_list(int id, int elemtype, size_t n) {
+		field(id, T_LIST);
+		if (n < 15) {
+			out.push_back((uint8_t) ((n << 4) | elemtype));
+		} else {
+			out.push_back((uint8_t) (0xF0 | elemtype));
+			varint(n);
+		}
+	}
+
+	void list_i32(int32_t v) {
+		zigzag(v);
+	}
+
+	void list_binary(const string &v) {
+		varint(v.size());
+		out.insert(out.end(), v.begin(), v.end());
+	}
+
+	/**
+	 * @brief End the outermost struct
+	 */
+	void finish() {
+		out.push_back(0);
+	}
+};
+
+#endif /* THRIFT_HPP_ */
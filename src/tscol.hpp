@@ -0,0 +1,448 @@
+/*
+ * tscol.hpp
+ * Columnar file per merge group, with a footer index of chunk statistics
+ *
+ * Layout:
+ *   "TSCOL001", group key, u32 column count, column names ("ts" first)
+ *   chunks: per row group of --rows_per_chunk rows, one write_chunk record
+ *     (encode_block payload) per column
+ *   footer: u64 rows, u32 rows per chunk, u32 chunks, then per column per
+ *     chunk: u64 file offset, u32 rows, i32 min, i32 max
+ *   trailer: u64 footer offset, "TSCOL001"
+ */
+
+#ifndef TSCOL_HPP_
+#define TSCOL_HPP_
+
+#include <stdint.h>
+
+#include "compact.hpp"
+#include "data.hpp"
+#include "sink.hpp"
+
+using namespace std;
+
+const char TSCOL_MAGIC[8] = {'T', 'S', 'C', 'O', 'L', '0', '0', '1'};
+
+struct TscolChunk {
+	uint64_t offset;
+	uint32_t nrows;
+	int32_t min;
+	int32_t max;
+};
+
+size_t tscol_chunk_rows() {
+	return opt_int("rows_per_chunk", 65536);
+}
+
+/**
+ * Writes each merge group as output-N.tsc. Rows are buffered until a
+ *  chunk's worth is ready, then every column's chunk goes straight to disk;
+ *  only the index is held until the footer.
+ */
+class TscolSink : public GroupSink {
+private:
+	string output;
+	size_t chunkrows;
+	double slack;
+	int level;
+	ofstream out;
+	vector<vector<int32_t> > pending;
+	vector<vector<TscolChunk> > index;
+	uint64_t nrows;
+	vector<uint8_t> buf;
+	vector<uint8_t> scratch;
+
+	void write_row_group() {
+		if (pending.empty() || pending[0].empty()) {
+			return;
+		}
+		for (unsigned c = 0; c < pending.size(); ++c) {
+			const vector<int32_t> &vals = pending[c];
+			TscolChunk ch;
+			ch.offset = out.tellp();
+			ch.nrows = vals.size();
+			ch.min = *min_element(vals.begin(), vals.end());
+			ch.max = *max_element(vals.begin(), vals.end());
+			index[c].push_back(ch);
+
+			buf.clear();
+			encode_block(&vals[0], vals.size(), buf, -1, slack);
+			write_chunk(out, buf, level, scratch);
+			pending[c].clear();
+		}
+	}
+
+public:
+	uint64_t totalbytes;
+
+	TscolSink(const char *_output) : output(_output), chunkrows(tscol_chunk_rows()),
+		slack(opt_double("slack", 0)), level(opt_int("level", 0)), nrows(0), totalbytes(0) {}
+
+	const char* name() const {
+		return "tscol";
+	}
+
+	void begin_group(int groupdx, const string &key, const GroupReader &group) {
+		stringstream name;
+		name << output << "-" << groupdx << ".tsc";
+		out.open(name.str().c_str(), ios::binary | ios::out | ios::trunc);
+		out.write(TSCOL_MAGIC, 8);
+		write_str(out, key);
+		write_pod(out, (uint32_t) (group.columns.size() + 1));
+		write_str(out, "ts");
+		for (unsigned i = 0; i < group.columns.size(); ++i) {
+			write_str(out, group.columns[i]);
+		}
+
+		pending.assign(group.columns.size() + 1, vector<int32_t>());
+		index.assign(group.columns.size() + 1, vector<TscolChunk>());
+		nrows = 0;
+	}
+
+	void write_block(const GroupBlock &blk) {
+		size_t r = 0;
+		while (r < blk.nrows) {
+			size_t take = min(blk.nrows - r, chunkrows - pending[0].size());
+			pending[0].insert(pending[0].end(), blk.ts + r, blk.ts + r + take);
+			for (unsigned i = 0; i < blk.vals.size(); ++i) {
+				pending[i + 1].insert(pending[i + 1].end(), blk.vals[i] + r, blk.vals[i] + r + take);
+			}
+			r += take;
+			nrows += take;
+			if (pending[0].size() == chunkrows) {
+				write_row_group();
+			}
+		}
+	}
+
+	void end_group() {
+		write_row_group();
+
+		uint64_t footer = out.tellp();
+		write_pod(out, nrows);
+		write_pod(out, (uint32_t) chunkrows);
+		write_pod(out, (uint32_t) index[0].size());
+		for (unsigned c = 0; c < index.size(); ++c) {
+			for (unsigned k = 0; k < index[c].size(); ++k) {
+				const TscolChunk &ch = index[c][k];
+				write_pod(out, ch.offset);
+				write_pod(out, ch.nrows);
+				write_pod(out, ch.min);
+				write_pod(out, ch.max);
+			}
+		}
+		write_pod(out, footer);
+		out.write(TSCOL_MAGIC, 8);
+		totalbytes += out.tellp();
+		out.close();
+	}
+
+	void finish() {
+		cerr << "tscol bytes " << totalbytes << endl;
+	}
+};
+
+void insert_tscol_multi(DataMulti data, int twidth, int vwidth, const char *output) {
+	if (twidth != 4 || vwidth != 4) {
+		cerr << "tscol only supports 4 byte samples" << endl;
+		return;
+	}
+
+	TscolSink tscol(output);
+	vector<GroupSink*> sinks(1, &tscol);
+	run_sinks(data, sinks);
+}
+
+/**
+ * A mapped .tsc file: header and footer index are parsed up front, chunks
+ *  decoded on demand
+ */
+class TscolFile {
+private:
+	MappedFile f;
+
+	TscolFile(const TscolFile&);
+	TscolFile& operator=(const TscolFile&);
+
+	bool parse() {
+		const uint8_t *base = (const uint8_t*) f.data;
+		const uint8_t *end = base + f.size;
+		if (!f.ok || f.size < 32 || 0 != memcmp(base, TSCOL_MAGIC, 8) ||
+				0 != memcmp(end - 8, TSCOL_MAGIC, 8)) {
+			return false;
+		}
+		const uint8_t *p = base + 8;
+		uint32_t keylen = get_u32(p);
+		if ((size_t) (end - p) < keylen + 4) {
+			return false;
+		}
+		key.assign((const char*) p, keylen);
+		p += keylen;
+		uint32_t ncols = get_u32(p);
+		if (0 == ncols) {
+			return false;
+		}
+		for (uint32_t c = 0; c < ncols; ++c) {
+			if (end - p < 4) {
+				return false;
+			}
+			uint32_t namelen = get_u32(p);
+			if ((size_t) (end - p) < namelen) {
+				return false;
+			}
+			names.push_back(string((const char*) p, namelen));
+			p += namelen;
+		}
+
+		uint64_t footer;
+		memcpy(&footer, end - 16, 8);
+		if (footer > f.size - 16 || f.size - 16 - footer < 16) {
+			return false;
+		}
+		p = base + footer;
+		memcpy(&nrows, p, 8);
+		p += 8;
+		chunkrows = get_u32(p);
+		uint32_t nchunks = get_u32(p);
+		if ((uint64_t) (end - 16 - p) != (uint64_t) ncols * nchunks * 20) {
+			return false;
+		}
+		chunks.assign(ncols, vector<TscolChunk>(nchunks));
+		for (uint32_t c = 0; c < ncols; ++c) {
+			for (uint32_t k = 0; k < nchunks; ++k) {
+				TscolChunk &ch = chunks[c][k];
+				memcpy(&ch.offset, p, 8);
+				p += 8;
+				ch.nrows = get_u32(p);
+				ch.min = (int32_t) get_u32(p);
+				ch.max = (int32_t) get_u32(p);
+				if (ch.offset >= footer) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+public:
+	bool ok;
+	string key;
+	//"ts" then the value columns
+	vector<string> names;
+	uint64_t nrows;
+	uint32_t chunkrows;
+	//[column][chunk]
+	vector<vector<TscolChunk> > chunks;
+
+	TscolFile(const char *fname) : f(fname), nrows(0), chunkrows(0) {
+		ok = parse();
+	}
+
+	size_t nchunks() const {
+		return chunks.empty() ? 0 : chunks[0].size();
+	}
+
+	/**
+	 * @brief Decode chunk k of column col into out (replacing its contents)
+	 * @returns false on a malformed chunk
+	 */
+	bool read(unsigned col, size_t k, vector<int32_t> &out, vector<uint8_t> &scratch) const {
+		const uint8_t *end = (const uint8_t*) f.data + f.size;
+		const uint8_t *chunk;
+		size_t len;
+		out.clear();
+		if (NULL == read_chunk((const uint8_t*) f.data + chunks[col][k].offset, end, chunk, len, scratch)) {
+			return false;
+		}
+		return decode_block(chunk, out) == len && out.size() == chunks[col][k].nrows;
+	}
+
+	/**
+	 * @brief Chunks whose timestamp range overlaps [t0, t1]
+	 */
+	void chunks_in_range(int32_t t0, int32_t t1, vector<size_t> &ks) const {
+		ks.clear();
+		for (size_t k = 0; k < nchunks(); ++k) {
+			if (chunks[0][k].max >= t0 && chunks[0][k].min <= t1) {
+				ks.push_back(k);
+			}
+		}
+	}
+};
+
+/**
+ * Serves a .tsc file as a merge group, one decoded chunk at a time, so the
+ *  sinks can read it in place of the loose .ts/.vs streams
+ */
+class TscolGroupReader : public GroupReader {
+private:
+	const TscolFile &file;
+	vector<vector<int32_t> > cols;
+	vector<uint8_t> scratch;
+	size_t chunk;
+	size_t inchunk;
+	size_t pos;
+	bool bad;
+
+public:
+	TscolGroupReader(const TscolFile &_file) : file(_file), chunk(0), inchunk(0), pos(0), bad(false) {
+		tsname = "ts";
+		columns.assign(file.names.begin() + 1, file.names.end());
+		//no loose streams behind these columns
+		vsnames.assign(columns.size(), "");
+		nrows = file.nrows;
+		cols.resize(file.names.size());
+	}
+
+	bool ok() const {
+		return file.ok && !bad;
+	}
+
+	void rewind() {
+		chunk = 0;
+		inchunk = 0;
+		pos = 0;
+		cols[0].clear();
+	}
+
+	bool next(GroupBlock &blk, size_t maxrows) {
+		if (bad) {
+			return false;
+		}
+		if (inchunk >= cols[0].size()) {
+			if (chunk >= file.nchunks()) {
+				return false;
+			}
+			for (unsigned c = 0; c < cols.size(); ++c) {
+				if (!file.read(c, chunk, cols[c], scratch)) {
+					cerr << "corrupt chunk " << chunk << " of column " << file.names[c] << endl;
+					bad = true;
+					return false;
+				}
+			}
+			++chunk;
+			inchunk = 0;
+		}
+		blk.start = pos;
+		blk.nrows = min(maxrows, cols[0].size() - inchunk);
+		blk.ts = &cols[0][inchunk];
+		blk.vals.resize(cols.size() - 1);
+		for (unsigned c = 1; c < cols.size(); ++c) {
+			blk.vals[c - 1] = &cols[c][inchunk];
+		}
+		inchunk += blk.nrows;
+		pos += blk.nrows;
+		return true;
+	}
+};
+
+/**
+ * @brief Feed .tsc files to sinks as if they were merge groups, in order
+ */
+void run_sinks_tscol(const vector<string> &files, vector<GroupSink*> &sinks) {
+	for (unsigned i = 0; i < files.size(); ++i) {
+		TscolFile file(files[i].c_str());
+		if (!file.ok) {
+			cerr << "could not read tscol file " << files[i] << endl;
+			break;
+		}
+		GroupReader *group = reorder_group(new TscolGroupReader(file));
+		feed_sinks(*group, i + 1, file.key, sinks);
+		delete group;
+	}
+
+	for (unsigned s = 0; s < sinks.size(); ++s) {
+		sinks[s]->finish();
+	}
+}
+
+/**
+ * @brief Sum one column over the rows with t0 <= ts <= t1, decoding only
+ *  chunks the footer index says can overlap the range
+ * @param scanned set to the number of chunks decoded
+ * @returns false if the file or column couldn't be read
+ */
+bool tscol_sum_range(const char *fname, const string &column, int32_t t0, int32_t t1,
+		int64_t &sum, long &rows, size_t &scanned) {
+	TscolFile file(fname);
+	if (!file.ok) {
+		return false;
+	}
+	unsigned col = find(file.names.begin(), file.names.end(), column) - file.names.begin();
+	if (col >= file.names.size()) {
+		return false;
+	}
+
+	vector<size_t> ks;
+	file.chunks_in_range(t0, t1, ks);
+	vector<int32_t> ts;
+	vector<int32_t> vals;
+	vector<uint8_t> scratch;
+	sum = 0;
+	rows = 0;
+	scanned = ks.size();
+	for (unsigned i = 0; i < ks.size(); ++i) {
+		if (!file.read(0, ks[i], ts, scratch) || !file.read(col, ks[i], vals, scratch)) {
+			return false;
+		}
+		for (size_t r = 0; r < ts.size(); ++r) {
+			if (ts[r] >= t0 && ts[r] <= t1) {
+				sum += vals[r];
+				++rows;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Write a .tsc file's header and chunk index to out
+ */
+void print_tscol_info(const char *fname, ostream &out) {
+	TscolFile file(fname);
+	if (!file.ok) {
+		out << "could not read tscol file " << fname << endl;
+		return;
+	}
+	out << "group " << file.key << " rows " << file.nrows << " chunks " << file.nchunks()
+			<< " (" << file.chunkrows << " rows each)" << endl;
+	for (unsigned c = 0; c < file.names.size(); ++c) {
+		out << file.names[c] << endl;
+		for (unsigned k = 0; k < file.chunks[c].size(); ++k) {
+			const TscolChunk &ch = file.chunks[c][k];
+			out << "\t" << k << "\t@" << ch.offset << "\t" << ch.nrows << " rows\t["
+					<< ch.min << ", " << ch.max << "]" << endl;
+		}
+	}
+}
+
+void test_tscol_multi() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	insert_tscol_multi(data, 4, 4, "out-tscol");
+
+	TscolFile file("out-tscol-1.tsc");
+	MappedFile vs("../testdata-multi/vs/vm_2543_net_received_average.vs");
+	MappedFile ts("../testdata-multi/ts.merge/012dd4af04c6fff34ffb0734141299c7.ts");
+	const int32_t *tvals = (const int32_t*) ts.data;
+	const int32_t *vvals = (const int32_t*) vs.data;
+	size_t n = min(ts.size, vs.size) / 4;
+	int32_t t0 = tvals[n / 3];
+	int32_t t1 = tvals[n / 2];
+	int64_t expect = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (tvals[i] >= t0 && tvals[i] <= t1) {
+			expect += vvals[i];
+		}
+	}
+
+	int64_t sum;
+	long rows;
+	size_t scanned;
+	bool ok = tscol_sum_range("out-tscol-1.tsc", "vm_2543_net_received_average", t0, t1, sum, rows, scanned);
+	cerr << "tscol range sum " << sum << " over " << scanned << "/" << file.nchunks() << " chunks"
+			<< (ok && sum == expect ? " ok" : " MISMATCH") << endl;
+}
+
+#endif /* TSCOL_HPP_ */
@@ -0,0 +1,599 @@
+/*
+ * tsdbnet.hpp
+ * OpenTSDB put load driver over persistent TCP connections (telnet "put"
+ *  lines or HTTP /api/put JSON batches), and a minimal local stand-in
+ *  server that parses and counts puts
+ */
+
+#ifndef TSDBNET_HPP_
+#define TSDBNET_HPP_
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+
+#include "data.hpp"
+#include "opentsdb.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+
+//what OpenTSDB's telnet "version" command answers: a revision line, then a build line
+const char TSDB_VERSION_REPLY[] =
+		"net.opentsdb.tools 2.0.0 built from revision 0000000 (MINT)\n"
+		"Built on 2013/07/17 00:00:00 +0000 by tscomparison@localhost:/opentsdb\n";
+
+bool send_all(int fd, const char *p, size_t n) {
+	while (n > 0) {
+		ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+		if (w < 0 && errno == EINTR) {
+			continue;
+		}
+		if (w <= 0) {
+			return false;
+		}
+		p += w;
+		n -= w;
+	}
+	return true;
+}
+
+void set_nodelay(int fd) {
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/**
+ * Counters updated by all of the server's connection threads
+ */
+struct TsdbServerStats {
+	volatile long puts;
+	volatile long requests;
+	volatile long errors;
+	volatile long conns;
+};
+
+/**
+ * @brief Handle one telnet command line (without its newline)
+ */
+void tsdb_telnet_line(const string &line, TsdbServerStats &st, string &reply) {
+	stringstream in(line);
+	string cmd;
+	if (!(in >> cmd)) {
+		return;
+	}
+	__sync_fetch_and_add(&st.requests, 1);
+	if (cmd == "put") {
+		//put <metric> <timestamp> <value> <tagk=tagv> [...]
+		int nargs = 0;
+		string arg;
+		while (in >> arg) {
+			++nargs;
+		}
+		if (nargs >= 4) {
+			__sync_fetch_and_add(&st.puts, 1);
+		} else {
+			__sync_fetch_and_add(&st.errors, 1);
+			char buf[128];
+			sprintf(buf, "put: illegal argument: not enough arguments (need least 4, got %d)\n", nargs);
+			reply += buf;
+		}
+	} else if (cmd == "version") {
+		reply += TSDB_VERSION_REPLY;
+	} else {
+		__sync_fetch_and_add(&st.errors, 1);
+		reply += "unknown command: " + cmd + ".  Try `help'.\n";
+	}
+}
+
+/**
+ * @brief Find the end of HTTP headers and the Content-Length
+ * @returns header bytes including the blank line, 0 if incomplete
+ */
+size_t http_headers(const char *p, size_t n, size_t &clen) {
+	string head(p, n);
+	size_t end = head.find("\r\n\r\n");
+	if (end == string::npos) {
+		return 0;
+	}
+	head.resize(end);
+	clen = 0;
+	for (size_t i = 0; i < head.size(); ++i) {
+		head[i] = tolower(head[i]);
+	}
+	size_t at = head.find("\r\ncontent-length:");
+	if (at != string::npos) {
+		clen = strtoul(head.c_str() + at + 17, NULL, 10);
+	}
+	return end + 4;
+}
+
+/**
+ * @brief Handle one HTTP request: POST /api/put counts the JSON objects
+ *  of its body (OpenTSDB answers 204), GET /api/version answers 200
+ * @returns bytes consumed, 0 if the request is incomplete
+ */
+size_t tsdb_http_request(const char *p, size_t n, TsdbServerStats &st, string &reply) {
+	size_t clen;
+	size_t hdr = http_headers(p, n, clen);
+	if (0 == hdr || n < hdr + clen) {
+		return 0;
+	}
+	__sync_fetch_and_add(&st.requests, 1);
+
+	const char *body = p + hdr;
+	if (0 == strncmp(p, "POST /api/put", 13)) {
+		long nputs = 0;
+		const char *key = "\"metric\"";
+		for (const char *q = body; (q = (const char*) memmem(q, body + clen - q, key, 8)) != NULL; q += 8) {
+			++nputs;
+		}
+		if (nputs > 0) {
+			__sync_fetch_and_add(&st.puts, nputs);
+			reply += "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n\r\n";
+		} else {
+			__sync_fetch_and_add(&st.errors, 1);
+			reply += "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+		}
+	} else if (0 == strncmp(p, "GET /api/version", 16)) {
+		const char *json = "{\"version\":\"stand-in\"}";
+		char buf[256];
+		sprintf(buf, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n%s",
+				(int) strlen(json), json);
+		reply += buf;
+	} else {
+		__sync_fetch_and_add(&st.errors, 1);
+		reply += "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+	}
+	return hdr + clen;
+}
+
+struct TsdbConn {
+	int fd;
+	TsdbServerStats *stats;
+};
+
+/**
+ * @brief Serve one connection until the peer closes it. The protocol is
+ *  picked from the first bytes: HTTP if they start a request line,
+ *  telnet otherwise.
+ */
+void* tsdb_conn_thread(void *arg) {
+	TsdbConn conn = *(TsdbConn*) arg;
+	delete (TsdbConn*) arg;
+	TsdbServerStats &st = *conn.stats;
+	__sync_fetch_and_add(&st.conns, 1);
+
+	string buf;
+	string reply;
+	char chunk[65536];
+	int http = -1;
+	ssize_t r;
+	while ((r = recv(conn.fd, chunk, sizeof(chunk), 0)) > 0) {
+		buf.append(chunk, r);
+		if (http < 0) {
+			if (buf.size() < 4) {
+				continue;
+			}
+			http = (0 == buf.compare(0, 4, "POST") || 0 == buf.compare(0, 4, "GET "));
+		}
+
+		reply.clear();
+		size_t used = 0;
+		if (http) {
+			size_t n;
+			while ((n = tsdb_http_request(buf.data() + used, buf.size() - used, st, reply)) > 0) {
+				used += n;
+			}
+		} else {
+			size_t nl;
+			while ((nl = buf.find('\n', used)) != string::npos) {
+				size_t len = nl - used;
+				if (len > 0 && buf[nl - 1] == '\r') {
+					--len;
+				}
+				tsdb_telnet_line(buf.substr(used, len), st, reply);
+				used = nl + 1;
+			}
+		}
+		buf.erase(0, used);
+		if (!reply.empty() && !send_all(conn.fd, reply.data(), reply.size())) {
+			break;
+		}
+	}
+	close(conn.fd);
+	return NULL;
+}
+
+/**
+ * Accepts connections on a background thread, one detached thread per
+ *  connection
+ */
+class TsdbServer {
+private:
+	int listenfd;
+	pthread_t acceptor;
+
+	static void* accept_loop(void *arg) {
+		TsdbServer *self = (TsdbServer*) arg;
+		int fd;
+		while ((fd = accept(self->listenfd, NULL, NULL)) >= 0) {
+			set_nodelay(fd);
+			TsdbConn *conn = new TsdbConn;
+			conn->fd = fd;
+			conn->stats = &self->stats;
+			pthread_t t;
+			if (0 != pthread_create(&t, NULL, tsdb_conn_thread, conn)) {
+				close(fd);
+				delete conn;
+				continue;
+			}
+			pthread_detach(t);
+		}
+		return NULL;
+	}
+
+public:
+	TsdbServerStats stats;
+	int port;
+
+	TsdbServer() : listenfd(-1), port(0) {
+		memset((void*) &stats, 0, sizeof(stats));
+	}
+
+	/**
+	 * @param _port port to listen on, 0 for any free one (see port)
+	 */
+	bool start(int _port) {
+		listenfd = socket(AF_INET, SOCK_STREAM, 0);
+		if (listenfd < 0) {
+			return false;
+		}
+		int one = 1;
+		setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port = htons(_port);
+		socklen_t alen = sizeof(addr);
+		if (bind(listenfd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(listenfd, 128) < 0 ||
+				getsockname(listenfd, (struct sockaddr*) &addr, &alen) < 0) {
+			close(listenfd);
+			return false;
+		}
+		port = ntohs(addr.sin_port);
+		return 0 == pthread_create(&acceptor, NULL, accept_loop, this);
+	}
+
+	/**
+	 * @brief Stop accepting; open connections run until their peers close
+	 */
+	void stop() {
+		shutdown(listenfd, SHUT_RDWR);
+		close(listenfd);
+		pthread_join(acceptor, NULL);
+	}
+};
+
+/**
+ * @brief Run a stand-in server on port forever, reporting puts per second
+ */
+void serve_opentsdb(int port) {
+	TsdbServer server;
+	if (!server.start(port)) {
+		cerr << "could not listen on port " << port << endl;
+		return;
+	}
+	cerr << "listening on port " << server.port << endl;
+	long last = 0;
+	for (;;) {
+		sleep(1);
+		long puts = server.stats.puts;
+		cerr << "puts/sec " << (puts - last) << " total " << puts << " errors " << server.stats.errors
+				<< " connections " << server.stats.conns << endl;
+		last = puts;
+	}
+}
+
+int tcp_connect(const string &host, int port) {
+	struct addrinfo hints;
+	struct addrinfo *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	char portstr[16];
+	sprintf(portstr, "%d", port);
+	if (0 != getaddrinfo(host.c_str(), portstr, &hints, &res)) {
+		return -1;
+	}
+	int fd = -1;
+	for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd >= 0 && 0 == connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+			break;
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd >= 0) {
+		set_nodelay(fd);
+	}
+	return fd;
+}
+
+/**
+ * One connection's share of the load: value streams whose metric number
+ *  m<N> has (N - 1) % nconns == c, read group by group through GroupReader
+ *  (so reordered with --lateness) and sent as batches of --batch puts,
+ *  with up to --pipeline batches awaiting their reply. Telnet puts have no
+ *  reply, so every telnet batch ends with a "version" probe whose two line
+ *  answer marks the batch done.
+ */
+struct TsdbDriver {
+	DataMulti *data;
+	vector<map<string, set<string> >::const_iterator> groups;
+	//value stream -> metric number, in stream name order from 1
+	map<string, int> metricdx;
+	string host;
+	int port;
+	bool http;
+	size_t batch;
+	size_t pipeline;
+	size_t nconns;
+
+	vector<vector<double> > latencies;
+	vector<long> puts;
+	vector<long> failures;
+
+	struct Conn {
+		int fd;
+		string rbuf;
+		deque<double> inflight;
+	};
+
+	/**
+	 * @brief Wait for the oldest batch's reply
+	 */
+	bool read_reply(Conn &conn, size_t c) {
+		char chunk[4096];
+		for (;;) {
+			if (http) {
+				size_t clen;
+				size_t hdr = http_headers(conn.rbuf.data(), conn.rbuf.size(), clen);
+				if (hdr && conn.rbuf.size() >= hdr + clen) {
+					if (conn.rbuf.compare(0, 10, "HTTP/1.1 2") != 0) {
+						++failures[c];
+					}
+					conn.rbuf.erase(0, hdr + clen);
+					break;
+				}
+			} else {
+				size_t nl = conn.rbuf.find('\n');
+				if (nl != string::npos) {
+					string line = conn.rbuf.substr(0, nl);
+					conn.rbuf.erase(0, nl + 1);
+					//error lines come ahead of the probe's answer, whose
+					// last line is the "Built on" one
+					if (0 == line.compare(0, 4, "put:") || 0 == line.compare(0, 7, "unknown")) {
+						++failures[c];
+						continue;
+					}
+					if (0 == line.compare(0, 8, "Built on")) {
+						break;
+					}
+					continue;
+				}
+			}
+			ssize_t r = recv(conn.fd, chunk, sizeof(chunk), 0);
+			if (r <= 0) {
+				return false;
+			}
+			conn.rbuf.append(chunk, r);
+		}
+		latencies[c].push_back(wall_seconds() - conn.inflight.front());
+		conn.inflight.pop_front();
+		return true;
+	}
+
+	bool send_batch(Conn &conn, size_t c, string body, long nputs) {
+		if (0 == nputs) {
+			return true;
+		}
+		string req;
+		if (http) {
+			//objects come with trailing commas
+			body[body.size() - 1] = ']';
+			char head[256];
+			sprintf(head, "POST /api/put HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+					"Content-Length: %d\r\n\r\n[", host.c_str(), (int) body.size() + 1);
+			req = head + body;
+		} else {
+			req = body + "version\n";
+		}
+		conn.inflight.push_back(wall_seconds());
+		if (!send_all(conn.fd, req.data(), req.size())) {
+			return false;
+		}
+		puts[c] += nputs;
+		while (conn.inflight.size() >= pipeline) {
+			if (!read_reply(conn, c)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void operator()(size_t c) {
+		Conn conn;
+		conn.fd = tcp_connect(host, port);
+		if (conn.fd < 0) {
+			cerr << "could not connect to " << host << ":" << port << endl;
+			return;
+		}
+
+		stringstream body;
+		long pending = 0;
+		bool ok = true;
+		size_t blockrows = group_block_rows();
+		char metricname[32];
+		for (size_t g = 0; ok && g < groups.size(); ++g) {
+			//this connection's columns of the group
+			vector<unsigned> cols;
+			unsigned col = 0;
+			for (set<string>::const_iterator it = (*groups[g]).second.begin(); it != (*groups[g]).second.end();
+					++it, ++col) {
+				if ((size_t) (metricdx.find(*it)->second - 1) % nconns == c) {
+					cols.push_back(col);
+				}
+			}
+			if (cols.empty()) {
+				continue;
+			}
+
+			GroupReader *group = open_group(*data, groups[g]);
+			if (!group->ok()) {
+				cerr << "could not find timestamp file " << group->tsname << endl;
+				delete group;
+				continue;
+			}
+			vector<OpenTsdbSeries*> series;
+			for (unsigned i = 0; i < cols.size(); ++i) {
+				sprintf(metricname, "m%d", metricdx.find(group->columns[cols[i]])->second);
+				series.push_back(new OpenTsdbSeries(metricname, "t=v", http ? TSDB_JSON : TSDB_TELNET));
+			}
+
+			GroupBlock blk;
+			while (ok && group->next(blk, blockrows)) {
+				for (size_t r = 0; ok && r < blk.nrows; ++r) {
+					for (unsigned i = 0; i < series.size(); ++i) {
+						long before = series[i]->ninserts;
+						series[i]->push(blk.ts[r], blk.vals[cols[i]][r], body);
+						pending += series[i]->ninserts - before;
+					}
+					if (pending >= (long) batch) {
+						ok = send_batch(conn, c, body.str(), pending);
+						body.str("");
+						pending = 0;
+					}
+				}
+			}
+			for (unsigned i = 0; i < series.size(); ++i) {
+				long before = series[i]->ninserts;
+				series[i]->finish(body, group->columns[cols[i]]);
+				pending += series[i]->ninserts - before;
+			}
+			for (unsigned i = 0; i < series.size(); ++i) {
+				delete series[i];
+			}
+			delete group;
+		}
+		if (ok) {
+			ok = send_batch(conn, c, body.str(), pending);
+		}
+		while (ok && !conn.inflight.empty()) {
+			ok = read_reply(conn, c);
+		}
+		if (!ok) {
+			cerr << "connection " << c << " failed" << endl;
+		}
+		close(conn.fd);
+	}
+};
+
+/**
+ * @brief Send every stream of data to an opentsdb (or stand-in) server
+ *  and report put throughput and batch round trip latency percentiles.
+ *  --proto=telnet|http, --conns, --batch puts per batch, --pipeline
+ *  batches in flight per connection.
+ * @returns puts sent
+ */
+long drive_opentsdb(DataMulti &dm, const string &host, int port, ostream &out) {
+	TsdbDriver driver;
+	driver.data = &dm;
+	for (map<string, set<string> >::const_iterator it = dm.begin(); it != dm.end(); ++it) {
+		driver.groups.push_back(it);
+	}
+	set<string> names = opentsdb_stream_names(dm);
+	int metricdx = 0;
+	for (set<string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+		driver.metricdx[*it] = ++metricdx;
+	}
+	driver.host = host;
+	driver.port = port;
+	driver.http = opt_str("proto", "telnet") == "http";
+	driver.batch = max(1L, opt_int("batch", 50));
+	driver.pipeline = max(1L, opt_int("pipeline", 1));
+	driver.nconns = max(1L, opt_int("conns", 4));
+	driver.latencies.resize(driver.nconns);
+	driver.puts.assign(driver.nconns, 0);
+	driver.failures.assign(driver.nconns, 0);
+
+	double start = wall_seconds();
+	parallel_for(driver.nconns, driver, driver.nconns);
+	double elapsed = wall_seconds() - start;
+
+	vector<double> lat;
+	long puts = 0;
+	long failures = 0;
+	for (size_t c = 0; c < driver.nconns; ++c) {
+		lat.insert(lat.end(), driver.latencies[c].begin(), driver.latencies[c].end());
+		puts += driver.puts[c];
+		failures += driver.failures[c];
+	}
+	sort(lat.begin(), lat.end());
+
+	out << (driver.http ? "http" : "telnet") << " conns " << driver.nconns << " batch " << driver.batch
+			<< " pipeline " << driver.pipeline << endl;
+	out << "puts " << puts << " in " << elapsed << "s, puts/sec " << (elapsed > 0 ? puts / elapsed : 0)
+			<< ", failed batches " << failures << endl;
+	if (!lat.empty()) {
+		const double qs[] = {0.5, 0.9, 0.99, 0.999};
+		out << "batch latency ms:";
+		for (int q = 0; q < 4; ++q) {
+			out << " p" << qs[q] * 100 << "=" << lat[min(lat.size() - 1, (size_t) (qs[q] * lat.size()))] * 1e3;
+		}
+		out << " max=" << lat.back() * 1e3 << endl;
+	}
+	return puts;
+}
+
+/**
+ * @brief Drive a stand-in server on an ephemeral local port and check
+ *  that it counted every put
+ */
+void bench_opentsdb_local(DataMulti &dm, ostream &out) {
+	TsdbServer server;
+	if (!server.start(0)) {
+		cerr << "could not start the stand-in server" << endl;
+		return;
+	}
+	long sent = drive_opentsdb(dm, "127.0.0.1", server.port, out);
+	server.stop();
+	out << "server counted " << server.stats.puts << " puts (" << (server.stats.puts == sent ? "all" : "MISMATCH")
+			<< "), " << server.stats.errors << " errors" << endl;
+}
+
+void test_opentsdb_net() {
+	DataMulti data("../testdata-multi/ts.merge", "../testdata-multi/vs",
+			getMergeMap("../testdata-multi/ts.merge/fmerge.sorted.txt"));
+	options()["proto"] = "telnet";
+	bench_opentsdb_local(data, cerr);
+	options()["proto"] = "http";
+	options()["pipeline"] = "4";
+	bench_opentsdb_local(data, cerr);
+	options().erase("proto");
+	options().erase("pipeline");
+}
+
+#endif /* TSDBNET_HPP_ */